@@ -17,7 +17,7 @@ set TARGET=%1
 if "%TARGET%"=="" set TARGET=vte
 
 if /I "%TARGET%"=="vte" (
-    gcc -Wall -Wextra -O2 -o "bin\\vte.exe" "src\\editor_curses.c" "src\\config.c" "src\\modules\\line_edit.c" "src\\modules\\buffer.c" "src\\modules\\syntax.c" "src\\modules\\navigation.c" "src\\modules\\status.c" "src\\modules\\undo.c" "src\\modules\\clipboard.c" "src\\internal\\resize.c" "src\\internal\\mouse.c" "src\\internal\\wrap.c" "src\\internal\\wrap_cache.c" "src\\internal\\utf8.c" "src\\internal\\utf8_edit.c" "src\\platform\\platform.c" -lpdcurses
+    gcc -Wall -Wextra -O2 -o "bin\\vte.exe" "src\\editor_curses.c" "src\\config.c" "src\\modules\\line_edit.c" "src\\modules\\buffer.c" "src\\modules\\line_diff.c" "src\\modules\\file_watch.c" "src\\modules\\stream.c" "src\\modules\\line_store.c" "src\\modules\\syntax.c" "src\\modules\\navigation.c" "src\\modules\\status.c" "src\\modules\\undo.c" "src\\modules\\undo_journal.c" "src\\modules\\clipboard.c" "src\\internal\\resize.c" "src\\internal\\mouse.c" "src\\internal\\wrap.c" "src\\internal\\wrap_cache.c" "src\\internal\\utf8.c" "src\\internal\\utf8_edit.c" "src\\internal\\input_queue.c" "src\\render\\render.c" "src\\render\\render_vt.c" "src\\platform\\platform.c" -lpdcurses
     if errorlevel 1 (
         echo Build failed
         exit /b 1
@@ -19,7 +19,7 @@ if (-not (Get-Command gcc -ErrorAction SilentlyContinue)) {
 New-Item -ItemType Directory -Force -Path .\bin | Out-Null
 
 if ($Target -eq 'vte') {
-    $src = @(Join-Path -Path $PSScriptRoot -ChildPath "src\\editor_curses.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\config.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\line_edit.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\buffer.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\syntax.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\navigation.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\status.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\undo.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\clipboard.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\resize.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\mouse.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\wrap.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\wrap_cache.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\utf8.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\utf8_edit.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\platform\\platform.c")
+    $src = @(Join-Path -Path $PSScriptRoot -ChildPath "src\\editor_curses.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\config.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\line_edit.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\buffer.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\line_diff.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\file_watch.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\stream.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\line_store.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\syntax.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\navigation.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\status.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\undo.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\undo_journal.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\modules\\clipboard.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\resize.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\mouse.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\wrap.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\wrap_cache.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\utf8.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\utf8_edit.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\internal\\input_queue.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\render\\render.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\render\\render_vt.c"), (Join-Path -Path $PSScriptRoot -ChildPath "src\\platform\\platform.c")
     $exe = Join-Path -Path $PSScriptRoot -ChildPath "bin\\vte.exe"
     if ($Wide) {
         $cflags = "-DPDC_WIDE"
@@ -21,16 +21,21 @@ mkdir -p bin
 
 # Build with ncurses
 echo "Building vte for Unix/Linux..."
-gcc -Wall -Wextra -O2 -D_XOPEN_SOURCE_EXTENDED \
+gcc -Wall -Wextra -O2 -D_XOPEN_SOURCE_EXTENDED -pthread \
     -o bin/vte \
     src/editor_curses.c \
     src/config.c \
     src/modules/line_edit.c \
     src/modules/buffer.c \
+    src/modules/line_diff.c \
+    src/modules/file_watch.c \
+    src/modules/stream.c \
+    src/modules/line_store.c \
     src/modules/syntax.c \
     src/modules/navigation.c \
     src/modules/status.c \
     src/modules/undo.c \
+    src/modules/undo_journal.c \
     src/modules/clipboard.c \
     src/internal/resize.c \
     src/internal/mouse.c \
@@ -38,6 +43,9 @@ gcc -Wall -Wextra -O2 -D_XOPEN_SOURCE_EXTENDED \
     src/internal/wrap_cache.c \
     src/internal/utf8.c \
     src/internal/utf8_edit.c \
+    src/internal/input_queue.c \
+    src/render/render.c \
+    src/render/render_vt.c \
     src/platform/platform.c \
     -lncurses
 
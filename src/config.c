@@ -12,6 +12,16 @@ void config_init(EditorConfig *cfg)
     cfg->expand_tabs = 1;
     cfg->scroll_offset = 3;
     cfg->syntax_enabled = 1;
+    cfg->undo_budget_kb = 8192;
+    cfg->undo_file = 1;
+    cfg->frame_cap_ms = 50;
+    cfg->esc_timeout_ms = 25;
+    cfg->vt_render = 1;
+    cfg->line_wrap = 1;
+    cfg->long_line_kb = 256;
+    cfg->fsync = 1;
+    cfg->journal_delay_ms = 200;
+    cfg->watch_files = 1;
 }
 
 int config_load(EditorConfig *cfg, const char *path)
@@ -60,7 +70,27 @@ int config_generate(const char *path)
     fprintf(f, "# Minimum lines to keep above/below cursor (0-20)\n");
     fprintf(f, "scroll_offset=3\n\n");
     fprintf(f, "# Enable syntax highlighting\n");
-    fprintf(f, "syntax=on\n");
+    fprintf(f, "syntax=on\n\n");
+    fprintf(f, "# Memory budget for undo history in KiB (64-1048576)\n");
+    fprintf(f, "undo_budget=8192\n\n");
+    fprintf(f, "# Keep undo history across sessions in .<file>.vteundo\n");
+    fprintf(f, "undo_file=on\n\n");
+    fprintf(f, "# Redraw at least every N ms while keys are still queued (0-1000, 0 = only when idle)\n");
+    fprintf(f, "frame_cap=50\n\n");
+    fprintf(f, "# Wait N ms after Esc for the rest of an arrow/function key (0-1000)\n");
+    fprintf(f, "esc_timeout=25\n\n");
+    fprintf(f, "# Draw the screen with the built-in VT100 renderer (off = through curses)\n");
+    fprintf(f, "vt_render=on\n\n");
+    fprintf(f, "# Wrap long lines on screen (off = one row per line, scroll sideways)\n");
+    fprintf(f, "wrap=on\n\n");
+    fprintf(f, "# Lines of at least this many KiB are indexed in chunks so edits and scrolling do not rescan them (0 = never)\n");
+    fprintf(f, "long_line=256\n\n");
+    fprintf(f, "# Flush a saved file to disk before it replaces the original (off = faster, less safe on power loss)\n");
+    fprintf(f, "fsync=on\n\n");
+    fprintf(f, "# Milliseconds edits gather before the undo journal writes them (a crash loses at most this much typing)\n");
+    fprintf(f, "journal_delay=200\n\n");
+    fprintf(f, "# Reload a file when another program changes it, unless the buffer has unsaved changes (then only warn)\n");
+    fprintf(f, "watch=on\n");
 
     fclose(f);
     return 0;
@@ -154,6 +184,96 @@ int config_set(EditorConfig *cfg, const char *cmd, char *status_out, size_t stat
         snprintf(status_out, status_len, "syntax = %s", cfg->syntax_enabled ? "on" : "off");
         return 0;
     }
+    else if (strcmp(setting, "undobudget") == 0 || strcmp(setting, "undo_budget") == 0)
+    {
+        int val = atoi(value);
+        if (val >= 64 && val <= 1048576)
+        {
+            cfg->undo_budget_kb = val;
+            snprintf(status_out, status_len, "undo_budget = %d KiB", val);
+            return 0;
+        }
+        snprintf(status_out, status_len, "Invalid undo_budget (must be 64-1048576 KiB)");
+        return -1;
+    }
+    else if (strcmp(setting, "undofile") == 0 || strcmp(setting, "undo_file") == 0)
+    {
+        cfg->undo_file = parse_bool(value);
+        snprintf(status_out, status_len, "undo_file = %s", cfg->undo_file ? "on" : "off");
+        return 0;
+    }
+    else if (strcmp(setting, "framecap") == 0 || strcmp(setting, "frame_cap") == 0)
+    {
+        int val = atoi(value);
+        if (val >= 0 && val <= 1000)
+        {
+            cfg->frame_cap_ms = val;
+            snprintf(status_out, status_len, "frame_cap = %d ms", val);
+            return 0;
+        }
+        snprintf(status_out, status_len, "Invalid frame_cap (must be 0-1000 ms)");
+        return -1;
+    }
+    else if (strcmp(setting, "esctimeout") == 0 || strcmp(setting, "esc_timeout") == 0)
+    {
+        int val = atoi(value);
+        if (val >= 0 && val <= 1000)
+        {
+            cfg->esc_timeout_ms = val;
+            snprintf(status_out, status_len, "esc_timeout = %d ms", val);
+            return 0;
+        }
+        snprintf(status_out, status_len, "Invalid esc_timeout (must be 0-1000 ms)");
+        return -1;
+    }
+    else if (strcmp(setting, "vtrender") == 0 || strcmp(setting, "vt_render") == 0)
+    {
+        cfg->vt_render = parse_bool(value);
+        snprintf(status_out, status_len, "vt_render = %s", cfg->vt_render ? "on" : "off");
+        return 0;
+    }
+    else if (strcmp(setting, "wrap") == 0)
+    {
+        cfg->line_wrap = parse_bool(value);
+        snprintf(status_out, status_len, "wrap = %s", cfg->line_wrap ? "on" : "off");
+        return 0;
+    }
+    else if (strcmp(setting, "longline") == 0 || strcmp(setting, "long_line") == 0)
+    {
+        int val = atoi(value);
+        if (val >= 0 && val <= 1048576)
+        {
+            cfg->long_line_kb = val;
+            snprintf(status_out, status_len, "long_line = %d KiB", val);
+            return 0;
+        }
+        snprintf(status_out, status_len, "Invalid long_line (must be 0-1048576 KiB)");
+        return -1;
+    }
+    else if (strcmp(setting, "fsync") == 0)
+    {
+        cfg->fsync = parse_bool(value);
+        snprintf(status_out, status_len, "fsync = %s", cfg->fsync ? "on" : "off");
+        return 0;
+    }
+    else if (strcmp(setting, "journaldelay") == 0 || strcmp(setting, "journal_delay") == 0)
+    {
+        int val = atoi(value);
+        if (val >= 0 && val <= 10000)
+        {
+            cfg->journal_delay_ms = val;
+            snprintf(status_out, status_len, "journal_delay = %dms", val);
+            return 0;
+        }
+        snprintf(status_out, status_len, "Invalid journal_delay (must be 0-10000ms)");
+        return -1;
+    }
+    else if (strcmp(setting, "autoread") == 0 || strcmp(setting, "watch") == 0)
+    {
+        cfg->watch_files = parse_bool(value);
+        snprintf(status_out, status_len, "watch = %s", cfg->watch_files ? "on" : "off");
+        return 0;
+    }
 
     snprintf(status_out, status_len, "Unknown setting: %s", setting);
     return -1;
@@ -162,11 +282,21 @@ int config_set(EditorConfig *cfg, const char *cmd, char *status_out, size_t stat
 void config_show(const EditorConfig *cfg, char *out, size_t len)
 {
     snprintf(out, len,
-             "tab_width=%d auto_indent=%s line_numbers=%s expand_tabs=%s scroll_offset=%d syntax=%s",
+             "tab_width=%d auto_indent=%s line_numbers=%s expand_tabs=%s scroll_offset=%d syntax=%s undo_budget=%d undo_file=%s frame_cap=%d esc_timeout=%d vt_render=%s wrap=%s long_line=%d fsync=%s journal_delay=%d watch=%s",
              cfg->tab_width,
              cfg->auto_indent ? "on" : "off",
              cfg->show_line_numbers ? "on" : "off",
              cfg->expand_tabs ? "on" : "off",
              cfg->scroll_offset,
-             cfg->syntax_enabled ? "on" : "off");
+             cfg->syntax_enabled ? "on" : "off",
+             cfg->undo_budget_kb,
+             cfg->undo_file ? "on" : "off",
+             cfg->frame_cap_ms,
+             cfg->esc_timeout_ms,
+             cfg->vt_render ? "on" : "off",
+             cfg->line_wrap ? "on" : "off",
+             cfg->long_line_kb,
+             cfg->fsync ? "on" : "off",
+             cfg->journal_delay_ms,
+             cfg->watch_files ? "on" : "off");
 }
@@ -11,6 +11,16 @@ typedef struct
     int expand_tabs;       /* Convert tabs to spaces */
     int scroll_offset;     /* Min lines to keep above/below cursor when scrolling */
     int syntax_enabled;    /* Enable syntax highlighting */
+    int undo_budget_kb;    /* Memory budget for undo/redo history in KiB */
+    int undo_file;         /* Persist undo history in a journal next to each file */
+    int frame_cap_ms;      /* Longest time in ms the screen may lag behind queued input */
+    int esc_timeout_ms;    /* How long to wait after Esc for the rest of a key sequence, in ms */
+    int vt_render;         /* Draw with the built-in VT100 renderer instead of curses */
+    int line_wrap;         /* Wrap long lines (off = one row per line, scroll horizontally) */
+    int long_line_kb;      /* Lines of at least this many KiB get the long-line index (0 = never) */
+    int fsync;             /* Flush saved files to disk before they replace the original */
+    int journal_delay_ms;  /* How long edits gather before the undo journal writes them, ms */
+    int watch_files;       /* Reload files other programs change (buffers without changes of their own) */
 } EditorConfig;
 
 /* Initialize config with defaults */
@@ -5,8 +5,19 @@
 #include "modules/line_edit.h"
 #include "config.h"
 
-#define MAX_LINES 65536
 #define LINE_CAP 8192
+/* Resize reports closer together than this are handled as one */
+#define RESIZE_SETTLE_MS 30
+/* Lines the idle wrap-count fill does between checks for input */
+#define WRAP_FILL_SLICE 2048
+/* Visual rows one wheel step scrolls */
+#define MOUSE_SCROLL_ROWS 3
+/* How often the status line follows a background save while no keys come in */
+#define SAVE_POLL_MS 100
+/* How often a followed file is looked at for new lines while no keys come in */
+#define FOLLOW_POLL_MS 100
+/* Bytes of a followed file (or of stdin) taken in between checks for input */
+#define FOLLOW_SLICE ((size_t)4 * 1024 * 1024)
 typedef enum
 {
     MODE_NORMAL,
@@ -16,11 +27,14 @@ typedef enum
 } Mode;
 
 #include "modules/buffer.h"
+#include "modules/line_store.h"
 #include "modules/syntax.h"
 #include "modules/navigation.h"
 #include "modules/status.h"
 #include "modules/undo.h"
 #include "modules/clipboard.h"
+#include "modules/file_watch.h"
+#include "modules/stream.h"
 #include "internal/resize.h"
 #include "internal/mouse.h"
 #include "internal/wrap.h"
@@ -29,6 +43,39 @@ typedef enum
 #include "internal/wrap_cache.h"
 #include "internal/utf8_edit.h"
 #include "platform/platform.h"
+#include "render/render.h"
+
+/* Input-to-paint latency: from a key's arrival to the frame that shows it */
+static struct
+{
+    long since; /* arrival of the oldest key not painted yet, -1 if none */
+    long last, worst, total, frames;
+} latency = {-1, 0, 0, 0, 0};
+
+/* Time spent in draw_screen(), composing and sending a frame */
+static struct
+{
+    long long last, worst, total, frames;
+} frame_cost;
+
+static void latency_key(void)
+{
+    if (latency.since < 0)
+        latency.since = utf8_key_time();
+}
+
+static void latency_painted(void)
+{
+    if (latency.since < 0)
+        return;
+    long ms = platform_now_ms() - latency.since;
+    latency.last = ms;
+    if (ms > latency.worst)
+        latency.worst = ms;
+    latency.total += ms;
+    latency.frames++;
+    latency.since = -1;
+}
 
 static void show_help(void)
 {
@@ -38,11 +85,13 @@ static void show_help(void)
         "Modes:",
         "  NORMAL - navigate and enter commands/insert",
         "  INSERT - type text (press Esc to return to NORMAL)",
-        "  COMMAND - press : to enter, supports :w, :w filename, :q, :wq, :h, :help",
+        "  COMMAND - press : to enter, supports :w, :w filename, :q, :wq, :h, :help, :recover, :follow",
         "",
         "Mouse:",
         "  Single-click to move the cursor (works in NORMAL and INSERT modes)",
         "  Click mapping respects visual wrapping (long lines wrap on screen)",
+        "  Drag to select text; it is copied to the unnamed register",
+        "  Wheel scrolls the view, taking the cursor along at the edges",
         "",
         "Normal mode keys:",
         "  h/j/k/l    - left/down/up/right",
@@ -52,8 +101,10 @@ static void show_help(void)
         "  /          - pattern search mode",
         "  n          - find next match (forward)",
         "  N          - find previous match (backward)",
-        "  y          - yank (copy) current line",
-        "  p          - paste yanked content",
+        "  yy / Nyy   - yank (copy) current line / N lines",
+        "  dd / Ndd   - delete current line / N lines (yanked first)",
+        "  p / P      - paste after / before the current line",
+        "  \"a         - use register a (a-z) for the next yank or paste",
         "  Ctrl+Z     - undo last change",
         "  Ctrl+Y     - redo last undone change",
         "",
@@ -73,6 +124,9 @@ static void show_help(void)
         "  /pattern   - search forward for 'pattern'",
         "  :set       - show current settings",
         "  :set name=value - change a setting",
+        "  :latency   - show input-to-paint latency and frame cost",
+        "  :recover   - replay changes an earlier session left unsaved",
+        "  :follow    - follow the file as it grows, like tail -f (again to stop)",
         "  :q         - quit (all buffers)",
         "  :wq        - save current buffer and quit",
         "  :h or :help- show this help",
@@ -91,7 +145,6 @@ static void show_help(void)
 
     int rows, cols;
     getmaxyx(stdscr, rows, cols);
-    (void)cols; /* suppress unused warning */
     int offset = 0;
     int max_offset = total_lines - rows;
     if (max_offset < 0)
@@ -99,20 +152,23 @@ static void show_help(void)
 
     while (1)
     {
-        clear();
+        render_clear();
         for (int r = 0; r < rows && offset + r < total_lines; ++r)
         {
-            mvprintw(r, 0, "%s", help_lines[offset + r]);
+            const char *text = help_lines[offset + r];
+            render_text(r, 0, text, strlen(text), cols);
         }
-        refresh();
+        render_flush(-1, 0);
+        latency_painted();
 
-        int ch = getch();
-        if (ch == 'j' || ch == KEY_DOWN)
+        int ch = utf8_getch();
+        latency_key();
+        if (ch == 'j' || ch == UTF8_KEY(KEY_DOWN))
         {
             if (offset < max_offset)
                 offset++;
         }
-        else if (ch == 'k' || ch == KEY_UP)
+        else if (ch == 'k' || ch == UTF8_KEY(KEY_UP))
         {
             if (offset > 0)
                 offset--;
@@ -126,23 +182,28 @@ static void show_help(void)
             break; /* any other key exits */
         }
     }
-    clear();
+    render_clear();
 }
 
-static void get_command_line(int row, char *out, int maxlen)
+static void get_command_line(int row, char prompt, char *out, int maxlen)
 {
     int pos = 0, len = 0;
     out[0] = '\0';
     int rows, cols;
     getmaxyx(stdscr, rows, cols);
     (void)rows;
-    (void)cols;
     while (1)
     {
-        int c = getch();
+        render_text(row, 0, &prompt, 1, 1);
+        render_text(row, 1, out, (size_t)len, cols - 1);
+        render_flush(row, 1 + pos);
+        latency_painted();
+
+        int c = utf8_getch();
+        latency_key();
         if (c == '\r' || c == '\n')
             break;
-        else if (c == KEY_BACKSPACE || c == 127 || c == 8)
+        else if (c == UTF8_KEY(KEY_BACKSPACE) || c == 127 || c == 8)
         {
             if (pos > 0)
             {
@@ -165,19 +226,354 @@ static void get_command_line(int row, char *out, int maxlen)
                 out[len] = '\0';
             }
         }
-        mvprintw(row, 1, "%s", out);
-        clrtoeol();
-        move(row, 1 + pos);
-        refresh();
     }
 }
 
-static void draw_screen(Buffer *b, size_t cx, size_t cy, size_t rowoff, size_t coloff, Mode mode, const char *status, LineEdit *le, int le_active, int line_num_width, WrapCache *wc)
+/* Status text for a finished save of 'name': the size and the write rate */
+static void format_save(char *out, size_t len, const char *name, size_t bytes, long long us)
+{
+    double ms = us > 0 ? us / 1000.0 : 0.001;
+    if (bytes >= 1024 * 1024)
+        snprintf(out, len, "\"%.160s\" written: %.1f MB in %.0f ms (%.0f MB/s)", name, bytes / 1048576.0, ms,
+                 bytes / 1048576.0 / (ms / 1000.0));
+    else
+        snprintf(out, len, "\"%.160s\" written: %zu bytes in %.1f ms", name, bytes, ms);
+}
+
+/* The save running on the writer thread, if any, and the file name it reports */
+static BufferSave *saving;
+static char saving_name[240];
+static int saving_shown = -1;
+
+/* Wait for the running save and put its result in the status line; returns 0 on success */
+static int save_end(char *status, size_t len)
+{
+    size_t bytes = 0;
+    long long us = 0;
+    int result = buffer_save_finish(saving, &bytes, &us);
+    saving = NULL;
+    if (result == 0)
+        format_save(status, len, saving_name, bytes, us);
+    else
+        snprintf(status, len, "Save failed: %s", saving_name);
+    return result;
+}
+
+/* Show how far the running save is, or its result once the writer is done */
+static void save_follow(char *status, size_t len)
+{
+    if (!saving)
+        return;
+    int percent = buffer_save_progress(saving);
+    if (percent == 100)
+        save_end(status, len);
+    else if (percent != saving_shown)
+        snprintf(status, len, "Saving \"%s\": %d%%", saving_name, percent);
+    saving_shown = percent;
+}
+
+/* Start saving the current buffer to 'path' in the background; editing goes on meanwhile */
+static void save_begin(const char *path, char *status, size_t len)
+{
+    if (saving)
+    {
+        snprintf(status, len, "Still saving %s", saving_name);
+        return;
+    }
+    saving = buffer_save_start(path);
+    if (!saving)
+    {
+        snprintf(status, len, "Save failed");
+        return;
+    }
+    snprintf(saving_name, sizeof(saving_name), "%.*s", (int)(sizeof(saving_name) - 1), path);
+    saving_shown = -1;
+    save_follow(status, len);
+}
+
+/* Line 'i' as currently displayed: the line editor owns line cy while editing */
+static const char *display_line(Buffer *b, size_t i, size_t cy, LineEdit *le)
+{
+    if (le && le->buf && i == cy)
+        return le_cstr(le);
+    return b->lines[i];
+}
+
+/* Scratch space for composing one screen row (gutter, then text), and for the
+   visible part of a long line being edited */
+static char *row_buf;
+static size_t row_cap;
+static char *window_buf;
+static size_t window_cap;
+
+static char *scratch_reserve(char **buf, size_t *cap, size_t n)
+{
+    if (n > *cap)
+    {
+        size_t c = *cap ? *cap : 256;
+        while (c < n)
+            c *= 2;
+        char *nb = (char *)realloc(*buf, c);
+        if (!nb)
+            return NULL;
+        *buf = nb;
+        *cap = c;
+    }
+    return *buf;
+}
+
+/* Bytes read from a long line per screen column drawn: room for marks on top of
+   the widest UTF-8 sequence */
+#define WINDOW_BYTES_PER_COL 8
+
+/* The line editor owns line i and the line has a long-line index: it is read in
+   windows, since le_cstr() would move the gap across the whole line every frame */
+static int edited_long(size_t i, size_t cy, LineEdit *le, WrapCache *wc)
+{
+    return le && le->buf && i == cy && wrap_cache_is_long(wc, i);
+}
+
+/* Line i from byte 'from' on, NUL-terminated after at least n bytes or at the end
+   of the line. Valid until the next call. */
+static const char *line_window(Buffer *b, size_t i, size_t cy, LineEdit *le, WrapCache *wc, size_t from, size_t n)
+{
+    if (!edited_long(i, cy, le, wc))
+        return display_line(b, i, cy, le) + from;
+    if (from > le->len)
+        from = le->len;
+    if (n > le->len - from)
+        n = le->len - from;
+    if (!scratch_reserve(&window_buf, &window_cap, n + 1))
+        return "";
+    le_copy(le, from, n, window_buf);
+    window_buf[n] = '\0';
+    return window_buf;
+}
+
+/* Byte offset at which display column 'col' of line i starts */
+static size_t line_col_byte(Buffer *b, size_t i, size_t cy, LineEdit *le, WrapCache *wc, size_t col)
+{
+    if (!edited_long(i, cy, le, wc))
+        return wrap_cache_col_byte(wc, display_line(b, i, cy, le), i, col);
+    size_t rest, len;
+    size_t start = wrap_cache_long_col(wc, i, col, &rest, &len);
+    return col == 0 ? 0 : start + wrap_next_segment(line_window(b, i, cy, le, wc, start, len), 0, (int)rest);
+}
+
+/* Display column of byte offset 'byte' of line i */
+static size_t line_byte_col(Buffer *b, size_t i, size_t cy, LineEdit *le, WrapCache *wc, size_t byte)
+{
+    if (!edited_long(i, cy, le, wc))
+        return wrap_cache_byte_col(wc, display_line(b, i, cy, le), i, byte);
+    size_t col, len;
+    size_t start = wrap_cache_long_byte(wc, i, byte, &col, &len);
+    const char *chunk = line_window(b, i, cy, le, wc, start, byte - start);
+    return col + (size_t)wrap_cols_for_prefix(chunk, byte - start);
+}
+
+/* Visual rows of line i, without touching its text when the count is known */
+static int line_rows(Buffer *b, size_t i, size_t cy, LineEdit *le, WrapCache *wc)
+{
+    int v = wrap_cache_peek(wc, i);
+    return v >= 0 ? v : wrap_cache_get(wc, display_line(b, i, cy, le), i);
+}
+
+/* Tell the wrap cache about an edit of the line being edited: 'removed' bytes at
+   'at' gave way to 'inserted'. A long line's index follows it in place; any other
+   line is measured again when next drawn. */
+static void line_edited(WrapCache *wc, size_t cy, size_t at, const char *removed, size_t removed_len,
+                        const char *inserted, size_t inserted_len)
+{
+    if (!wrap_cache_long_edit(wc, cy, at, removed_len, (size_t)wrap_cols_for_prefix(removed, removed_len),
+                              inserted_len, (size_t)wrap_cols_for_prefix(inserted, inserted_len)))
+        wrap_cache_invalidate_line(wc, cy);
+}
+
+/* Line number right-aligned in width - 1 columns plus a space, i.e. "%*zu " without printf */
+static void format_gutter(char *dst, int width, size_t n)
+{
+    int i = width - 1;
+    dst[i] = ' ';
+    do
+    {
+        dst[--i] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0 && i > 0);
+    while (i > 0)
+        dst[--i] = ' ';
+}
+
+/* Text selected by dragging the mouse: line/col up to end_line/end_col, end excluded */
+typedef struct
+{
+    size_t line, col;
+    size_t end_line, end_col;
+} Selection;
+
+/* Selection between the drag anchor and the cursor, in file order */
+static Selection make_selection(size_t al, size_t ac, size_t cl, size_t cc)
+{
+    Selection s;
+    int anchor_first = al < cl || (al == cl && ac <= cc);
+    s.line = anchor_first ? al : cl;
+    s.col = anchor_first ? ac : cc;
+    s.end_line = anchor_first ? cl : al;
+    s.end_col = anchor_first ? cc : ac;
+    return s;
+}
+
+/* The selected text as a malloc'ed string, lines joined with '\n' */
+static char *selection_text(Buffer *b, const Selection *sel)
+{
+    size_t total = 0;
+    for (size_t i = sel->line; i <= sel->end_line && i < b->count; ++i)
+        total += line_len(b->lines[i]) + 1;
+    char *text = (char *)malloc(total + 1);
+    if (!text)
+        return NULL;
+    size_t n = 0;
+    for (size_t i = sel->line; i <= sel->end_line && i < b->count; ++i)
+    {
+        size_t len = line_len(b->lines[i]);
+        size_t from = i == sel->line ? (sel->col < len ? sel->col : len) : 0;
+        size_t to = i == sel->end_line ? (sel->end_col < len ? sel->end_col : len) : len;
+        if (to > from)
+        {
+            memcpy(text + n, b->lines[i] + from, to - from);
+            n += to - from;
+        }
+        if (i != sel->end_line)
+            text[n++] = '\n';
+    }
+    text[n] = '\0';
+    return text;
+}
+
+/* Screen row of the cursor counted from the top of the view (rowsub rows into line
+   rowoff), or -1 if it is above it. Only the lines in between are measured, and
+   the count stops once it is past 'limit'. */
+static int cursor_view_row(Buffer *b, size_t cx, size_t cy, size_t rowoff, size_t rowsub,
+                           LineEdit *le, WrapCache *wc, int wrap, int text_width, int limit)
+{
+    if (!wrap)
+    {
+        /* One row per line */
+        if (cy < rowoff)
+            return -1;
+        return cy - rowoff > (size_t)limit ? limit + 1 : (int)(cy - rowoff);
+    }
+    size_t crow = line_byte_col(b, cy, cy, le, wc, cx) / (size_t)text_width;
+    if (cy < rowoff || (cy == rowoff && crow < rowsub))
+        return -1;
+    long row = (long)(crow - rowsub);
+    for (size_t i = rowoff; i < cy && row <= limit; ++i)
+        row += line_rows(b, i, cy, le, wc);
+    return row > limit ? limit + 1 : (int)row;
+}
+
+/* Scroll so the cursor is on screen. The view is anchored at a buffer line
+   (rowoff) plus the visual rows of it scrolled off (rowsub), so this only ever
+   looks at wrap counts of lines around the viewport. Without wrapping rows are
+   lines and coloff follows the cursor column instead. */
+static void scroll_to_cursor(Buffer *b, size_t cx, size_t cy, size_t *rowoff, size_t *rowsub, size_t *coloff,
+                             LineEdit *le, WrapCache *wc, int wrap, int text_width, int max_display)
+{
+    if (*rowoff >= b->count)
+        *rowoff = b->count - 1;
+    if (!wrap)
+    {
+        *rowsub = 0;
+        if (cy < *rowoff)
+            *rowoff = cy;
+        else if (cy >= *rowoff + (size_t)max_display)
+            *rowoff = cy - max_display + 1;
+        /* Jump half a screen sideways, like vim, so typing at the edge doesn't redraw every key */
+        size_t ccol = line_byte_col(b, cy, cy, le, wc, cx);
+        size_t half = (size_t)text_width / 2;
+        if (ccol < *coloff)
+            *coloff = ccol > half ? ccol - half : 0;
+        else if (ccol >= *coloff + (size_t)text_width)
+            *coloff = ccol - half;
+        return;
+    }
+    *coloff = 0;
+    /* The top line may have been edited to fewer rows */
+    int top_rows = line_rows(b, *rowoff, cy, le, wc);
+    if (*rowsub >= (size_t)top_rows)
+        *rowsub = (size_t)top_rows - 1;
+
+    int row = cursor_view_row(b, cx, cy, *rowoff, *rowsub, le, wc, 1, text_width, max_display);
+    size_t crow = line_byte_col(b, cy, cy, le, wc, cx) / (size_t)text_width;
+    if (row < 0)
+    {
+        /* Above the view: put the cursor row at the top */
+        *rowoff = cy;
+        *rowsub = crow;
+    }
+    else if (row >= max_display)
+    {
+        /* Below it: walk back from the cursor row to fill the screen above it */
+        size_t top = cy, sub = crow;
+        size_t need = (size_t)max_display - 1;
+        while (need > 0)
+        {
+            if (sub > 0)
+            {
+                size_t take = sub < need ? sub : need;
+                sub -= take;
+                need -= take;
+            }
+            else if (top > 0)
+            {
+                top--;
+                sub = (size_t)line_rows(b, top, cy, le, wc);
+                need--;
+                sub--;
+            }
+            else
+                break;
+        }
+        *rowoff = top;
+        *rowsub = sub;
+    }
+}
+
+/* Compose one screen row: the gutter ('first' row of a line shows its number) and
+   the n bytes at 'seg', which start at byte 'at' of the line, with the selected part
+   highlighted */
+static void draw_row(int screen_row, size_t lineno, const char *seg, size_t n, size_t at, int first,
+                     int line_num_width, int cols, const Selection *sel)
+{
+    char *row = scratch_reserve(&row_buf, &row_cap, (size_t)line_num_width + n);
+    if (!row)
+        return;
+    /* Line number on the first visual row, blank gutter on continuations */
+    if (first)
+        format_gutter(row, line_num_width, lineno + 1);
+    else
+        memset(row, ' ', (size_t)line_num_width);
+    memcpy(row + line_num_width, seg, n);
+    render_text(screen_row, 0, row, (size_t)line_num_width + n, cols);
+    if (sel && lineno >= sel->line && lineno <= sel->end_line)
+    {
+        /* Part of the selection on this row, as columns of the segment */
+        size_t from = lineno == sel->line ? sel->col : 0;
+        size_t to = lineno == sel->end_line ? sel->end_col : at + n;
+        from = from > at ? from : at;
+        to = to < at + n ? to : at + n;
+        if (to > from)
+        {
+            int c0 = wrap_cols_for_prefix(seg, from - at);
+            int c1 = wrap_cols_for_prefix(seg, to - at);
+            render_highlight(screen_row, line_num_width + c0, c1 - c0);
+        }
+    }
+}
+
+static void draw_screen(Buffer *b, size_t cx, size_t cy, size_t rowoff, size_t rowsub, size_t coloff, Mode mode, const char *status, LineEdit *le, int le_active, int line_num_width, WrapCache *wc, int wrap, const Selection *sel)
 {
     int rows, cols;
     getmaxyx(stdscr, rows, cols);
-    /* Hide cursor during redraw to avoid flicker */
-    curs_set(0);
     size_t max_display = rows - 2;
 
     /* Available width for text excluding line numbers */
@@ -185,66 +581,56 @@ static void draw_screen(Buffer *b, size_t cx, size_t cy, size_t rowoff, size_t c
     if (text_width < 1)
         text_width = 1;
 
-    /* Determine which buffer line starts at the top, based on visual row offset */
-    size_t start_line = 0;
-    size_t skip_rows_in_first = 0;
-    size_t remain = rowoff;
-    for (size_t i = 0; i < b->count; ++i)
+    /* The view starts rowsub visual rows into line rowoff */
+    if (!(mode == MODE_INSERT && le_active))
+        le = NULL;
+    size_t start_line = rowoff < b->count ? rowoff : b->count - 1;
+    size_t skip_rows_in_first = rowsub;
+
+    /* Every screen row is composed in row_buf and handed over in one call */
+    size_t screen_row = 0;
+    if (!wrap)
     {
-        const char *ln = b->lines[i];
-        int vis = wrap_cache_get(wc, ln, i);
-        if ((size_t)vis > remain)
+        /* One row per line from column coloff on; no wrap counts are needed */
+        for (size_t lineno = start_line; lineno < b->count && screen_row < max_display; ++lineno, ++screen_row)
         {
-            start_line = i;
-            skip_rows_in_first = remain;
-            break;
-        }
-        remain -= (size_t)vis;
-        if (i + 1 == b->count)
-        {
-            start_line = i;
-            skip_rows_in_first = 0;
+            size_t pos = line_col_byte(b, lineno, cy, le, wc, coloff);
+            const char *text = line_window(b, lineno, cy, le, wc, pos, (size_t)text_width * WINDOW_BYTES_PER_COL);
+            size_t end = wrap_next_segment(text, 0, text_width);
+            draw_row((int)screen_row, lineno, text, end, pos, 1, line_num_width, cols, sel);
         }
     }
-
     /* Draw buffer lines with wrapping starting from the computed offset */
-    size_t screen_row = 0;
-    for (size_t lineno = start_line; lineno < b->count && screen_row < max_display; ++lineno)
+    for (size_t lineno = start_line; wrap && lineno < b->count && screen_row < max_display; ++lineno)
     {
-        const char *line = b->lines[lineno];
-        if (mode == MODE_INSERT && le_active && le && lineno == cy && le->buf)
-            line = le->buf;
-
-        /* First visual row: draw line number */
-        mvprintw((int)screen_row, 0, "%*zu ", line_num_width - 1, lineno + 1);
-
-        int max_rows_for_line = (int)(max_display - screen_row);
         size_t line_start_coloff = coloff;
         if (lineno == start_line && skip_rows_in_first > 0)
             line_start_coloff += skip_rows_in_first * (size_t)text_width;
 
-        int used = wrap_draw_line(line, (int)screen_row, line_num_width, text_width, line_start_coloff, max_rows_for_line);
-        if (used < 1)
-            used = 1;
-
-        for (int k = 1; k < used && screen_row + (size_t)k < max_display; ++k)
+        /* Only the part of the line that fits in the rows left is read */
+        size_t start = line_col_byte(b, lineno, cy, le, wc, line_start_coloff);
+        const char *text = line_window(b, lineno, cy, le, wc, start,
+                                       (max_display - screen_row) * (size_t)text_width * WINDOW_BYTES_PER_COL);
+        size_t pos = 0;
+        int first = 1;
+        do
         {
-            mvprintw((int)(screen_row + k), 0, "%*s ", line_num_width - 1, "");
-        }
-
-        screen_row += (size_t)used;
+            size_t end = wrap_next_segment(text, pos, text_width);
+            draw_row((int)screen_row, lineno, text + pos, end - pos, start + pos, first, line_num_width, cols, sel);
+            screen_row++;
+            first = 0;
+            if (end == pos)
+                break;
+            pos = end;
+        } while (text[pos] && screen_row < max_display);
     }
 
     /* Clear remaining rows below the last drawn content without erasing the whole screen */
     for (; screen_row < max_display; ++screen_row)
     {
         /* Blank gutter and text area for each leftover row */
-        mvprintw((int)screen_row, 0, "%*s ", line_num_width - 1, "");
-        /* Print padded empty segment to ensure text area is cleared */
-        mvprintw((int)screen_row, line_num_width, "%-*s", cols - line_num_width, "");
+        render_text((int)screen_row, 0, "", 0, cols);
     }
-    move(rows - 2, 0);
-    clrtoeol();
 
     /* Use status module to format status line */
     char mstr[16];
@@ -253,86 +639,340 @@ static void draw_screen(Buffer *b, size_t cx, size_t cy, size_t rowoff, size_t c
     status_format(status_line, sizeof(status_line), mstr, b->path,
                   buffer_index(), buffer_count(), b->dirty, cy, cx, cols);
 
-    mvprintw(rows - 2, 0, "%s", status_line);
+    render_text(rows - 2, 0, status_line, strlen(status_line), cols);
 
     /* Show status message if present */
     if (status && status[0])
     {
-        mvprintw(rows - 2, strlen(mstr) + strlen(b->path ? b->path : "[No file]") + 20, "  %s", status);
+        int at = (int)(strlen(mstr) + strlen(b->path ? b->path : "[No file]") + 20);
+        char msg[300];
+        int mlen = snprintf(msg, sizeof(msg), "  %s", status);
+        if (mlen > (int)sizeof(msg) - 1)
+            mlen = (int)sizeof(msg) - 1;
+        int mcols = wrap_cols_for_prefix(msg, (size_t)mlen);
+        if (at < cols)
+            render_text(rows - 2, at, msg, (size_t)mlen, mcols < cols - at ? mcols : cols - at);
     }
 
-    move(rows - 1, 0);
-    clrtoeol();
+    render_text(rows - 1, 0, "", 0, cols);
 
     /* Position cursor accounting for wrapping and line number column */
-    int vcursor = 0;
-    for (size_t i = 0; i < cy; ++i)
-    {
-        const char *ln = b->lines[i];
-        int vis = wrap_cache_get(wc, ln, i);
-        vcursor += vis;
-    }
-    const char *cur_line = (mode == MODE_INSERT && le_active && le && le->buf) ? le->buf : b->lines[cy];
-    int cx_cols = wrap_cols_for_prefix(cur_line, cx);
-    vcursor += cx_cols / text_width;
-
-    int curs_y = vcursor - (int)rowoff;
-    int curs_x = (cx_cols % text_width) + line_num_width;
+    int curs_y = cursor_view_row(b, cx, cy, rowoff, rowsub, le, wc, wrap, text_width, (int)max_display);
+    size_t ccol = line_byte_col(b, cy, cy, le, wc, cx);
+    int curs_x;
+    if (wrap)
+        curs_x = (int)(ccol % (size_t)text_width) + line_num_width;
+    else
+        curs_x = (int)(ccol - coloff) + line_num_width;
 
     /* Clamp cursor into visible area */
-    if (curs_y >= 0 && curs_y < (int)max_display && curs_x >= 0 && curs_x < cols)
-        move(curs_y, curs_x);
+    if (!(curs_y >= 0 && curs_y < (int)max_display && curs_x >= 0 && curs_x < cols))
+    {
+        curs_y = rows - 1;
+        curs_x = 0;
+    }
+    render_flush(curs_y, curs_x);
+}
 
-    /* Batch updates for smoother rendering and apply after final cursor move */
-    wnoutrefresh(stdscr);
-    doupdate();
+/* Hand the line being edited back to the buffer, recording the change for undo.
+   Returns 1 if the line changed; le is left empty either way. */
+static int commit_line_edit(Buffer *b, size_t cy, LineEdit *le, WrapCache *wc)
+{
+    LineEditChange change;
+    int changed = le_change(le, &change) &&
+                  undo_record_edit(b, cy, change.pos, change.removed, change.removed_len,
+                                   change.inserted, change.inserted_len);
+    char *line = le_release(le);
+    if (!line)
+        return 0;
+    /* Callers go on to change neighbouring slots too; after this they are the buffer's own */
+    buffer_own_lines(b);
+    b->lines[cy] = line;
+    if (changed)
+    {
+        b->dirty = 1;
+        /* A long line's index has followed each edit already (line_edited) */
+        if (!wrap_cache_is_long(wc, cy))
+            wrap_cache_invalidate_line(wc, cy);
+    }
+    return changed;
+}
 
-    /* Restore cursor visibility after redraw */
-    curs_set(1);
+/* Replace 'remove' lines at 'at' with 'lines' as one undoable step: a single splice of
+   the line array and a single wrap cache update. The buffer takes ownership of the
+   lines on success. */
+static int splice_lines(Buffer *b, size_t at, size_t remove, char **lines, size_t n, WrapCache *wc)
+{
+    /* reserve first so the recorded step cannot be left without its change */
+    if (buffer_reserve(b, b->count - remove + n) != 0)
+        return -1;
+    undo_record_lines(b, at, &b->lines[at], remove, lines, n);
+    if (buffer_splice_lines(b, at, remove, lines, n) != 0)
+        return -1;
+    wrap_cache_splice(wc, at, remove, n);
+    return 0;
 }
 
-int main(int argc, char **argv)
+/* Insert pasted text at cy:cx as one line splice and one undo step. Returns the number
+   of lines the text spans (0 on failure) and leaves cy/cx just after it. */
+static size_t paste_text(Buffer *b, size_t *cy, size_t *cx, const char *text, size_t len, WrapCache *wc)
 {
-    /* initialize buffer pool and set current buffer */
-    buffer_pool_init();
-    undo_init();
-    clipboard_init();
-    if (argc >= 2)
+    size_t n = 1;
+    for (size_t i = 0; i < len; ++i)
+        n += text[i] == '\n';
+    char **lines = (char **)malloc(n * sizeof(char *));
+    if (!lines)
+        return 0;
+    const char *cur = b->lines[*cy];
+    size_t cur_len = line_len(cur);
+    size_t at = *cx < cur_len ? *cx : cur_len;
+    size_t made = 0, start = 0, seg = 0;
+    for (; made < n; ++made)
     {
-        if (buffer_open_file(argv[1]) < 0)
+        const char *nl = (const char *)memchr(text + start, '\n', len - start);
+        seg = nl ? (size_t)(nl - (text + start)) : len - start;
+        /* the first line keeps the text before the cursor, the last one the text after it */
+        size_t pre = made == 0 ? at : 0;
+        size_t post = made == n - 1 ? cur_len - at : 0;
+        char *line = line_new(pre ? cur : text + start, pre ? pre : seg);
+        if (line && (pre || post))
         {
-            Buffer *buf = buffer_current();
-            fprintf(stderr, "Could not open '%s' - starting empty\n", argv[1]);
-            buf->lines[0] = malloc(1);
-            buf->lines[0][0] = '\0';
-            buf->count = 1;
-            if (buf->path)
+            char *grown = line_writable(line, pre + seg + post);
+            if (!grown)
+            {
+                line_release(line);
+                line = NULL;
+            }
+            else
             {
-                free(buf->path);
-                buf->path = NULL;
+                line = grown;
+                if (pre)
+                    memcpy(line + pre, text + start, seg);
+                memcpy(line + pre + seg, cur + at, post);
+                line_set_len(line, pre + seg + post);
             }
-            buf->dirty = 0;
         }
+        if (!line)
+            break;
+        lines[made] = line;
+        start += seg + 1;
+    }
+    if (made < n || splice_lines(b, *cy, 1, lines, n, wc) != 0)
+    {
+        for (size_t i = 0; i < made; ++i)
+            line_release(lines[i]);
+        free(lines);
+        return 0;
+    }
+    free(lines);
+    *cx = n == 1 ? at + seg : seg;
+    *cy += n - 1;
+    return n;
+}
+
+/* Point out changes an earlier session left unsaved in the buffer's undo journal */
+static void note_unsaved(Buffer *b, char *status, size_t len)
+{
+    if (b->path && undo_journal_has_unsaved(b))
+        snprintf(status, len, "%.180s has unsaved changes from an earlier session: :recover restores them", b->path);
+}
+
+/* Where line 'line' went when a reload put the hunks in; *same is 0 if it was replaced */
+static size_t reload_line(const LineHunk *h, size_t n, size_t line, int *same)
+{
+    *same = 1;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (line < h[i].old_at)
+            return line + h[i].new_at - h[i].old_at;
+        if (line < h[i].old_at + h[i].removed)
+        {
+            size_t off = line - h[i].old_at;
+            *same = 0;
+            return h[i].new_at + (off < h[i].inserted ? off : h[i].inserted ? h[i].inserted - 1 : 0);
+        }
+    }
+    return n ? line + (h[n - 1].new_at + h[n - 1].inserted) - (h[n - 1].old_at + h[n - 1].removed) : line;
+}
+
+/* Reload buffer i after another program rewrote its file: only the lines that differ
+   change, and the view and the cursor stay on the same text. Returns 1 if there is
+   something new to show. */
+static int reload_file(int i, WrapCache *wc, size_t *cy, size_t *cx, size_t *rowoff, size_t *rowsub,
+                       char *status, size_t len)
+{
+    Buffer *b = buffer_at((size_t)i);
+    LineHunk *h;
+    size_t n;
+    if (buffer_reload(b, &h, &n) != 0)
+    {
+        snprintf(status, len, "\"%.200s\" changed on disk but could not be reloaded", b->path);
+        return 1;
+    }
+    if (n == 0)
+        return 0;
+    if (i == buffer_index())
+    {
+        /* from the last hunk, as the buffer took them */
+        for (size_t k = n; k-- > 0;)
+            wrap_cache_splice(wc, h[k].old_at, h[k].removed, h[k].inserted);
+        wrap_cache_ensure(wc, b->count);
+        int same;
+        *rowoff = reload_line(h, n, *rowoff, &same);
+        if (!same)
+            *rowsub = 0;
+        if (*rowoff >= b->count)
+            *rowoff = b->count - 1;
+        *cy = reload_line(h, n, *cy, &same);
+        if (*cy >= b->count)
+            *cy = b->count - 1;
+        if (!same)
+        {
+            const char *line = b->lines[*cy];
+            if (*cx > line_len(line))
+                *cx = line_len(line);
+            while (*cx > 0 && ((unsigned char)line[*cx] & 0xC0) == 0x80)
+                (*cx)--;
+        }
+    }
+    size_t lines = 0;
+    for (size_t k = 0; k < n; ++k)
+        lines += h[k].inserted > h[k].removed ? h[k].inserted : h[k].removed;
+    snprintf(status, len, "\"%.200s\" changed on disk: reloaded %zu line%s", b->path, lines, lines == 1 ? "" : "s");
+    free(h);
+    return 1;
+}
+
+/* Follow mode: take in what was appended to buffer i's file, FOLLOW_SLICE bytes at a
+   time. While the cursor is on the last line the view stays pinned to the end;
+   once it moved up, it stays where it is. Returns 1 if there is something new to
+   show (or more to read). */
+static int tail_file(int i, WrapCache *wc, size_t *cy, size_t *cx, size_t *rowoff, size_t *rowsub,
+                     char *status, size_t len)
+{
+    Buffer *b = buffer_at((size_t)i);
+    int current = i == buffer_index();
+    size_t old_count = b->count, first;
+    int pinned = current && *cy + 1 >= old_count;
+    int more = buffer_read_appended(b, FOLLOW_SLICE, &first);
+    if (more < 0)
+    {
+        /* truncated or replaced (log rotation): start over from what is there now */
+        int shown = reload_file(i, wc, cy, cx, rowoff, rowsub, status, len);
+        if (shown && pinned)
+        {
+            *cy = b->count - 1;
+            *cx = 0;
+            *rowoff = *rowsub = 0; /* the view fills up from the end again */
+        }
+        return shown;
+    }
+    if (first == b->count)
+        return 0;
+    if (current)
+    {
+        /* only the old last line and the new ones are measured again */
+        wrap_cache_splice(wc, first, old_count - first, b->count - first);
+        wrap_cache_ensure(wc, b->count);
+        if (pinned)
+        {
+            *cy = b->count - 1;
+            *cx = 0;
+        }
+    }
+    snprintf(status, len, "Following \"%.200s\": %zu lines%s", b->path, b->count, more ? " (reading)" : "");
+    return 1;
+}
+
+/* Another program changed the file of buffer i: reload or follow it if the buffer has
+   no changes of its own, else warn. Returns 1 if there is something new to show. */
+static int follow_file(int i, WrapCache *wc, size_t *cy, size_t *cx, size_t *rowoff, size_t *rowsub,
+                       char *status, size_t len)
+{
+    Buffer *b = buffer_at((size_t)i);
+    if (b->disk_size < 0)
+        snprintf(status, len, "\"%.200s\" was removed by another program", b->path);
+    else if (b->dirty)
+        snprintf(status, len, b->follow ? "\"%.200s\" grew; following waits until it is saved"
+                                        : "\"%.200s\" changed on disk; :w would overwrite it",
+                 b->path);
+    else if (b->follow)
+        return tail_file(i, wc, cy, cx, rowoff, rowsub, status, len);
+    else
+        return reload_file(i, wc, cy, cx, rowoff, rowsub, status, len);
+    return 1;
+}
+
+/* Stdin read into buffer i (vte -): append what the reader has, FOLLOW_SLICE bytes at
+   a time; with -f the view stays pinned to the end like follow mode. The stream is
+   closed once the data ended. Returns 1 if there is something new to show. */
+static int take_stream(Stream **stream, int i, WrapCache *wc, size_t *cy, size_t *cx, char *status, size_t len)
+{
+    Buffer *b = buffer_at((size_t)i);
+    int current = i == buffer_index();
+    size_t old_count = b->count;
+    int pinned = current && b->follow && *cy + 1 >= old_count;
+    size_t first = stream_take(*stream, b, FOLLOW_SLICE);
+    int failed, finished = stream_finished(*stream, &failed);
+    if (first == b->count && !finished)
+        return 0;
+    if (first < b->count && current)
+    {
+        wrap_cache_splice(wc, first, old_count - first, b->count - first);
+        wrap_cache_ensure(wc, b->count);
+        if (pinned)
+        {
+            *cy = b->count - 1;
+            *cx = 0;
+        }
+    }
+    if (finished)
+    {
+        snprintf(status, len, "Read %zu lines from stdin%s", stream_lines(*stream),
+                 failed ? " (incomplete: read error or out of memory)" : "");
+        stream_close(*stream);
+        *stream = NULL;
+        b->follow = 0;
     }
     else
+        snprintf(status, len, "Reading stdin: %zu lines", stream_lines(*stream));
+    return 1;
+}
+
+/* Add the files from the command line that have been read by now, or all of them if
+   'wait'; one that could not be opened is named in the status line. Returns 1 if
+   there is something new to show. */
+static int add_loaded(int wait, int follow, char *status, size_t len)
+{
+    const char *path;
+    int index, added = 0;
+    while (buffer_load_next(wait, &path, &index))
     {
-        Buffer *buf = buffer_current();
-        buf->lines[0] = malloc(1);
-        buf->lines[0][0] = '\0';
-        buf->count = 1;
-        buf->path = NULL;
-        buf->dirty = 0;
+        if (index < 0)
+            snprintf(status, len, "Could not open '%.200s'", path);
+        else
+            buffer_at((size_t)index)->follow = follow;
+        added = 1;
     }
+    return added;
+}
 
-    /* pointer to currently active buffer */
-    Buffer *buf = buffer_current();
-    /* wrap cache for current buffer */
-    WrapCache wc;
-    wrap_cache_init(&wc, buf->count);
-    size_t cx = 0, cy = 0, rowoff = 0, coloff = 0;
-    Mode mode = MODE_NORMAL;
-    char status[256] = "";
+/* Start a buffer with one empty line */
+static void buffer_start_empty(Buffer *b)
+{
+    char *empty = line_new("", 0);
+    if (empty && buffer_insert_line(b, 0, empty) != 0)
+        line_release(empty);
+    if (b->path)
+    {
+        free(b->path);
+        b->path = NULL;
+    }
+    b->dirty = 0;
+}
 
+int main(int argc, char **argv)
+{
     /* config state */
     EditorConfig config;
     config_init(&config);
@@ -342,15 +982,86 @@ int main(int argc, char **argv)
         config_generate(".vterc");
         config_load(&config, ".vterc");
     }
+    undo_set_budget((size_t)config.undo_budget_kb * 1024);
+    undo_set_persistent(config.undo_file);
+    undo_set_journal_delay(config.journal_delay_ms);
+    buffer_set_fsync(config.fsync);
+
+    /* initialize buffer pool and set current buffer */
+    buffer_pool_init();
+    clipboard_init();
+    /* vte [-f] [-] [file...]: -f follows the files as they grow, - reads stdin */
+    int arg = 1, follow = 0;
+    Stream *stream = NULL; /* stdin being read into buffer stream_buffer */
+    int stream_buffer = 0;
+    if (arg < argc && strcmp(argv[arg], "-f") == 0)
+    {
+        follow = 1;
+        arg++;
+    }
+    if (arg < argc && strcmp(argv[arg], "-") == 0)
+    {
+        /* before curses starts: the terminal takes stdin's place for the keys */
+        int fd = platform_stdin_take();
+        buffer_start_empty(buffer_current());
+        if (fd < 0)
+            fprintf(stderr, "Nothing to read on stdin - starting empty\n");
+        else if (!(stream = stream_start(fd)))
+        {
+            fprintf(stderr, "Could not read stdin - starting empty\n");
+            platform_close_fd(fd);
+        }
+        else
+        {
+            stream_buffer = buffer_index();
+            buffer_current()->follow = follow;
+        }
+        arg++;
+    }
+    if (arg < argc && buffer_load_start(argv + arg, (size_t)(argc - arg)) < (size_t)(argc - arg))
+        fprintf(stderr, "Only %d files can be open - the rest are left out\n", MAX_BUFFERS);
+    /* The files are read in parallel; the first one to open is waited for (unless
+       stdin is there to start with), the others come in while the editor runs */
+    const char *loaded;
+    int loaded_at;
+    while (buffer_current()->count == 0 && buffer_load_next(1, &loaded, &loaded_at))
+    {
+        if (loaded_at < 0)
+            fprintf(stderr, "Could not open '%s'\n", loaded);
+        else
+            buffer_at((size_t)loaded_at)->follow = follow;
+    }
+    if (buffer_current()->count == 0)
+        buffer_start_empty(buffer_current());
+
+    /* pointer to currently active buffer */
+    Buffer *buf = buffer_current();
+    /* wrap cache for current buffer */
+    WrapCache wc;
+    wrap_cache_init(&wc, buf->count);
+    /* The view starts rowsub visual rows into buffer line rowoff */
+    size_t cx = 0, cy = buf->follow ? buf->count - 1 : 0, rowoff = 0, rowsub = 0, coloff = 0;
+    Mode mode = MODE_NORMAL;
+    char status[256] = "";
+    note_unsaved(buf, status, sizeof(status));
 
     /* navigation state */
     NavState nav;
     nav_init(&nav);
 
+    /* NORMAL mode prefixes: "x selects a register, digits a count, y/d wait for the motion */
+    int reg = CLIP_UNNAMED;
+    int reg_pending = 0;
+    size_t count = 0;
+    int pending_op = 0;
+
+    /* mouse selection: from the drag anchor to the cursor while sel_active */
+    int dragging = 0, sel_active = 0;
+    size_t sel_line = 0, sel_col = 0;
+
     /* line editor state used only in INSERT mode */
     LineEdit le;
-    le.buf = NULL;
-    le.len = le.cap = le.pos = 0;
+    memset(&le, 0, sizeof(le));
     int le_active = 0;
 
     /* Enable locale so curses treats UTF-8 correctly */
@@ -361,24 +1072,45 @@ int main(int argc, char **argv)
     /* Prefer cbreak over raw: allows wide input to compose dead keys on Windows better */
     cbreak();
     noecho();
-    keypad(stdscr, TRUE);
+    utf8_input_init();
+    utf8_set_esc_timeout(config.esc_timeout_ms);
     /* Ensure 8-bit input is not stripped; preserve high-bit bytes */
     meta(stdscr, TRUE);
     curs_set(1);
     syntax_init();
     mouse_init();
+    utf8_paste_mode(1);
+    render_init(config.vt_render);
 
     int ch;
+    long last_draw = platform_now_ms();
+    int resize_pending = 0;
     while (1)
     {
+        /* A resize waits until the reports stop coming in, so dragging a window edge
+           reflows once per pause instead of once per step */
+        if (resize_pending && (!utf8_wait_input(RESIZE_SETTLE_MS) ||
+                               (config.frame_cap_ms > 0 && platform_now_ms() - last_draw >= config.frame_cap_ms)))
+        {
+            int old_width = wc.width;
+            handle_resize();
+            resize_pending = 0;
+            /* Keep the top line where it is; rowsub follows the column it started at */
+            int new_width = getmaxx(stdscr) - nav_calc_line_num_width(buf->count);
+            if (old_width > 0 && new_width > 0 && new_width != old_width)
+                rowsub = rowsub * (size_t)old_width / (size_t)new_width;
+        }
+
+        save_follow(status, sizeof(status));
+
         int rows, cols;
         getmaxyx(stdscr, rows, cols);
         /* Defensive: ensure minimum terminal size to prevent crashes */
         if (rows < 3 || cols < 10)
         {
-            clear();
-            mvprintw(0, 0, "Terminal too small");
-            refresh();
+            render_clear();
+            render_text(0, 0, "Terminal too small", 18, cols);
+            render_flush(-1, 0);
             ch = utf8_getch();
             if (ch == 'q' || ch == 27)
                 break;
@@ -389,22 +1121,113 @@ int main(int argc, char **argv)
         /* Calculate line number width */
         nav.line_num_width = nav_calc_line_num_width(buf->count);
 
-        /* Update wrap cache width and size for this frame */
-        wrap_cache_set_width(&wc, cols - nav.line_num_width < 1 ? 1 : cols - nav.line_num_width);
+        /* Update wrap cache width and size for this frame; without wrapping the counts
+           are not used, so they are kept for when it comes back on */
+        if (config.line_wrap)
+            wrap_cache_set_width(&wc, cols - nav.line_num_width < 1 ? 1 : cols - nav.line_num_width);
+        wrap_cache_set_long_min(&wc, (size_t)config.long_line_kb * 1024);
         wrap_cache_ensure(&wc, buf->count);
 
-        draw_screen(buf, cx, cy, rowoff, coloff, mode, status, &le, le_active, nav.line_num_width, &wc);
+        /* With keys already queued (key repeat, typeahead) handle them first and paint
+           once they run out, but never let the screen fall more than frame_cap behind */
+        if (!utf8_input_pending() ||
+            (config.frame_cap_ms > 0 && platform_now_ms() - last_draw >= config.frame_cap_ms))
+        {
+            long long t0 = platform_now_us();
+            scroll_to_cursor(buf, cx, cy, &rowoff, &rowsub, &coloff,
+                             mode == MODE_INSERT && le_active ? &le : NULL, &wc, config.line_wrap,
+                             cols - nav.line_num_width < 1 ? 1 : cols - nav.line_num_width, max_display);
+            Selection sel = make_selection(sel_line, sel_col, cy, cx);
+            draw_screen(buf, cx, cy, rowoff, rowsub, coloff, mode, status, &le, le_active, nav.line_num_width, &wc,
+                        config.line_wrap, sel_active ? &sel : NULL);
+            long long cost = platform_now_us() - t0;
+            frame_cost.last = cost;
+            if (cost > frame_cost.worst)
+                frame_cost.worst = cost;
+            frame_cost.total += cost;
+            frame_cost.frames++;
+            last_draw = platform_now_ms();
+            latency_painted();
+        }
+        /* While idle, work out the wrap counts of the rest of the file for the prefix index */
+        while (config.line_wrap && !utf8_input_pending() &&
+               wrap_cache_fill(&wc, buf->lines, WRAP_FILL_SLICE, mode == MODE_INSERT && le_active ? cy : (size_t)-1))
+            ;
+        /* Come back to update the status line while a save runs */
+        if (saving && !utf8_wait_input(SAVE_POLL_MS))
+            continue;
+        /* Typing stays in the line editor until it is committed: once the keys pause,
+           commit it (still one undo step, the group stays open) so the journal has it */
+        if (mode == MODE_INSERT && le_active && le.modified && config.undo_file &&
+            !utf8_wait_input(config.journal_delay_ms))
+        {
+            size_t pos = le.pos;
+            commit_line_edit(buf, cy, &le, &wc);
+            le_adopt(&le, buf->lines[cy]);
+            le.pos = pos;
+            continue;
+        }
+        /* Pick up files other programs changed, lines read from stdin and files from the
+           command line, now and while waiting for keys; a followed file is also read
+           on a timer, in case no notification comes */
+        int loading = buffer_load_pending() > 0;
+        if ((config.watch_files || buf->follow || stream || loading) && mode == MODE_NORMAL && !saving &&
+            !utf8_input_pending())
+        {
+            int shown = 0, changed;
+            do
+            {
+                if (loading)
+                    shown |= add_loaded(0, follow, status, sizeof(status));
+                if (stream)
+                    shown |= take_stream(&stream, stream_buffer, &wc, &cy, &cx, status, sizeof(status));
+                if (buf->follow && buf->path && !buf->dirty)
+                    shown |= tail_file(buffer_index(), &wc, &cy, &cx, &rowoff, &rowsub, status, sizeof(status));
+                while (config.watch_files && (changed = file_watch_next()) >= 0)
+                    shown |= follow_file(changed, &wc, &cy, &cx, &rowoff, &rowsub, status, sizeof(status));
+            } while (!shown &&
+                     !utf8_wait_input(buf->follow || stream || loading ? FOLLOW_POLL_MS : FILE_WATCH_POLL_MS));
+            if (shown)
+            {
+                sel_active = 0;
+                continue;
+            }
+        }
         ch = utf8_getch();
+        latency_key();
 
-        if (ch == KEY_RESIZE)
+        if (ch == UTF8_KEY(KEY_RESIZE))
         {
-            handle_resize();
-            /* Invalidate wrap cache on resize */
-            wrap_cache_invalidate_all(&wc);
+            /* Applied at the top of the loop; wrap counts follow the width there */
+            resize_pending = 1;
+            continue;
+        }
+
+        if (ch == KEY_PASTE_BEGIN)
+        {
+            /* Bracketed paste: take the whole payload at once instead of key by key */
+            size_t len = 0;
+            char *text = utf8_read_paste(&len);
+            if (mode == MODE_INSERT && le_active)
+            {
+                cx = le.pos;
+                commit_line_edit(buf, cy, &le, &wc);
+                le_active = 0;
+            }
+            size_t n = text && len > 0 ? paste_text(buf, &cy, &cx, text, len, &wc) : 0;
+            free(text);
+            if (mode == MODE_INSERT)
+            {
+                le_adopt(&le, buf->lines[cy]);
+                le.pos = cx < le.len ? cx : le.len;
+                le_active = 1;
+            }
+            if (n > 0)
+                snprintf(status, sizeof(status), n == 1 ? "Pasted" : "Pasted %zu lines", n);
             continue;
         }
 
-        if (ch == KEY_MOUSE)
+        if (ch == UTF8_KEY(KEY_MOUSE))
         {
             int text_width = cols - nav.line_num_width;
             if (text_width < 1)
@@ -413,78 +1236,166 @@ int main(int argc, char **argv)
             /* In INSERT mode, commit current line edits before moving the cursor/line. */
             if (mode == MODE_INSERT && le_active)
             {
-                char *committed = le_take_string(&le);
-                if (committed)
-                {
-                    free(buf->lines[cy]);
-                    buf->lines[cy] = committed;
-                    buf->dirty = 1;
-                }
-                le_free(&le);
+                commit_line_edit(buf, cy, &le, &wc);
                 le_active = 0;
             }
 
-            if (mouse_handle_click(&cx, &cy, &rowoff, buf->lines, buf->count, nav.line_num_width, max_display, text_width))
+            MouseView mv = {buf->lines, buf->count, &wc, config.line_wrap, rowoff, rowsub, coloff,
+                            nav.line_num_width, max_display, text_width};
+            size_t mx = cx, my = cy;
+            int moved = 0;
+            MouseAction action = mouse_read(&mv, &mx, &my);
+            if (action == MOUSE_SCROLL_UP || action == MOUSE_SCROLL_DOWN)
+            {
+                mouse_scroll(&mv, action == MOUSE_SCROLL_UP ? -MOUSE_SCROLL_ROWS : MOUSE_SCROLL_ROWS);
+                rowoff = mv.rowoff;
+                rowsub = mv.rowsub;
+                /* Take the cursor along when it would scroll out of view */
+                int row = cursor_view_row(buf, cx, cy, rowoff, rowsub, NULL, &wc, config.line_wrap, text_width, max_display);
+                if (row < 0 || row >= max_display)
+                {
+                    mouse_map(&mv, nav.line_num_width, row < 0 ? 0 : max_display - 1, &mx, &my);
+                    moved = 1;
+                }
+            }
+            else if (action == MOUSE_PRESS)
+            {
+                dragging = 1;
+                sel_active = 0;
+                sel_line = my;
+                sel_col = mx;
+                moved = 1;
+                snprintf(status, sizeof(status), "Click: line %zu, col %zu", my + 1, mx + 1);
+            }
+            else if (action == MOUSE_DRAG && dragging)
+            {
+                sel_active = my != sel_line || mx != sel_col;
+                moved = 1;
+            }
+            else if (action == MOUSE_RELEASE && dragging)
             {
-                snprintf(status, sizeof(status), "Click: line %zu, col %zu", cy + 1, cx + 1);
-                /* If in INSERT mode, (re)initialize line editor at new position */
-                if (mode == MODE_INSERT)
+                dragging = 0;
+                if (sel_active)
                 {
-                    le_init(&le, buf->lines[cy]);
-                    le.pos = (cx < le.len) ? cx : le.len;
-                    le_active = 1;
-                    /* clicked line may change wrapping on edit later, no action now */
+                    /* Selecting copies, as in a terminal */
+                    Selection sel = make_selection(sel_line, sel_col, cy, cx);
+                    char *text = selection_text(buf, &sel);
+                    if (text && clipboard_yank_char(CLIP_UNNAMED, text) == 0)
+                        snprintf(status, sizeof(status), "Selected %zu bytes", strlen(text));
+                    free(text);
                 }
             }
+            if (moved)
+            {
+                cx = mx;
+                cy = my;
+            }
+            /* If in INSERT mode, (re)initialize line editor at the cursor */
+            if (mode == MODE_INSERT)
+            {
+                le_adopt(&le, buf->lines[cy]);
+                le.pos = (cx < le.len) ? cx : le.len;
+                le_active = 1;
+            }
             continue;
         }
+        /* Any key ends a mouse selection */
+        sel_active = 0;
+        dragging = 0;
 
         if (mode == MODE_NORMAL)
         {
+            if (reg_pending)
+            {
+                reg_pending = 0;
+                if (clipboard_valid_register(ch))
+                    reg = ch;
+                else
+                {
+                    snprintf(status, sizeof(status), "Invalid register");
+                    reg = CLIP_UNNAMED;
+                    count = 0;
+                    pending_op = 0;
+                }
+                continue;
+            }
+            if (ch == '"')
+            {
+                reg_pending = 1;
+                continue;
+            }
+            if ((ch >= '1' && ch <= '9') || (ch == '0' && count > 0))
+            {
+                if (count < buf->count)
+                    count = count * 10 + (size_t)(ch - '0');
+                continue;
+            }
+            if ((ch == 'y' || ch == 'd') && !pending_op)
+            {
+                pending_op = ch;
+                continue;
+            }
+            /* The prefixes apply to this key only */
+            size_t repeat = count ? count : 1;
+            int use_reg = reg;
+            count = 0;
+            reg = CLIP_UNNAMED;
+            if (pending_op)
+            {
+                int op = pending_op;
+                pending_op = 0;
+                if (ch != op)
+                    continue; /* only yy and dd are supported; anything else cancels */
+                size_t n = repeat < buf->count - cy ? repeat : buf->count - cy;
+                if (clipboard_yank_lines(use_reg, &buf->lines[cy], n) != 0)
+                {
+                    snprintf(status, sizeof(status), "Yank failed");
+                    continue;
+                }
+                if (op == 'y')
+                {
+                    snprintf(status, sizeof(status), n == 1 ? "Yanked line %zu" : "Yanked %zu lines", n == 1 ? cy + 1 : n);
+                    continue;
+                }
+                /* dd: a buffer always keeps at least one (empty) line */
+                char *empty = n == buf->count ? line_new("", 0) : NULL;
+                if ((n == buf->count && !empty) || splice_lines(buf, cy, n, &empty, empty ? 1 : 0, &wc) != 0)
+                {
+                    line_release(empty);
+                    snprintf(status, sizeof(status), "Delete failed");
+                    continue;
+                }
+                if (cy >= buf->count)
+                    cy = buf->count - 1;
+                cx = 0;
+                snprintf(status, sizeof(status), n == 1 ? "Deleted line" : "Deleted %zu lines", n);
+                continue;
+            }
             if (ch == ':')
             {
                 mode = MODE_COMMAND;
-                curs_set(1);
-                mvprintw(rows - 1, 0, ":");
-                clrtoeol();
                 char cmd[256];
-                move(rows - 1, 1);
-                get_command_line(rows - 1, cmd, 250);
+                get_command_line(rows - 1, ':', cmd, 250);
                 if (strcmp(cmd, "help") == 0 || strcmp(cmd, "h") == 0)
                 {
                     show_help();
                 }
                 else if (strncmp(cmd, "w ", 2) == 0)
                 {
-                    char *fname = cmd + 2;
-                    /* clamp filename length when assembling status text to avoid snprintf truncation warning */
-                    char _fname_s[240] = "";
-                    if (fname && fname[0])
-                    {
-                        /* use snprintf to safely truncate and avoid strncpy truncation warnings */
-                        snprintf(_fname_s, sizeof(_fname_s), "%.*s", (int)(sizeof(_fname_s) - 1), fname);
-                        _fname_s[sizeof(_fname_s) - 1] = '\0';
-                    }
-                    if (buffer_save_current(fname) == 0)
-                    {
-                        /* update buffer path to the saved filename */
-                        if (buf->path)
-                            free(buf->path);
-                        buf->path = strdup(fname);
-                        snprintf(status, sizeof(status), "Saved to %s", _fname_s);
-                        buf->dirty = 0;
-                    }
-                    else
-                        snprintf(status, sizeof(status), "Save failed");
+                    /* the buffer takes the new name once the save has gone through */
+                    save_begin(cmd + 2, status, sizeof(status));
                 }
                 else if (strncmp(cmd, "e ", 2) == 0)
                 {
                     char *fname = cmd + 2;
+                    /* the files from the command line go first, so none is opened twice */
+                    add_loaded(1, follow, status, sizeof(status));
                     if (buffer_open_file(fname) >= 0)
                     {
                         buf = buffer_current();
-                        cx = cy = rowoff = coloff = 0;
+                        cx = cy = rowoff = rowsub = coloff = 0;
                         snprintf(status, sizeof(status), "Opened %s", fname);
+                        note_unsaved(buf, status, sizeof(status));
                         /* reset wrap cache for new buffer */
                         wrap_cache_free(&wc);
                         wrap_cache_init(&wc, buf->count);
@@ -496,7 +1407,7 @@ int main(int argc, char **argv)
                 {
                     buffer_next();
                     buf = buffer_current();
-                    cx = cy = rowoff = coloff = 0;
+                    cx = cy = rowoff = rowsub = coloff = 0;
                     snprintf(status, sizeof(status), "Buffer %d/%zu", buffer_index() + 1, buffer_count());
                     wrap_cache_free(&wc);
                     wrap_cache_init(&wc, buf->count);
@@ -505,7 +1416,7 @@ int main(int argc, char **argv)
                 {
                     buffer_prev();
                     buf = buffer_current();
-                    cx = cy = rowoff = coloff = 0;
+                    cx = cy = rowoff = rowsub = coloff = 0;
                     snprintf(status, sizeof(status), "Buffer %d/%zu", buffer_index() + 1, buffer_count());
                     wrap_cache_free(&wc);
                     wrap_cache_init(&wc, buf->count);
@@ -513,15 +1424,7 @@ int main(int argc, char **argv)
                 else if (strcmp(cmd, "w") == 0)
                 {
                     if (buf->path)
-                    {
-                        if (buffer_save_current(buf->path) == 0)
-                        {
-                            snprintf(status, sizeof(status), "Saved");
-                            buf->dirty = 0;
-                        }
-                        else
-                            snprintf(status, sizeof(status), "Save failed");
-                    }
+                        save_begin(buf->path, status, sizeof(status));
                     else
                         snprintf(status, sizeof(status), "No filename");
                 }
@@ -529,13 +1432,51 @@ int main(int argc, char **argv)
                     break;
                 else if (strcmp(cmd, "wq") == 0)
                 {
+                    /* one writer per file: let a background save finish first */
+                    if (saving)
+                        save_end(status, sizeof(status));
                     if (buf->path)
                     {
-                        if (buffer_save_current(buf->path) == 0)
+                        if (buffer_save_current(buf->path, NULL) == 0)
                             buf->dirty = 0;
                     }
                     break;
                 }
+                else if (strcmp(cmd, "recover") == 0)
+                {
+                    UndoResult res;
+                    size_t n = undo_journal_recover(buf, &res);
+                    if (n > 0)
+                    {
+                        cy = res.line < buf->count ? res.line : buf->count - 1;
+                        cx = res.col < line_len(buf->lines[cy]) ? res.col : line_len(buf->lines[cy]);
+                        wrap_cache_ensure(&wc, buf->count);
+                        wrap_cache_invalidate_all(&wc);
+                        snprintf(status, sizeof(status), n == 1 ? "Recovered 1 change" : "Recovered %zu changes", n);
+                    }
+                    else
+                        snprintf(status, sizeof(status), "Nothing to recover");
+                }
+                else if (strcmp(cmd, "follow") == 0)
+                {
+                    if (buf->follow)
+                    {
+                        buf->follow = 0;
+                        snprintf(status, sizeof(status), "Stopped following");
+                    }
+                    else if (!buf->path)
+                        snprintf(status, sizeof(status), "No filename");
+                    else if (buf->dirty)
+                        snprintf(status, sizeof(status), "Save or undo the changes first");
+                    else
+                    {
+                        /* start at the end; new lines are read while waiting for keys */
+                        buf->follow = 1;
+                        cy = buf->count - 1;
+                        cx = 0;
+                        snprintf(status, sizeof(status), "Following \"%.200s\"", buf->path);
+                    }
+                }
                 else if (cmd[0] >= '0' && cmd[0] <= '9')
                 {
                     /* :number - goto line */
@@ -545,6 +1486,15 @@ int main(int argc, char **argv)
                     else
                         snprintf(status, sizeof(status), "Invalid line: %s", cmd);
                 }
+                else if (strcmp(cmd, "latency") == 0)
+                {
+                    if (latency.frames > 0 && frame_cost.frames > 0)
+                        snprintf(status, sizeof(status), "Input to paint: last %ld ms, avg %ld ms, worst %ld ms (%ld frames); frame cost: last %lld us, avg %lld us, worst %lld us (%s)",
+                                 latency.last, latency.total / latency.frames, latency.worst, latency.frames,
+                                 frame_cost.last, frame_cost.total / frame_cost.frames, frame_cost.worst, render_backend_name());
+                    else
+                        snprintf(status, sizeof(status), "Input to paint: nothing measured yet");
+                }
                 else if (strcmp(cmd, "set") == 0)
                 {
                     /* :set - show current settings */
@@ -554,6 +1504,12 @@ int main(int argc, char **argv)
                 {
                     /* :set name=value */
                     config_set(&config, cmd + 4, status, sizeof(status));
+                    undo_set_budget((size_t)config.undo_budget_kb * 1024);
+                    undo_set_persistent(config.undo_file);
+                    undo_set_journal_delay(config.journal_delay_ms);
+                    buffer_set_fsync(config.fsync);
+                    utf8_set_esc_timeout(config.esc_timeout_ms);
+                    render_init(config.vt_render);
                 }
                 else
                     snprintf(status, sizeof(status), "Unknown: %s", cmd);
@@ -563,12 +1519,8 @@ int main(int argc, char **argv)
             if (ch == '/')
             {
                 mode = MODE_SEARCH;
-                curs_set(1);
-                mvprintw(rows - 1, 0, "/");
-                clrtoeol();
                 char pattern[256];
-                move(rows - 1, 1);
-                get_command_line(rows - 1, pattern, 250);
+                get_command_line(rows - 1, '/', pattern, 250);
 
                 if (pattern[0] != '\0')
                 {
@@ -616,364 +1568,124 @@ int main(int argc, char **argv)
                     snprintf(status, sizeof(status), "No previous search");
                 continue;
             }
-            if (ch == 26) /* Ctrl+Z for undo */
+            if (ch == 26 || ch == 25) /* Ctrl+Z for undo, Ctrl+Y for redo */
             {
-                const UndoAction *action = undo_peek();
-                if (action)
+                UndoResult res;
+                int is_undo = (ch == 26);
+                if (is_undo ? undo_apply(buf, &res) : redo_apply(buf, &res))
                 {
-                    /* Perform undo based on action type */
-                    switch (action->type)
+                    cy = res.line < buf->count ? res.line : buf->count - 1;
+                    cx = res.col;
+                    if (res.structural)
                     {
-                    case UNDO_INSERT_CHAR:
-                        /* Remove character that was inserted */
-                        if (action->line < buf->count)
-                        {
-                            LineEdit temp_le;
-                            le_init(&temp_le, buf->lines[action->line]);
-                            temp_le.pos = action->pos + strlen(action->data);
-                            if (le_backspace_cp(&temp_le))
-                            {
-                                char *new_line = le_take_string(&temp_le);
-                                if (new_line)
-                                {
-                                    free(buf->lines[action->line]);
-                                    buf->lines[action->line] = new_line;
-                                    buf->dirty = 1;
-                                    cy = action->line;
-                                    cx = action->pos;
-                                }
-                            }
-                            le_free(&temp_le);
-                        }
-                        break;
-                    case UNDO_DELETE_CHAR:
-                        /* Re-insert character that was deleted */
-                        if (action->line < buf->count && action->data)
-                        {
-                            LineEdit temp_le;
-                            le_init(&temp_le, buf->lines[action->line]);
-                            temp_le.pos = action->pos;
-                            for (const char *p = action->data; *p; p++)
-                                le_insert_char(&temp_le, *p);
-                            char *new_line = le_take_string(&temp_le);
-                            if (new_line)
-                            {
-                                free(buf->lines[action->line]);
-                                buf->lines[action->line] = new_line;
-                                buf->dirty = 1;
-                                cy = action->line;
-                                cx = action->pos + strlen(action->data);
-                            }
-                            le_free(&temp_le);
-                        }
-                        break;
-                    case UNDO_INSERT_LINE:
-                        /* Remove line that was created */
-                        if (action->line + 1 < buf->count)
-                        {
-                            /* Join lines back */
-                            free(buf->lines[action->line + 1]);
-                            for (size_t i = action->line + 1; i < buf->count - 1; ++i)
-                                buf->lines[i] = buf->lines[i + 1];
-                            buf->count--;
-                            /* Restore original line */
-                            if (action->data)
-                            {
-                                free(buf->lines[action->line]);
-                                buf->lines[action->line] = strdup(action->data);
-                            }
-                            buf->dirty = 1;
-                            cy = action->line;
-                            cx = strlen(buf->lines[cy]);
-                            wrap_cache_ensure(&wc, buf->count);
-                            wrap_cache_invalidate_all(&wc);
-                        }
-                        break;
-                    case UNDO_DELETE_LINE:
-                        /* Re-insert line that was deleted (line join undo) */
-                        if (action->line < buf->count && action->data)
-                        {
-                            /* Split at the saved position - for now, simple append */
-                            if (buf->count + 1 < MAX_LINES)
-                            {
-                                for (size_t i = buf->count; i > action->line + 1; --i)
-                                    buf->lines[i] = buf->lines[i - 1];
-                                buf->lines[action->line + 1] = strdup(action->data);
-                                buf->count++;
-                                buf->dirty = 1;
-                                cy = action->line + 1;
-                                cx = 0;
-                                wrap_cache_ensure(&wc, buf->count);
-                                wrap_cache_invalidate_all(&wc);
-                            }
-                        }
-                        break;
-                    case UNDO_REPLACE_LINE:
-                        /* Restore old line content */
-                        if (action->line < buf->count && action->data)
-                        {
-                            free(buf->lines[action->line]);
-                            buf->lines[action->line] = strdup(action->data);
-                            buf->dirty = 1;
-                            cy = action->line;
-                            cx = strlen(buf->lines[cy]);
-                            wrap_cache_invalidate_line(&wc, cy);
-                        }
-                        break;
+                        wrap_cache_ensure(&wc, buf->count);
+                        wrap_cache_invalidate_all(&wc);
                     }
-
-                    /* Move action to redo stack */
-                    UndoAction copy = *action;
-                    copy.data = action->data ? strdup(action->data) : NULL;
-                    copy.data2 = action->data2 ? strdup(action->data2) : NULL;
-                    undo_push_to_redo(&copy);
-                    undo_pop();
-
-                    snprintf(status, sizeof(status), "Undo");
+                    else
+                        wrap_cache_invalidate_line(&wc, cy);
+                    if (res.incomplete)
+                        snprintf(status, sizeof(status), is_undo ? "Undo stopped part way: out of memory"
+                                                                 : "Redo stopped part way: out of memory");
+                    else
+                        snprintf(status, sizeof(status), is_undo ? "Undo" : "Redo");
                 }
+                else if (is_undo)
+                    snprintf(status, sizeof(status), undo_can_undo(buf) ? "Undo failed" : "Nothing to undo");
                 else
-                    snprintf(status, sizeof(status), "Nothing to undo");
+                    snprintf(status, sizeof(status), undo_can_redo(buf) ? "Redo failed" : "Nothing to redo");
                 continue;
             }
-            if (ch == 25) /* Ctrl+Y for redo */
+            if (ch == 'p' || ch == 'P') /* Paste after/before the current line */
             {
-                const UndoAction *action = redo_peek();
-                if (action)
+                if (!clipboard_has_content(use_reg))
                 {
-                    /* Debug: show what type of action we're redoing */
-                    if (action->type == UNDO_REPLACE_LINE && !action->data2)
-                    {
-                        snprintf(status, sizeof(status), "Redo failed: no new content stored");
-                        redo_pop();
-                        continue;
-                    }
-
-                    /* Perform redo - reapply the original change that was undone */
-                    /* For redo, we need to reverse the undo operation */
-                    switch (action->type)
-                    {
-                    case UNDO_INSERT_CHAR:
-                        /* Undo removed this char, redo removes it again (delete) */
-                        if (action->line < buf->count)
-                        {
-                            LineEdit temp_le;
-                            le_init(&temp_le, buf->lines[action->line]);
-                            temp_le.pos = action->pos + strlen(action->data);
-                            if (le_backspace_cp(&temp_le))
-                            {
-                                char *new_line = le_take_string(&temp_le);
-                                if (new_line)
-                                {
-                                    free(buf->lines[action->line]);
-                                    buf->lines[action->line] = new_line;
-                                    buf->dirty = 1;
-                                    cy = action->line;
-                                    cx = action->pos;
-                                }
-                            }
-                            le_free(&temp_le);
-                        }
-                        break;
-                    case UNDO_DELETE_CHAR:
-                        /* Undo restored this char, redo restores it again */
-                        if (action->line < buf->count && action->data)
-                        {
-                            LineEdit temp_le;
-                            le_init(&temp_le, buf->lines[action->line]);
-                            temp_le.pos = action->pos;
-                            for (const char *p = action->data; *p; p++)
-                                le_insert_char(&temp_le, *p);
-                            char *new_line = le_take_string(&temp_le);
-                            if (new_line)
-                            {
-                                free(buf->lines[action->line]);
-                                buf->lines[action->line] = new_line;
-                                buf->dirty = 1;
-                                cy = action->line;
-                                cx = action->pos + strlen(action->data);
-                            }
-                            le_free(&temp_le);
-                        }
-                        break;
-                    case UNDO_INSERT_LINE:
-                        /* Undo removed the inserted line, redo removes it again */
-                        if (action->line + 1 < buf->count)
-                        {
-                            free(buf->lines[action->line + 1]);
-                            for (size_t i = action->line + 1; i < buf->count - 1; ++i)
-                                buf->lines[i] = buf->lines[i + 1];
-                            buf->count--;
-                            buf->dirty = 1;
-                            cy = action->line;
-                            cx = strlen(buf->lines[cy]);
-                            wrap_cache_ensure(&wc, buf->count);
-                            wrap_cache_invalidate_all(&wc);
-                        }
-                        break;
-                    case UNDO_DELETE_LINE:
-                        /* Undo restored the deleted line, redo restores it again */
-                        if (action->line < buf->count && action->data)
-                        {
-                            if (buf->count + 1 < MAX_LINES)
-                            {
-                                for (size_t i = buf->count; i > action->line + 1; --i)
-                                    buf->lines[i] = buf->lines[i - 1];
-                                buf->lines[action->line + 1] = strdup(action->data);
-                                buf->count++;
-                                buf->dirty = 1;
-                                cy = action->line + 1;
-                                cx = 0;
-                                wrap_cache_ensure(&wc, buf->count);
-                                wrap_cache_invalidate_all(&wc);
-                            }
-                        }
-                        break;
-                    case UNDO_REPLACE_LINE:
-                        /* Undo restored old content (data), redo restores new content (data2) */
-                        if (action->line < buf->count)
-                        {
-                            if (action->data2)
-                            {
-                                /* Restore the "new" content that was there before undo */
-                                free(buf->lines[action->line]);
-                                buf->lines[action->line] = strdup(action->data2);
-                                buf->dirty = 1;
-                                cy = action->line;
-                                cx = strlen(buf->lines[cy]);
-                                wrap_cache_invalidate_line(&wc, cy);
-                            }
-                            else
-                            {
-                                /* No new content stored, can't redo properly */
-                                snprintf(status, sizeof(status), "Redo not available for this change");
-                            }
-                        }
-                        break;
-                    }
-
-                    /* Move back to undo stack (for all types that succeeded) */
-                    int should_push = 1;
-                    if (action->type == UNDO_REPLACE_LINE && !action->data2)
-                        should_push = 0; /* Don't push back if we couldn't redo */
-
-                    if (should_push)
+                    if (use_reg == CLIP_UNNAMED)
+                        snprintf(status, sizeof(status), "Clipboard empty");
+                    else
+                        snprintf(status, sizeof(status), "Register %c empty", use_reg);
+                }
+                else if (clipboard_type(use_reg) == CLIP_LINE)
+                {
+                    size_t n = 0;
+                    char **lines = clipboard_paste_lines(use_reg, &n);
+                    size_t at = ch == 'p' ? cy + 1 : cy;
+                    if (lines && splice_lines(buf, at, 0, lines, n, &wc) == 0)
                     {
-                        UndoAction copy = *action;
-                        copy.data = action->data ? strdup(action->data) : NULL;
-                        copy.data2 = action->data2 ? strdup(action->data2) : NULL;
-                        /* Push back to undo stack */
-                        redo_push_to_undo(&copy);
-                        redo_pop();
-                        snprintf(status, sizeof(status), "Redo");
+                        cy = at;
+                        cx = 0;
+                        snprintf(status, sizeof(status), n == 1 ? "Pasted line" : "Pasted %zu lines", n);
                     }
                     else
                     {
-                        redo_pop(); /* Still remove from redo stack */
+                        for (size_t i = 0; i < n; ++i)
+                            line_release(lines[i]);
+                        snprintf(status, sizeof(status), "Paste failed");
                     }
+                    free(lines);
                 }
                 else
-                    snprintf(status, sizeof(status), "Nothing to redo");
-                continue;
-            }
-            if (ch == 'y') /* Yank (copy) current line */
-            {
-                clipboard_yank_line(buf->lines[cy]);
-                snprintf(status, sizeof(status), "Yanked line %zu", cy + 1);
-                continue;
-            }
-            if (ch == 'p') /* Paste */
-            {
-                if (clipboard_has_content())
                 {
-                    char *content = clipboard_paste();
-                    if (content && clipboard_type() == CLIP_LINE)
+                    /* Insert at cursor position */
+                    char *content = clipboard_paste(use_reg);
+                    if (content && strchr(content, '\n'))
                     {
-                        /* Insert as new line below current */
-                        if (buf->count + 1 < MAX_LINES)
-                        {
-                            for (size_t i = buf->count; i > cy + 1; --i)
-                                buf->lines[i] = buf->lines[i - 1];
-                            buf->lines[cy + 1] = content;
-                            buf->count++;
-                            buf->dirty = 1;
-                            cy++;
-                            cx = 0;
-                            wrap_cache_ensure(&wc, buf->count);
-                            wrap_cache_invalidate_all(&wc);
-                            snprintf(status, sizeof(status), "Pasted line");
-                        }
-                        else
-                            free(content);
+                        /* Text spanning lines, e.g. a mouse selection: split it into lines */
+                        size_t n = paste_text(buf, &cy, &cx, content, strlen(content), &wc);
+                        if (n > 0)
+                            snprintf(status, sizeof(status), "Pasted %zu lines", n);
+                        free(content);
                     }
                     else if (content)
                     {
-                        /* Insert at cursor position */
                         LineEdit temp_le;
-                        le_init(&temp_le, buf->lines[cy]);
-                        temp_le.pos = cx;
-                        for (const char *p = content; *p; p++)
-                            le_insert_char(&temp_le, *p);
-                        char *new_line = le_take_string(&temp_le);
-                        if (new_line)
-                        {
-                            free(buf->lines[cy]);
-                            buf->lines[cy] = new_line;
-                            buf->dirty = 1;
-                            cx += strlen(content);
-                            wrap_cache_invalidate_line(&wc, cy);
+                        le_adopt(&temp_le, buf->lines[cy]);
+                        temp_le.pos = cx < temp_le.len ? cx : temp_le.len;
+                        le_insert_bytes(&temp_le, content, strlen(content));
+                        cx = temp_le.pos;
+                        if (commit_line_edit(buf, cy, &temp_le, &wc))
                             snprintf(status, sizeof(status), "Pasted");
-                        }
-                        le_free(&temp_le);
                         free(content);
                     }
                 }
-                else
-                    snprintf(status, sizeof(status), "Clipboard empty");
                 continue;
             }
             if (ch == 'i')
             {
+                /* Everything typed until Esc is undone as one step */
+                undo_begin_group(buf);
                 mode = MODE_INSERT;
                 strcpy(status, "");
                 continue;
             }
-            if (ch == KEY_LEFT || ch == 'h')
+            if (ch == UTF8_KEY(KEY_LEFT) || ch == 'h')
             {
                 if (cx > 0)
                     cx--;
             }
-            else if (ch == KEY_RIGHT || ch == 'l')
+            else if (ch == UTF8_KEY(KEY_RIGHT) || ch == 'l')
             {
-                size_t line_len = strlen(buf->lines[cy]);
-                if (cx < line_len)
+                size_t len = line_len(buf->lines[cy]);
+                if (cx < len)
                     cx++;
             }
-            else if (ch == KEY_UP || ch == 'k')
+            else if (ch == UTF8_KEY(KEY_UP) || ch == 'k')
             {
                 if (cy > 0)
                 {
                     cy--;
-                    size_t line_len = strlen(buf->lines[cy]);
-                    if (cx > line_len)
-                        cx = line_len;
-                    if (cy < rowoff)
-                    {
-                        rowoff = cy;
-                    }
+                    size_t len = line_len(buf->lines[cy]);
+                    if (cx > len)
+                        cx = len;
                 }
             }
-            else if (ch == KEY_DOWN || ch == 'j')
+            else if (ch == UTF8_KEY(KEY_DOWN) || ch == 'j')
             {
                 if (cy + 1 < buf->count)
                 {
                     cy++;
-                    size_t line_len = strlen(buf->lines[cy]);
-                    if (cx > line_len)
-                        cx = line_len;
-                    if (cy >= rowoff + (size_t)max_display)
-                    {
-                        rowoff = cy - max_display + 1;
-                    }
+                    size_t len = line_len(buf->lines[cy]);
+                    if (cx > len)
+                        cx = len;
                 }
             }
         }
@@ -982,8 +1694,8 @@ int main(int argc, char **argv)
             /* initialize line editor for the current line when first entering INSERT */
             if (!le_active)
             {
-                /* Don't record undo here - we'll do it when we exit INSERT mode */
-                le_init(&le, buf->lines[cy]);
+                /* Edit the line in place; undo is recorded when the line is handed back */
+                le_adopt(&le, buf->lines[cy]);
                 le.pos = cx;
                 le_active = 1;
             }
@@ -991,51 +1703,30 @@ int main(int argc, char **argv)
             if (ch == 27)
             {
                 /* exit insert mode: write back the current line */
-                char *newline = le_take_string(&le);
-                if (newline)
-                {
-                    /* Only record undo if the line actually changed */
-                    if (strcmp(buf->lines[cy], newline) != 0)
-                    {
-                        undo_clear_redo(); /* New edit action clears redo stack */
-                        undo_push_replace_line_full(cy, buf->lines[cy], newline);
-                    }
-
-                    free(buf->lines[cy]);
-                    buf->lines[cy] = newline;
-                    buf->dirty = 1;
-                    wrap_cache_invalidate_line(&wc, cy);
-                }
-                le_free(&le);
+                commit_line_edit(buf, cy, &le, &wc);
+                undo_end_group(buf);
                 le_active = 0;
                 mode = MODE_NORMAL;
                 continue;
             }
 
-            if (ch == KEY_LEFT)
+            if (ch == UTF8_KEY(KEY_LEFT))
             {
                 le_move_left_cp(&le);
             }
-            else if (ch == KEY_RIGHT)
+            else if (ch == UTF8_KEY(KEY_RIGHT))
             {
                 le_move_right_cp(&le);
             }
-            else if (ch == KEY_UP)
+            else if (ch == UTF8_KEY(KEY_UP))
             {
                 if (cy > 0)
                 {
                     /* Save current line edit */
-                    char *tmp = le_take_string(&le);
-                    if (tmp)
-                    {
-                        free(buf->lines[cy]);
-                        buf->lines[cy] = tmp;
-                        buf->dirty = 1;
-                    }
+                    commit_line_edit(buf, cy, &le, &wc);
                     cy--;
-                    /* Re-init with new line */
-                    le_free(&le);
-                    le_init(&le, buf->lines[cy]);
+                    /* Continue with the new line */
+                    le_adopt(&le, buf->lines[cy]);
                     /* Try to preserve column position */
                     if (cx > le.len)
                         le.pos = le.len;
@@ -1044,169 +1735,149 @@ int main(int argc, char **argv)
                     cx = le.pos;
                 }
             }
-            else if (ch == KEY_DOWN)
+            else if (ch == UTF8_KEY(KEY_DOWN))
             {
                 if (cy < buf->count - 1)
                 {
                     /* Save current line edit */
-                    char *tmp = le_take_string(&le);
-                    if (tmp)
-                    {
-                        free(buf->lines[cy]);
-                        buf->lines[cy] = tmp;
-                    }
+                    commit_line_edit(buf, cy, &le, &wc);
                     cy++;
-                    /* Re-init with new line */
-                    le_free(&le);
-                    le_init(&le, buf->lines[cy]);
+                    /* Continue with the new line */
+                    le_adopt(&le, buf->lines[cy]);
                     /* Try to preserve column position */
                     if (cx > le.len)
                         le.pos = le.len;
                     else
                         le.pos = cx;
                     cx = le.pos;
-                    /* Adjust scroll if needed */
-                    if (cy >= rowoff + (size_t)max_display)
-                        rowoff = cy - max_display + 1;
                 }
             }
-            else if (ch == KEY_HOME)
+            else if (ch == UTF8_KEY(KEY_HOME))
             {
                 le_move_home(&le);
             }
-            else if (ch == KEY_END)
+            else if (ch == UTF8_KEY(KEY_END))
             {
                 le_move_end(&le);
             }
-            else if (ch == KEY_DC)
+            else if (ch == UTF8_KEY(KEY_DC))
             {
+                /* Keep the bytes going away: a long line's index needs their width */
+                char gone[5];
+                size_t at = le.pos, old_len = le.len;
+                size_t take = le.len - at < 4 ? le.len - at : 4;
+                le_copy(&le, at, take, gone);
+                gone[take] = '\0';
                 if (le_delete_cp(&le))
                 {
                     buf->dirty = 1;
-                    wrap_cache_invalidate_line(&wc, cy);
+                    line_edited(&wc, cy, at, gone, old_len - le.len, "", 0);
                 }
             }
-            else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8)
+            else if (ch == UTF8_KEY(KEY_BACKSPACE) || ch == 127 || ch == 8)
             {
+                char gone[5];
+                size_t old_len = le.len;
+                size_t take = le.pos < 4 ? le.pos : 4;
+                le_copy(&le, le.pos - take, take, gone);
+                gone[take] = '\0';
                 if (le_backspace_cp(&le))
                 {
+                    size_t n = old_len - le.len;
                     buf->dirty = 1;
-                    wrap_cache_invalidate_line(&wc, cy);
+                    line_edited(&wc, cy, le.pos, gone + take - n, n, "", 0);
                 }
                 else
                 {
                     /* at column 0: join with previous line if possible */
                     if (le.pos == 0 && cy > 0)
                     {
-                        size_t prevlen = strlen(buf->lines[cy - 1]);
-                        char *joined = realloc(buf->lines[cy - 1], prevlen + le.len + 1);
+                        size_t prevlen = line_len(buf->lines[cy - 1]);
+                        commit_line_edit(buf, cy, &le, &wc);
+                        size_t curlen = line_len(buf->lines[cy]);
+                        char *joined = line_writable(buf->lines[cy - 1], prevlen + curlen);
+                        size_t keep_pos = 0;
                         if (joined)
                         {
-                            /* Record the line that will be deleted for undo */
-                            undo_clear_redo();
-                            undo_push_delete_line(cy, buf->lines[cy]);
+                            /* Record the join so undo can split the line again */
+                            undo_record_join(buf, cy - 1, prevlen);
 
-                            memcpy(joined + prevlen, le.buf, le.len + 1);
+                            memcpy(joined + prevlen, buf->lines[cy], curlen);
+                            line_set_len(joined, prevlen + curlen);
                             buf->lines[cy - 1] = joined;
-                            free(buf->lines[cy]);
-                            for (size_t i = cy; i < buf->count - 1; ++i)
-                                buf->lines[i] = buf->lines[i + 1];
-                            buf->count--;
+                            buffer_delete_line(buf, cy);
+                            wrap_cache_splice(&wc, cy, 1, 0);
                             cy--;
-                            /* reinit line editor to the end of the joined line */
-                            le_free(&le);
-                            le_init(&le, buf->lines[cy]);
-                            le.pos = prevlen;
-                            buf->dirty = 1;
-                            /* Buffer structure changed; reset wrap cache */
-                            wrap_cache_ensure(&wc, buf->count);
-                            wrap_cache_invalidate_all(&wc);
+                            wrap_cache_invalidate_line(&wc, cy);
+                            keep_pos = prevlen;
                         }
+                        /* continue editing at the join point */
+                        le_adopt(&le, buf->lines[cy]);
+                        le.pos = keep_pos;
                     }
                 }
             }
             else if (ch == '\n' || ch == '\r')
             {
-                /* split the current line at cursor */
-                char *right = le_split(&le);
-                char *left = le_take_string(&le);
-
-                /* Record the line split for undo */
-                if (left && right)
-                {
-                    undo_clear_redo();
-                    undo_push_insert_line(cy, left, right);
-                }
-
+                /* split the current line at cursor: commit pending edits first so
+                   undo restores them separately from the line break */
+                size_t split_at = le.pos;
+                commit_line_edit(buf, cy, &le, &wc);
+                char *left = line_writable(buf->lines[cy], split_at);
+                char *right = left ? line_new(left + split_at, line_len(left) - split_at) : NULL;
                 if (left)
-                {
-                    free(buf->lines[cy]);
                     buf->lines[cy] = left;
-                }
-                if (right)
+                size_t keep_pos = split_at;
+                if (right && buffer_insert_line(buf, cy + 1, right) == 0)
                 {
-                    if (buf->count + 1 < MAX_LINES)
-                    {
-                        for (size_t i = buf->count; i > cy + 1; --i)
-                            buf->lines[i] = buf->lines[i - 1];
-                        buf->lines[cy + 1] = right;
-                        buf->count++;
-                        cy++;
-                        le_free(&le);
-                        le_init(&le, buf->lines[cy]);
-                        le.pos = 0;
-                        buf->dirty = 1;
-                        /* Buffer grew; reset cache size and invalidate */
-                        wrap_cache_ensure(&wc, buf->count);
-                        wrap_cache_invalidate_all(&wc);
-                    }
-                    else
-                        free(right);
+                    undo_record_split(buf, cy, split_at);
+                    line_set_len(left, split_at);
+                    wrap_cache_invalidate_line(&wc, cy);
+                    wrap_cache_splice(&wc, cy + 1, 0, 1);
+                    cy++;
+                    keep_pos = 0;
                 }
+                else
+                    line_release(right);
+                le_adopt(&le, buf->lines[cy]);
+                le.pos = keep_pos;
             }
             else if (ch >= 32 && ch < 127)
             {
+                char added[2] = {(char)ch, '\0'};
                 if (le_insert_char(&le, ch))
                 {
                     buf->dirty = 1;
-                    wrap_cache_invalidate_line(&wc, cy);
+                    line_edited(&wc, cy, le.pos - 1, "", 0, added, 1);
                 }
             }
-            else if (ch >= 128 && ch <= 0x10FFFF)
+            else if (ch >= 128 && !utf8_is_key(ch))
             {
+                size_t at = le.pos, old_len = le.len;
                 if (le_insert_codepoint(&le, ch))
                 {
+                    char added[5];
+                    le_copy(&le, at, le.len - old_len, added);
+                    added[le.len - old_len] = '\0';
                     buf->dirty = 1;
-                    wrap_cache_invalidate_line(&wc, cy);
+                    line_edited(&wc, cy, at, "", 0, added, le.len - old_len);
                 }
             }
 
             cx = le.pos;
-            /* Wrapping enabled: disable horizontal scrolling */
-            coloff = 0;
-
-            /* Ensure cursor is visible by adjusting visual row offset */
-            int text_width = cols - nav.line_num_width;
-            if (text_width < 1)
-                text_width = 1;
-            int vcursor = 0;
-            for (size_t i = 0; i < cy; ++i)
-                vcursor += wrap_cache_get(&wc, buf->lines[i], i);
-            {
-                const char *cline = (le_active && le.buf) ? le.buf : buf->lines[cy];
-                int cx_cols = wrap_cols_for_prefix(cline, cx);
-                vcursor += cx_cols / text_width;
-            }
-            if (vcursor < (int)rowoff)
-                rowoff = (size_t)vcursor;
-            else if (vcursor >= (int)(rowoff + max_display))
-                rowoff = (size_t)(vcursor - max_display + 1);
         }
     }
 
+    render_shutdown();
+    mouse_shutdown();
     endwin();
-    undo_free();
+    utf8_paste_mode(0);
+    /* Quitting while a save runs waits for it */
+    if (saving && save_end(status, sizeof(status)) != 0)
+        fprintf(stderr, "%s\n", status);
     clipboard_free();
+    file_watch_free();
+    stream_close(stream);
     buffer_free_all();
     return 0;
 }
@@ -0,0 +1,82 @@
+#include "input_queue.h"
+
+int input_queue_init(InputQueue *q)
+{
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->waiting, 0);
+    atomic_init(&q->closed, 0);
+    q->ready = platform_signal_new();
+    return q->ready ? 0 : -1;
+}
+
+void input_queue_free(InputQueue *q)
+{
+    platform_signal_free(q->ready);
+    q->ready = NULL;
+}
+
+int input_queue_push(InputQueue *q, const InputEvent *ev)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head - tail == INPUT_QUEUE_SIZE)
+        return 0;
+    q->events[head & (INPUT_QUEUE_SIZE - 1)] = *ev;
+    /* Publishing head and then checking 'waiting' pairs with the consumer
+       setting 'waiting' and then checking head: one of them sees the other */
+    atomic_store(&q->head, head + 1);
+    if (atomic_load(&q->waiting))
+        platform_signal_raise(q->ready);
+    return 1;
+}
+
+void input_queue_close(InputQueue *q)
+{
+    atomic_store(&q->closed, 1);
+    platform_signal_raise(q->ready);
+}
+
+int input_queue_pop(InputQueue *q, InputEvent *ev)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load(&q->head);
+    if (head == tail)
+        return 0;
+    *ev = q->events[tail & (INPUT_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+int input_queue_wait(InputQueue *q, InputEvent *ev, int timeout_ms)
+{
+    long deadline = timeout_ms > 0 ? platform_now_ms() + timeout_ms : 0;
+    while (1)
+    {
+        if (input_queue_pop(q, ev))
+            return 1;
+        if (timeout_ms == 0 || atomic_load(&q->closed))
+            return 0;
+        int wait = -1;
+        if (timeout_ms > 0)
+        {
+            long left = deadline - platform_now_ms();
+            if (left <= 0)
+                return 0;
+            wait = (int)left;
+        }
+        atomic_store(&q->waiting, 1);
+        if (input_queue_pop(q, ev))
+        {
+            atomic_store(&q->waiting, 0);
+            return 1;
+        }
+        platform_signal_wait(q->ready, wait);
+        atomic_store(&q->waiting, 0);
+    }
+}
+
+size_t input_queue_count(InputQueue *q)
+{
+    return atomic_load(&q->head) - atomic_load(&q->tail);
+}
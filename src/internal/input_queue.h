@@ -0,0 +1,48 @@
+#ifndef VTE_INPUT_QUEUE_H
+#define VTE_INPUT_QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "../platform/platform.h"
+
+/* One decoded key, stamped with the time its bytes were read */
+typedef struct
+{
+    int key;           /* codepoint or UTF8_KEY(KEY_*) */
+    int mouse_button;  /* mouse reports only, see utf8_mouse_event() */
+    int mouse_x;
+    int mouse_y;
+    int mouse_release;
+    long time_ms;      /* platform_now_ms() when the key arrived */
+} InputEvent;
+
+#define INPUT_QUEUE_SIZE 1024 /* power of two */
+
+/* Single-producer/single-consumer ring. The producer only writes 'head' and the
+   consumer only writes 'tail', so neither side ever takes a lock. */
+typedef struct
+{
+    InputEvent events[INPUT_QUEUE_SIZE];
+    atomic_size_t head;     /* next slot to fill */
+    atomic_size_t tail;     /* next slot to take */
+    atomic_int waiting;     /* consumer is asleep in input_queue_wait() */
+    atomic_int closed;      /* producer is gone */
+    PlatformSignal *ready;
+} InputQueue;
+
+/* Returns 0 on success */
+int input_queue_init(InputQueue *q);
+void input_queue_free(InputQueue *q);
+
+/* Producer side. push() returns 0 if the queue is full. */
+int input_queue_push(InputQueue *q, const InputEvent *ev);
+void input_queue_close(InputQueue *q);
+
+/* Consumer side. pop() returns 0 if the queue is empty; wait() blocks up to
+   timeout_ms (-1 = no limit) for an event and returns 0 on timeout or once the
+   queue is closed and drained. */
+int input_queue_pop(InputQueue *q, InputEvent *ev);
+int input_queue_wait(InputQueue *q, InputEvent *ev, int timeout_ms);
+size_t input_queue_count(InputQueue *q);
+
+#endif /* VTE_INPUT_QUEUE_H */
@@ -1,76 +1,170 @@
 #include "mouse.h"
-#include "wrap.h"
+#include "utf8.h"
 #include <curses.h>
+#include <stdio.h>
 #include <string.h>
 
 void mouse_init(void)
 {
     mousemask(ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION, NULL);
     mouseinterval(0);
+#ifdef NCURSES_VERSION
+    /* Button-event tracking: motion is reported while a button is held, for drags */
+    fputs("\033[?1002h", stdout);
+    fflush(stdout);
+#endif
 }
 
-int mouse_handle_click(size_t *cx, size_t *cy, size_t *rowoff,
-                       char **lines, size_t line_count,
-                       int line_num_width, int max_display, int text_width)
+void mouse_shutdown(void)
 {
-    /* PDCurses: getmouse() returns button event mask; also refresh Mouse_status coords */
-    mmask_t mev = getmouse();
-    if (!(mev & (BUTTON1_CLICKED | BUTTON1_DOUBLE_CLICKED)))
-        return 0;
-    request_mouse_pos();
-    int click_y = MOUSE_Y_POS;
-    int click_x = MOUSE_X_POS;
+#ifdef NCURSES_VERSION
+    fputs("\033[?1002l", stdout);
+    fflush(stdout);
+#endif
+}
 
-    /* Ignore clicks on status/command lines */
-    if (click_y >= max_display)
-        return 0;
+/* Measure the lines from 'from' on until they cover 'rows' visual rows, so lookups in
+   that stretch use exact counts rather than the estimates of lines not reached yet */
+static void measure_rows(const MouseView *v, size_t from, size_t rows)
+{
+    for (size_t i = from; i < v->line_count && rows > 0; ++i)
+    {
+        size_t n = (size_t)wrap_cache_get(v->wc, v->lines[i], i);
+        rows = n >= rows ? 0 : rows - n;
+    }
+}
 
-    if (text_width < 1)
-        text_width = 1;
+void mouse_map(const MouseView *v, int x, int y, size_t *cx, size_t *cy)
+{
+    int text_width = v->text_width < 1 ? 1 : v->text_width;
+    if (v->line_count == 0)
+    {
+        *cy = 0;
+        *cx = 0;
+        return;
+    }
+    if (y < 0)
+        y = 0;
+    if (y >= v->max_display)
+        y = v->max_display - 1;
 
     /* Translate click to text area X (column) */
-    int text_x = click_x - line_num_width;
+    int text_x = x - v->line_num_width;
     if (text_x < 0)
         text_x = 0;
+    if (text_x >= text_width)
+        text_x = text_width - 1;
 
-    /* Absolute visual row from top of file */
-    size_t abs_vis_row = *rowoff + (size_t)click_y;
+    if (!v->wrap)
+    {
+        /* Rows are lines; the column index finds the byte */
+        size_t line = v->rowoff + (size_t)y;
+        if (line >= v->line_count)
+            line = v->line_count - 1;
+        *cy = line;
+        *cx = wrap_cache_col_byte(v->wc, v->lines[line], line, v->coloff + (size_t)text_x);
+        return;
+    }
 
-    /* Find target buffer line and wrap segment */
-    size_t sum = 0;
-    size_t target_line = line_count ? (line_count - 1) : 0;
+    /* Absolute visual row from the top of the file, then the line and wrap segment
+       it falls on. The lines from the top of the view down to the click are measured
+       first, so both lookups agree even while the rest of the index holds estimates. */
+    measure_rows(v, v->rowoff, v->rowsub + (size_t)y + 1);
+    size_t abs_vis_row = wrap_cache_prefix(v->wc, v->rowoff) + v->rowsub + (size_t)y;
     size_t segment = 0;
-    for (size_t i = 0; i < line_count; ++i)
+    size_t target_line = wrap_cache_find(v->wc, abs_vis_row, &segment);
+    if (target_line >= v->line_count)
+        target_line = v->line_count - 1;
+
+    size_t target_col = segment * (size_t)text_width + (size_t)text_x;
+    *cy = target_line;
+    *cx = wrap_cache_col_byte(v->wc, v->lines[target_line], target_line, target_col);
+}
+
+void mouse_scroll(MouseView *v, long delta)
+{
+    if (v->line_count == 0)
+        return;
+    if (!v->wrap)
     {
-        int vis = wrap_calc_visual_lines(lines[i], text_width);
-        if (abs_vis_row < sum + (size_t)vis)
+        size_t top = v->rowoff;
+        if (delta < 0)
+            top = (size_t)-delta > top ? 0 : top - (size_t)-delta;
+        else
+            top += (size_t)delta;
+        v->rowoff = top < v->line_count ? top : v->line_count - 1;
+        v->rowsub = 0;
+        return;
+    }
+    if (delta < 0)
+    {
+        /* Rows above the view may not be measured yet; each line is at least one row */
+        size_t need = (size_t)-delta;
+        for (size_t i = v->rowoff; i > 0 && need > 0; --need)
         {
-            target_line = i;
-            segment = abs_vis_row - sum;
-            break;
+            --i;
+            wrap_cache_get(v->wc, v->lines[i], i);
         }
-        sum += (size_t)vis;
     }
-
-    const char *tline = (line_count > 0) ? lines[target_line] : "";
-    size_t base_col = segment * (size_t)text_width;
-    size_t target_col = base_col + (size_t)text_x;
-    size_t new_cx = wrap_byte_index_for_col(tline, (int)target_col);
-    size_t new_cy = target_line;
-
-    /* Bounds check */
-    if (line_count == 0)
+    else
     {
-        new_cy = 0;
-        new_cx = 0;
+        /* Likewise the rows scrolled over below, down to the new top row */
+        measure_rows(v, v->rowoff, v->rowsub + (size_t)delta + 1);
     }
-    else if (new_cy >= line_count)
+    size_t top = wrap_cache_prefix(v->wc, v->rowoff) + v->rowsub;
+    if (delta < 0)
+        top = (size_t)-delta > top ? 0 : top - (size_t)-delta;
+    else
+        top += (size_t)delta;
+    /* Stop with the last row of the file at the top */
+    size_t last = wrap_cache_prefix(v->wc, v->line_count);
+    if (last > 0 && top >= last)
+        top = last - 1;
+    v->rowoff = wrap_cache_find(v->wc, top, &v->rowsub);
+}
+
+MouseAction mouse_read(const MouseView *v, size_t *cx, size_t *cy)
+{
+#ifdef NCURSES_VERSION
+    /* ncurses: the report was decoded by utf8_getch(); button is the xterm code */
+    int button, x, y, release;
+    if (!utf8_mouse_event(&button, &x, &y, &release))
+        return MOUSE_NONE;
+    if (button == 64)
+        return MOUSE_SCROLL_UP;
+    if (button == 65)
+        return MOUSE_SCROLL_DOWN;
+    if ((button & 3) != 0)
+        return MOUSE_NONE; /* middle/right button */
+    MouseAction action = release ? MOUSE_RELEASE : (button & 32) ? MOUSE_DRAG : MOUSE_PRESS;
+#else
+    /* PDCurses: button state and position are in Mouse_status after request_mouse_pos() */
+    request_mouse_pos();
+    int x = MOUSE_X_POS;
+    int y = MOUSE_Y_POS;
+    if (MOUSE_WHEEL_UP)
+        return MOUSE_SCROLL_UP;
+    if (MOUSE_WHEEL_DOWN)
+        return MOUSE_SCROLL_DOWN;
+    MouseAction action = MOUSE_NONE;
+    if (BUTTON_CHANGED(1))
     {
-        new_cy = line_count - 1;
+        int state = BUTTON_STATUS(1) & BUTTON_ACTION_MASK;
+        if (state == BUTTON_PRESSED || state == BUTTON_CLICKED || state == BUTTON_DOUBLE_CLICKED)
+            action = MOUSE_PRESS;
+        else if (state == BUTTON_RELEASED)
+            action = MOUSE_RELEASE;
     }
+    else if (MOUSE_MOVED && (BUTTON_STATUS(1) & BUTTON_ACTION_MASK) == BUTTON_PRESSED)
+        action = MOUSE_DRAG;
+    if (action == MOUSE_NONE)
+        return MOUSE_NONE;
+#endif
 
-    *cy = new_cy;
-    *cx = new_cx;
-
-    return 1;
+    /* Ignore presses on status/command lines; drags past them stay on the last text row */
+    if (action == MOUSE_PRESS && y >= v->max_display)
+        return MOUSE_NONE;
+    if (action != MOUSE_RELEASE)
+        mouse_map(v, x, y, cx, cy);
+    return action;
 }
@@ -2,18 +2,51 @@
 #define MOUSE_H
 
 #include <stddef.h>
+#include "wrap_cache.h"
 
 /* Initialize mouse support (call once at startup) */
 void mouse_init(void);
+/* Turn off the reporting mouse_init() asked the terminal for */
+void mouse_shutdown(void);
 
-/* Handle a mouse event and update cursor position if clicked.
-   Returns 1 if cursor was moved, 0 otherwise.
-   line_num_width: width of line number column to account for offset */
-/* Wrapped rendering aware: rowoff is visual-row offset, coloff can be 0 when wrapping is enabled.
+/* The part of the editor's state needed to map screen cells to text. Mapping goes
+   through the wrap cache's prefix index, so it is O(log n) in the file length.
    lines: array of pointers to buffer lines; line_count: number of lines in buffer.
+   rowoff/rowsub: the view starts rowsub visual rows into line rowoff.
+   wrap/coloff: without wrapping each row is a line shown from column coloff.
    text_width: width of the text area (cols - line_num_width). */
-int mouse_handle_click(size_t *cx, size_t *cy, size_t *rowoff,
-                       char **lines, size_t line_count,
-                       int line_num_width, int max_display, int text_width);
+typedef struct MouseView
+{
+    char **lines;
+    size_t line_count;
+    WrapCache *wc;
+    int wrap;
+    size_t rowoff, rowsub;
+    size_t coloff;
+    int line_num_width;
+    int max_display;
+    int text_width;
+} MouseView;
+
+typedef enum
+{
+    MOUSE_NONE,
+    MOUSE_PRESS,   /* left button went down */
+    MOUSE_DRAG,    /* moved with the left button held */
+    MOUSE_RELEASE, /* left button released */
+    MOUSE_SCROLL_UP,
+    MOUSE_SCROLL_DOWN
+} MouseAction;
+
+/* Read the mouse event utf8_getch() returned UTF8_KEY(KEY_MOUSE) for. Presses and
+   drags are mapped to a text position in *cy and *cx; clicks on the status/command
+   lines are ignored. */
+MouseAction mouse_read(const MouseView *v, size_t *cx, size_t *cy);
+
+/* Map screen cell x/y (clamped into the text area) to a text position */
+void mouse_map(const MouseView *v, int x, int y, size_t *cx, size_t *cy);
+
+/* Move the top of the view by 'delta' visual rows, within the file */
+void mouse_scroll(MouseView *v, long delta);
 
 #endif /* MOUSE_H */
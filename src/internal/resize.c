@@ -1,10 +1,17 @@
 #include "resize.h"
+#include "../platform/platform.h"
+#include "../render/render.h"
 #include <curses.h>
 
 void handle_resize(void)
 {
+#ifdef NCURSES_VERSION
+    /* The input thread takes SIGWINCH, so ncurses may not know the new size yet */
+    int rows, cols;
+    if (platform_terminal_size(&rows, &cols) == 0)
+        resize_term(rows, cols);
+#else
     resize_term(0, 0);
-    clearok(curscr, TRUE);
-    clear();
-    refresh();
+#endif
+    render_invalidate();
 }
@@ -1,5 +1,7 @@
 /* Prefer wide-char input to properly handle dead keys and composed characters when available */
 #include "utf8.h"
+#include "input_queue.h"
+#include "../platform/platform.h"
 #include <curses.h>
 #if defined(PDC_WIDE) || defined(NCURSES_WIDECHAR) || defined(_XOPEN_SOURCE_EXTENDED)
 #include <wchar.h>
@@ -8,23 +10,94 @@
 #ifdef _WIN32
 #include <windows.h>
 #endif
+#include <stdio.h>
+#include <stdlib.h>
 
-int utf8_getch(void)
+#ifdef NCURSES_VERSION
+/* ncurses only tells a bare Esc from an arrow key after ESCDELAY (a second by
+   default), so keypad mode stays off and CSI/SS3 sequences are decoded here.
+   PDCurses reads keys from the console API and has no such delay. */
+#define VTE_OWN_KEY_DECODER 1
+#endif
+
+/* Once ESC [ or ESC O has arrived the rest of the sequence is on its way */
+#define SEQ_TIMEOUT_MS 250
+
+static int esc_timeout_ms = 25;
+static int input_delay = -1; /* how long utf8_getch() may wait, -1 = block */
+static int read_delay = -1;  /* timeout currently set in curses */
+
+/* Character the decoder read too far (whatever followed a lone Esc) */
+static int held_char;
+static int have_held = 0;
+
+/* Mouse report filled in by the decoder, and the one handed out with
+   UTF8_KEY(KEY_MOUSE) */
+typedef struct
+{
+    int button, x, y, release;
+} MouseReport;
+static MouseReport decoded_mouse;
+static MouseReport last_mouse;
+static int mouse_valid = 0;
+
+/* Key read ahead by utf8_input_pending() when there is no input thread */
+static InputEvent peeked;
+static int have_peeked = 0;
+static long key_time = 0;
+
+#ifdef VTE_OWN_KEY_DECODER
+/* With the input thread running, keys are decoded from the raw terminal bytes
+   on that thread and handed over through 'queue' */
+static InputQueue queue;
+static int threaded = 0;
+static unsigned char raw_buf[256];
+static size_t raw_pos = 0;
+static size_t raw_len = 0;
+static long raw_time = 0; /* when raw_buf[] was filled */
+static int raw_closed = 0;
+static int resize_seen = 0;
+static int stamp_next = 0; /* note the arrival time of the next byte read */
+static long stamp_time = 0;
+#endif
+
+static void apply_delay(int ms)
+{
+    if (ms != read_delay)
+    {
+        timeout(ms);
+        read_delay = ms;
+    }
+}
+
+static void set_delay(int ms)
+{
+    input_delay = ms;
+    apply_delay(ms);
+}
+
+/* One character from curses: a codepoint, UTF8_KEY(KEY_*) or ERR */
+static int read_char(void)
 {
 #ifdef VTE_HAVE_WIDE_INPUT
     /* Try wide-character input first; returns composed characters properly */
     wint_t wch = 0;
     int rc = get_wch(&wch);
     if (rc == KEY_CODE_YES)
-        return (int)wch;
+        return UTF8_KEY((int)wch);
     if (rc == OK)
         return (int)wch;
+    /* Under a timeout ERR just means no key arrived; don't wait a second time */
+    if (read_delay >= 0)
+        return ERR;
     /* else fall through to byte-wise path */
 #endif
     /* Byte-wise getch decoding of UTF-8 or current Windows code page */
     int ch = getch();
-    if (ch < 0 || ch >= KEY_MIN)
+    if (ch < 0)
         return ch;
+    if (ch >= KEY_MIN)
+        return UTF8_KEY(ch);
     if (ch < 128)
         return ch;
 #ifdef _WIN32
@@ -65,3 +138,454 @@ int utf8_getch(void)
     }
     return ch;
 }
+
+
+#ifdef VTE_OWN_KEY_DECODER
+static int raw_byte(int ms)
+{
+    if (raw_pos == raw_len)
+    {
+        if (raw_closed)
+            return ERR;
+        int n = platform_read_input(raw_buf, sizeof(raw_buf), ms, &resize_seen);
+        if (n < 0)
+            raw_closed = 1;
+        if (n <= 0)
+            return ERR;
+        raw_pos = 0;
+        raw_len = (size_t)n;
+        raw_time = platform_now_ms();
+    }
+    if (stamp_next)
+    {
+        stamp_time = raw_time;
+        stamp_next = 0;
+    }
+    return raw_buf[raw_pos++];
+}
+
+/* One UTF-8 character from the terminal bytes */
+static int raw_char(int ms)
+{
+    int ch = raw_byte(ms);
+    if (ch < 0x80)
+        return ch;
+    int more = (ch & 0xE0) == 0xC0 ? 1 : (ch & 0xF0) == 0xE0 ? 2 : (ch & 0xF8) == 0xF0 ? 3 : 0;
+    if (more == 0)
+        return ch;
+    int cp = ch & (0x3F >> more);
+    while (more-- > 0)
+    {
+        int c = raw_byte(SEQ_TIMEOUT_MS);
+        if (c == ERR || (c & 0xC0) != 0x80)
+            return -1;
+        cp = (cp << 6) | (c & 0x3F);
+    }
+    return cp;
+}
+#endif
+
+/* Next character for the decoder, waiting at most 'ms' (-1: as long as utf8_getch() may) */
+static int next_char(int ms)
+{
+    if (have_held)
+    {
+        have_held = 0;
+        return held_char;
+    }
+#ifdef VTE_OWN_KEY_DECODER
+    if (threaded)
+        return raw_char(ms);
+#endif
+    apply_delay(ms < 0 ? input_delay : ms);
+    return read_char();
+}
+
+static void hold_char(int ch)
+{
+    held_char = ch;
+    have_held = 1;
+}
+
+#ifdef VTE_OWN_KEY_DECODER
+/* Final byte of ESC [ x / ESC O x */
+static int final_key(int c)
+{
+    switch (c)
+    {
+    case 'A': return UTF8_KEY(KEY_UP);
+    case 'B': return UTF8_KEY(KEY_DOWN);
+    case 'C': return UTF8_KEY(KEY_RIGHT);
+    case 'D': return UTF8_KEY(KEY_LEFT);
+    case 'H': return UTF8_KEY(KEY_HOME);
+    case 'F': return UTF8_KEY(KEY_END);
+    case 'P': return UTF8_KEY(KEY_F(1));
+    case 'Q': return UTF8_KEY(KEY_F(2));
+    case 'R': return UTF8_KEY(KEY_F(3));
+    case 'S': return UTF8_KEY(KEY_F(4));
+    case 'Z': return UTF8_KEY(KEY_BTAB);
+    }
+    return ERR;
+}
+
+/* ESC [ n ~ */
+static int tilde_key(int n)
+{
+    switch (n)
+    {
+    case 1: case 7: return UTF8_KEY(KEY_HOME);
+    case 2: return UTF8_KEY(KEY_IC);
+    case 3: return UTF8_KEY(KEY_DC);
+    case 4: case 8: return UTF8_KEY(KEY_END);
+    case 5: return UTF8_KEY(KEY_PPAGE);
+    case 6: return UTF8_KEY(KEY_NPAGE);
+    case 200: return KEY_PASTE_BEGIN;
+    case 201: return KEY_PASTE_END;
+    }
+    if (n >= 11 && n <= 15)
+        return UTF8_KEY(KEY_F(n - 10));
+    if (n >= 17 && n <= 21)
+        return UTF8_KEY(KEY_F(n - 11));
+    if (n == 23 || n == 24)
+        return UTF8_KEY(KEY_F(n - 12));
+    return ERR;
+}
+
+/* Rest of a CSI sequence whose first byte after ESC [ is 'c'. Modifier
+   parameters (ESC [ 1 ; 5 A) are accepted and ignored. */
+static int decode_csi(int c)
+{
+    int params[4] = {0, 0, 0, 0};
+    int np = 0, digits = 0, marker = 0;
+    if (c == '<' || c == '?' || c == '>' || c == '=')
+    {
+        marker = c;
+        c = next_char(SEQ_TIMEOUT_MS);
+    }
+    while (c != ERR)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            if (np < 4 && params[np] < 100000)
+                params[np] = params[np] * 10 + (c - '0');
+            digits = 1;
+        }
+        else if (c == ';')
+        {
+            np++;
+            digits = 0;
+        }
+        else if (c >= 0x40 && c <= 0x7E)
+            break;
+        else if (c < 0x20 || c > 0x2F)
+            return ERR; /* not part of a CSI sequence */
+        c = next_char(SEQ_TIMEOUT_MS);
+    }
+    if (c == ERR)
+        return ERR;
+    if (digits || np > 0)
+        np++;
+    if (np > 4)
+        np = 4;
+
+    if (marker == '<' && (c == 'M' || c == 'm') && np == 3)
+    {
+        /* SGR mouse report: ESC [ < b ; x ; y M (press) or m (release) */
+        decoded_mouse.button = params[0];
+        decoded_mouse.x = params[1] - 1;
+        decoded_mouse.y = params[2] - 1;
+        decoded_mouse.release = (c == 'm');
+        return UTF8_KEY(KEY_MOUSE);
+    }
+    if (marker == 0 && c == 'M' && np == 0)
+    {
+        /* X10 mouse report: ESC [ M followed by three bytes offset by 32 */
+        int b = next_char(SEQ_TIMEOUT_MS);
+        int x = next_char(SEQ_TIMEOUT_MS);
+        int y = next_char(SEQ_TIMEOUT_MS);
+        if (b < 32 || x < 33 || y < 33)
+            return ERR;
+        int cb = b - 32;
+        decoded_mouse.release = (cb & 3) == 3 && !(cb & 64);
+        decoded_mouse.button = decoded_mouse.release ? cb & ~3 : cb;
+        decoded_mouse.x = x - 33;
+        decoded_mouse.y = y - 33;
+        return UTF8_KEY(KEY_MOUSE);
+    }
+    if (marker != 0)
+        return ERR;
+    if (c == '~')
+        return np > 0 ? tilde_key(params[0]) : ERR;
+    return final_key(c);
+}
+#endif
+
+static int read_key(void)
+{
+#ifdef VTE_OWN_KEY_DECODER
+    while (1)
+    {
+        int ch = next_char(-1);
+        if (ch != 27)
+            return ch;
+        int next = next_char(esc_timeout_ms);
+        if (next == ERR)
+            return 27; /* bare Esc */
+        if (next != '[' && next != 'O')
+        {
+            /* Alt+key, or Esc quickly followed by another key */
+            hold_char(next);
+            return 27;
+        }
+        int c = next_char(SEQ_TIMEOUT_MS);
+        if (c == ERR)
+        {
+            hold_char(next);
+            return 27;
+        }
+        int key = next == '[' ? decode_csi(c) : final_key(c);
+        if (key != ERR)
+            return key;
+        /* Unknown or garbled sequence: drop it and read on */
+    }
+#else
+    return next_char(-1);
+#endif
+}
+
+/* Decode one key into 'ev'; returns 0 if none arrived in time */
+static int decode_event(InputEvent *ev)
+{
+#ifdef VTE_OWN_KEY_DECODER
+    stamp_next = threaded;
+#endif
+    int key = read_key();
+    if (key == ERR)
+        return 0;
+    ev->key = key;
+    ev->time_ms = platform_now_ms();
+#ifdef VTE_OWN_KEY_DECODER
+    if (threaded)
+        ev->time_ms = stamp_next ? raw_time : stamp_time;
+#endif
+    if (key == UTF8_KEY(KEY_MOUSE))
+    {
+        ev->mouse_button = decoded_mouse.button;
+        ev->mouse_x = decoded_mouse.x;
+        ev->mouse_y = decoded_mouse.y;
+        ev->mouse_release = decoded_mouse.release;
+    }
+    return 1;
+}
+
+#ifdef VTE_OWN_KEY_DECODER
+static void push_event(const InputEvent *ev)
+{
+    /* The editor has fallen a whole queue behind: let it catch up */
+    while (!input_queue_push(&queue, ev))
+        platform_sleep_ms(5);
+}
+
+static void reader_main(void *arg)
+{
+    (void)arg;
+    while (!raw_closed)
+    {
+        InputEvent ev;
+        if (decode_event(&ev))
+            push_event(&ev);
+        if (resize_seen)
+        {
+            resize_seen = 0;
+            ev.key = UTF8_KEY(KEY_RESIZE);
+            ev.time_ms = platform_now_ms();
+            push_event(&ev);
+        }
+    }
+    input_queue_close(&queue);
+}
+#endif
+
+void utf8_input_init(void)
+{
+#ifdef VTE_OWN_KEY_DECODER
+    keypad(stdscr, FALSE);
+    /* Keys are read on a thread of their own so a slow redraw or save never holds
+       them up. curses is not thread safe, so that thread reads the terminal itself
+       and the main thread never calls getch() again. The reader runs until exit. */
+    if (input_queue_init(&queue) == 0 && platform_input_open() == 0)
+    {
+        threaded = 1;
+        if (platform_thread_start(reader_main, NULL))
+            typeahead(-1); /* ncurses can no longer see pending input itself */
+        else
+            threaded = 0;
+    }
+#else
+    keypad(stdscr, TRUE);
+#endif
+}
+
+void utf8_set_esc_timeout(int ms)
+{
+    esc_timeout_ms = ms;
+}
+
+int utf8_getch(void)
+{
+    InputEvent ev;
+    if (have_peeked)
+    {
+        ev = peeked;
+        have_peeked = 0;
+    }
+#ifdef VTE_OWN_KEY_DECODER
+    else if (threaded)
+    {
+        if (!input_queue_wait(&queue, &ev, input_delay))
+            return ERR;
+    }
+#endif
+    else if (!decode_event(&ev))
+        return ERR;
+    key_time = ev.time_ms;
+    if (ev.key == UTF8_KEY(KEY_MOUSE))
+    {
+        last_mouse.button = ev.mouse_button;
+        last_mouse.x = ev.mouse_x;
+        last_mouse.y = ev.mouse_y;
+        last_mouse.release = ev.mouse_release;
+        mouse_valid = 1;
+    }
+    return ev.key;
+}
+
+int utf8_input_pending(void)
+{
+    if (have_peeked)
+        return 1;
+#ifdef VTE_OWN_KEY_DECODER
+    if (threaded)
+        return input_queue_count(&queue) > 0;
+#endif
+    set_delay(0);
+    have_peeked = decode_event(&peeked);
+    set_delay(-1);
+    return have_peeked;
+}
+
+int utf8_wait_input(int ms)
+{
+    if (have_peeked)
+        return 1;
+#ifdef VTE_OWN_KEY_DECODER
+    if (threaded)
+    {
+        have_peeked = input_queue_wait(&queue, &peeked, ms);
+        return have_peeked;
+    }
+#endif
+    set_delay(ms);
+    have_peeked = decode_event(&peeked);
+    set_delay(-1);
+    return have_peeked;
+}
+
+long utf8_key_time(void)
+{
+    return key_time;
+}
+
+int utf8_mouse_event(int *button, int *x, int *y, int *release)
+{
+    if (!mouse_valid)
+        return 0;
+    *button = last_mouse.button;
+    *x = last_mouse.x;
+    *y = last_mouse.y;
+    *release = last_mouse.release;
+    mouse_valid = 0;
+    return 1;
+}
+
+void utf8_paste_mode(int enable)
+{
+#ifdef VTE_OWN_KEY_DECODER
+    /* The markers are decoded along with the other CSI sequences */
+    fputs(enable ? "\033[?2004h" : "\033[?2004l", stdout);
+    fflush(stdout);
+#else
+    (void)enable;
+#endif
+}
+
+/* Append one codepoint as UTF-8 */
+static int paste_put(char **buf, size_t *len, size_t *cap, int cp)
+{
+    if (*len + 4 > *cap)
+    {
+        size_t ncap = *cap ? *cap * 2 : 4096;
+        char *nb = (char *)realloc(*buf, ncap);
+        if (!nb)
+            return 0;
+        *buf = nb;
+        *cap = ncap;
+    }
+    char *p = *buf + *len;
+    if (cp < 0x80)
+    {
+        p[0] = (char)cp;
+        *len += 1;
+    }
+    else if (cp < 0x800)
+    {
+        p[0] = (char)(0xC0 | (cp >> 6));
+        p[1] = (char)(0x80 | (cp & 0x3F));
+        *len += 2;
+    }
+    else if (cp < 0x10000)
+    {
+        p[0] = (char)(0xE0 | (cp >> 12));
+        p[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        p[2] = (char)(0x80 | (cp & 0x3F));
+        *len += 3;
+    }
+    else
+    {
+        p[0] = (char)(0xF0 | (cp >> 18));
+        p[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        p[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        p[3] = (char)(0x80 | (cp & 0x3F));
+        *len += 4;
+    }
+    return 1;
+}
+
+char *utf8_read_paste(size_t *len)
+{
+    char *buf = NULL;
+    size_t cap = 0;
+    int prev_cr = 0;
+    *len = 0;
+    /* Don't hang if the closing marker never arrives */
+    set_delay(500);
+    while (1)
+    {
+        int ch = utf8_getch();
+        if (ch == KEY_PASTE_END || ch == ERR)
+            break;
+        /* Every codepoint is text here; keys are not */
+        if (ch <= 0 || utf8_is_key(ch))
+            continue;
+        if (ch == '\n' && prev_cr)
+        {
+            prev_cr = 0;
+            continue; /* second half of CRLF */
+        }
+        prev_cr = (ch == '\r');
+        if (!paste_put(&buf, len, &cap, ch == '\r' ? '\n' : ch))
+            break;
+    }
+    set_delay(-1);
+    return buf;
+}
\ No newline at end of file
@@ -2,11 +2,53 @@
 #define UTF8_H
 
 #include <stddef.h>
+#include <curses.h>
 
 /* Read a UTF-8 character from getch() and return the unicode codepoint.
    Returns the codepoint, or -1 on error.
    For ASCII (< 128), returns the character directly.
-   For multi-byte UTF-8, reads additional bytes as needed. */
+   For multi-byte UTF-8, reads additional bytes as needed.
+   Special keys come back as UTF8_KEY(KEY_*), above the Unicode range, so no
+   character can be taken for a key (U+0102 is KEY_DOWN's curses code). */
 int utf8_getch(void);
 
+#define UTF8_MAX_CODEPOINT 0x10FFFF
+#define UTF8_KEY(k) (UTF8_MAX_CODEPOINT + 1 + (k))
+#define utf8_is_key(ch) ((ch) > UTF8_MAX_CODEPOINT)
+
+/* Set up key input after initscr(). On ncurses keypad mode stays off and escape
+   sequences are decoded by us, so a bare Esc is reported once nothing else
+   follows within the escape timeout (see utf8_set_esc_timeout). Keys are then
+   read and decoded on a separate input thread where the platform allows it. */
+void utf8_input_init(void);
+void utf8_set_esc_timeout(int ms);
+
+/* When the key utf8_getch() returned last arrived (platform_now_ms() time).
+   With the input thread this is when its bytes were read, so the gap to the next
+   paint is the real input-to-screen latency. */
+long utf8_key_time(void);
+
+/* Nonzero if a key can be read right now without waiting. A key peeked this
+   way is kept and returned by the next utf8_getch(). */
+int utf8_input_pending(void);
+/* Like utf8_input_pending() but waits up to 'ms' for a key to arrive */
+int utf8_wait_input(int ms);
+
+/* Bracketed paste: with the mode enabled the terminal wraps pasted text in
+   ESC[200~ ... ESC[201~. utf8_getch() reports the opening marker as
+   KEY_PASTE_BEGIN; the payload is then read in one go with utf8_read_paste().
+   Only available where we decode escape sequences ourselves (ncurses). */
+#define KEY_PASTE_BEGIN UTF8_KEY(KEY_MAX + 1)
+#define KEY_PASTE_END UTF8_KEY(KEY_MAX + 2)
+void utf8_paste_mode(int enable);
+/* Read pasted text up to the closing marker as UTF-8. Line breaks (CR, LF, CRLF) are
+   returned as '\n'. Returns a malloc'ed buffer (caller frees) and its length in *len. */
+char *utf8_read_paste(size_t *len);
+
+/* Details of the mouse report utf8_getch() last returned as UTF8_KEY(KEY_MOUSE),
+   when the report was decoded here (ncurses). button is the xterm code: 0-2 for
+   the buttons, +32 while dragging, 64/65 for the wheel. x and y are 0-based
+   screen cells. Returns 0 if there is no report to fetch. */
+int utf8_mouse_event(int *button, int *x, int *y, int *release);
+
 #endif /* UTF8_H */
@@ -1,67 +1,60 @@
 #include "utf8_edit.h"
-#include <string.h>
+
+/* Continuation byte 10xxxxxx at text offset i */
+static int is_cont(const LineEdit *le, size_t i)
+{
+    unsigned char b = (unsigned char)le_byte_at(le, i);
+    return b >= 0x80 && b < 0xC0;
+}
 
 /* Return index of previous UTF-8 codepoint start before 'pos' (0 if none) */
-static size_t utf8_prev_cp_start(const char *s, size_t pos)
+static size_t utf8_prev_cp_start(const LineEdit *le, size_t pos)
 {
-    if (!s || pos == 0)
+    if (pos == 0)
         return 0;
-    size_t i = pos;
-    if (i > 0)
-        i--;
+    size_t i = pos - 1;
     /* Move left over continuation bytes 10xxxxxx */
-    while (i > 0 && (unsigned char)s[i] >= 0x80 && (unsigned char)s[i] < 0xC0)
+    while (i > 0 && is_cont(le, i))
         i--;
     return i;
 }
 
 /* Return index just after next UTF-8 codepoint starting at or after 'pos' */
-static size_t utf8_next_cp_end(const char *s, size_t pos)
+static size_t utf8_next_cp_end(const LineEdit *le, size_t pos)
 {
-    if (!s)
+    if (pos >= le->len)
         return pos;
-    unsigned char b0 = (unsigned char)s[pos];
-    if (b0 == 0)
-        return pos;
-    if (b0 < 0x80)
-        return pos + 1;
+    unsigned char b0 = (unsigned char)le_byte_at(le, pos);
+    size_t need = 0;
     if ((b0 & 0xE0) == 0xC0)
-    {
-        if ((unsigned char)s[pos + 1] >= 0x80 && (unsigned char)s[pos + 1] < 0xC0)
-            return pos + 2;
-        return pos + 1;
-    }
-    if ((b0 & 0xF0) == 0xE0)
-    {
-        if ((unsigned char)s[pos + 1] >= 0x80 && (unsigned char)s[pos + 1] < 0xC0 &&
-            (unsigned char)s[pos + 2] >= 0x80 && (unsigned char)s[pos + 2] < 0xC0)
-            return pos + 3;
-        /* fall back to advance minimally */
+        need = 1;
+    else if ((b0 & 0xF0) == 0xE0)
+        need = 2;
+    else if ((b0 & 0xF8) == 0xF0)
+        need = 3;
+    /* fall back to advance minimally on truncated sequences */
+    if (need > le->len - pos - 1)
         return pos + 1;
-    }
-    if ((b0 & 0xF8) == 0xF0)
+    for (size_t k = 1; k <= need; ++k)
     {
-        if ((unsigned char)s[pos + 1] >= 0x80 && (unsigned char)s[pos + 1] < 0xC0 &&
-            (unsigned char)s[pos + 2] >= 0x80 && (unsigned char)s[pos + 2] < 0xC0 &&
-            (unsigned char)s[pos + 3] >= 0x80 && (unsigned char)s[pos + 3] < 0xC0)
-            return pos + 4;
-        return pos + 1;
+        if (!is_cont(le, pos + k))
+            return pos + 1;
     }
-    return pos + 1;
+    return pos + 1 + need;
 }
 
 void le_move_left_cp(LineEdit *le)
 {
     if (!le || le->pos == 0)
         return;
-    le->pos = utf8_prev_cp_start(le->buf, le->pos);
+    le->pos = utf8_prev_cp_start(le, le->pos);
 }
 
 void le_move_right_cp(LineEdit *le)
 {
     if (!le || le->pos >= le->len)
         return;
-    le->pos = utf8_next_cp_end(le->buf, le->pos);
+    le->pos = utf8_next_cp_end(le, le->pos);
     if (le->pos > le->len)
         le->pos = le->len;
 }
@@ -70,31 +63,16 @@ int le_backspace_cp(LineEdit *le)
 {
     if (!le || !le->buf || le->pos == 0)
         return 0;
-    size_t start = utf8_prev_cp_start(le->buf, le->pos);
-    size_t bytes = le->pos - start;
-    if (bytes == 0)
-        return 0;
-    if (le->pos < le->len)
-        memmove(le->buf + start, le->buf + le->pos, le->len - le->pos);
-    le->len -= bytes;
-    le->pos = start;
-    le->buf[le->len] = '\0';
-    return 1;
+    size_t start = utf8_prev_cp_start(le, le->pos);
+    return le_erase_before(le, le->pos - start);
 }
 
 int le_delete_cp(LineEdit *le)
 {
     if (!le || !le->buf || le->pos >= le->len)
         return 0;
-    size_t end = utf8_next_cp_end(le->buf, le->pos);
-    size_t bytes = end - le->pos;
-    if (bytes == 0)
-        return 0;
-    if (end < le->len)
-        memmove(le->buf + le->pos, le->buf + end, le->len - end);
-    le->len -= bytes;
-    le->buf[le->len] = '\0';
-    return 1;
+    size_t end = utf8_next_cp_end(le, le->pos);
+    return le_erase_after(le, end - le->pos);
 }
 
 int le_insert_codepoint(LineEdit *le, int cp)
@@ -126,13 +104,8 @@ int le_insert_codepoint(LineEdit *le, int cp)
         utf8[len++] = (char)(0x80 | (cp & 0x3F));
     }
     utf8[len] = '\0';
-    /* Insert bytes at current position */
-    for (int i = 0; i < len; ++i)
-    {
-        if (!le_insert_char(le, (unsigned char)utf8[i]))
-            return 0;
-    }
-    return 1;
+    /* Insert the whole sequence at once */
+    return le_insert_bytes(le, utf8, (size_t)len);
 }
 
 /* Composition logic removed for simplicity; rely on platform input to provide composed codepoints. */
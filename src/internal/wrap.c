@@ -1,5 +1,4 @@
 #include "wrap.h"
-#include <curses.h>
 #include <string.h>
 #include <stdint.h>
 
@@ -60,6 +59,16 @@ static int ucs_display_width(int cp)
     return 1;
 }
 
+int wrap_decode(const char *s, int *cp)
+{
+    return utf8_decode_advance(s, cp);
+}
+
+int wrap_char_width(int cp)
+{
+    return ucs_display_width(cp);
+}
+
 int wrap_cols_for_prefix(const char *line, size_t byte_len)
 {
     if (!line)
@@ -125,52 +134,21 @@ int wrap_calc_visual_lines(const char *line, int width)
     return (total_cols + width - 1) / width;
 }
 
-int wrap_draw_line(const char *line, int row, int col_start, int width, size_t coloff, int max_rows)
+size_t wrap_next_segment(const char *line, size_t start, int width)
 {
-    if (!line || width <= 0)
-        return 0;
-
-    /* coloff is a column offset, not bytes */
-    int start_col = (int)coloff;
-    size_t line_len = strlen(line);
-    int total_cols = wrap_cols_for_prefix(line, line_len); /* total columns */
-    /* Ensure we visibly clear at least one row for empty lines or when starting beyond EOL */
-    if (total_cols <= 0)
-    {
-        /* Clear one visual row for an empty line */
-        mvprintw(row, col_start, "%-*s", width, "");
-        return 1;
-    }
-    if (start_col >= total_cols)
-    {
-        /* View starts beyond end of line: draw a blank segment to clear */
-        mvprintw(row, col_start, "%-*s", width, "");
-        return 1;
-    }
-
-    int rows_used = 0;
-
-    if (max_rows <= 0)
-        max_rows = 1;
-
-    int col_cursor = start_col;
-    size_t byte_cursor = wrap_byte_index_for_col(line, col_cursor);
-    while (col_cursor < total_cols && rows_used < max_rows)
+    int cols = 0;
+    size_t i = start;
+    while (line[i])
     {
-        int seg_cols = total_cols - col_cursor;
-        if (seg_cols > width)
-            seg_cols = width;
-        size_t byte_end = wrap_byte_index_for_col(line, col_cursor + seg_cols);
-        int bytes_to_print = (int)(byte_end - byte_cursor);
-
-        /* Print exactly 'width' cells, padding with spaces, so we never overdraw the gutter
-           and we overwrite any leftovers without using clrtoeol(). */
-        mvprintw(row + rows_used, col_start, "%-*.*s", width, bytes_to_print, line + byte_cursor);
-
-        byte_cursor = byte_end;
-        col_cursor += seg_cols;
-        rows_used++;
+        int cp = 0;
+        int adv = utf8_decode_advance(line + i, &cp);
+        if (adv <= 0)
+            break;
+        int w = ucs_display_width(cp);
+        if (cols + w > width)
+            break;
+        cols += w;
+        i += (size_t)adv;
     }
-
-    return rows_used > 0 ? rows_used : 1;
+    return i;
 }
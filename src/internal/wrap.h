@@ -7,13 +7,17 @@
    width: available display width for text (excluding line numbers) */
 int wrap_calc_visual_lines(const char *line, int width);
 
-/* Draw a wrapped line starting at screen row 'row'.
-   Returns the number of screen rows used.
-   Handles lines that exceed terminal width by wrapping to next line. */
-/* Draw a wrapped line starting at screen row 'row'.
-   max_rows limits how many screen rows may be written (clipped to viewport).
-   Returns the number of screen rows used (clipped to max_rows, at least 1 if any text shown). */
-int wrap_draw_line(const char *line, int row, int col_start, int width, size_t coloff, int max_rows);
+/* End of the display row that starts at byte 'start': the byte index after as many
+   characters as fit in 'width' columns (zero-width marks stay with their base) */
+size_t wrap_next_segment(const char *line, size_t start, int width);
+
+/* Decode the UTF-8 codepoint at 's' into *cp; returns the bytes it takes (0 at the NUL).
+   Invalid bytes decode as themselves, one byte each. */
+int wrap_decode(const char *s, int *cp);
+
+/* Display columns of a codepoint as counted for wrapping: 0 for controls and
+   combining marks, 1 otherwise */
+int wrap_char_width(int cp);
 
 /* Column/byte mapping helpers for UTF-8 text */
 /* Return the number of display columns occupied by the first 'byte_len' bytes of 'line'
@@ -1,20 +1,230 @@
 #include <stdlib.h>
+#include <string.h>
 #include "wrap_cache.h"
 #include "wrap.h"
 
+/* Rows a count contributes to the index: unknown lines take one */
+static size_t rows_of(int v)
+{
+    return v < 0 ? 1 : (size_t)v;
+}
+
+/* Fenwick tree t[1..n]: turn the values in t into the tree in O(n) */
+static void fenwick_build(size_t *t, size_t n)
+{
+    for (size_t i = 1; i <= n; ++i)
+    {
+        size_t parent = i + (i & (0 - i));
+        if (parent <= n)
+            t[parent] += t[i];
+    }
+}
+
+/* Entry k (0-based) went from 'from' to 'to' */
+static void fenwick_change(size_t *t, size_t n, size_t k, size_t from, size_t to)
+{
+    if (from == to)
+        return;
+    for (size_t i = k + 1; i <= n; i += i & (0 - i))
+        t[i] = t[i] - from + to;
+}
+
+/* Sum of the first k entries */
+static size_t fenwick_sum(const size_t *t, size_t k)
+{
+    size_t sum = 0;
+    for (size_t i = k; i > 0; i -= i & (0 - i))
+        sum += t[i];
+    return sum;
+}
+
+/* Number of leading entries whose sum is at most 'at'; what is left of 'at' after them in *rest */
+static size_t fenwick_find(const size_t *t, size_t n, size_t at, size_t *rest)
+{
+    size_t k = 0;
+    size_t step = 1;
+    while (step * 2 <= n)
+        step *= 2;
+    for (; n > 0 && step > 0; step /= 2)
+    {
+        if (k + step <= n && t[k + step] <= at)
+        {
+            k += step;
+            at -= t[k];
+        }
+    }
+    *rest = at;
+    return k;
+}
+
+/* Rebuild the prefix index from the counts in O(n) */
+static void tree_build(WrapCache *c)
+{
+    if (!c->tree)
+        return;
+    for (size_t i = 1; i <= c->count; ++i)
+        c->tree[i] = rows_of(c->counts[i - 1]);
+    fenwick_build(c->tree, c->count);
+    c->tree_valid = 1;
+}
+
+/* Record that line idx went from 'from' to 'to' rows */
+static void tree_update(WrapCache *c, size_t idx, int from, int to)
+{
+    if (c->tree_valid)
+        fenwick_change(c->tree, c->count, idx, rows_of(from), rows_of(to));
+}
+
+/* Forget the column index of line idx, or of every line if idx is (size_t)-1 */
+static void cols_forget(WrapCache *c, size_t idx)
+{
+    if (!c->cols)
+        return;
+    for (size_t i = 0; i < WRAP_COL_SLOTS; ++i)
+    {
+        if (idx == (size_t)-1 || c->cols[i].line == idx)
+            c->cols[i].line = (size_t)-1;
+    }
+}
+
+/* Long-line index of line idx, or NULL */
+static WrapLongLine *long_slot(WrapCache *c, size_t idx)
+{
+    for (size_t i = 0; i < WRAP_LONG_SLOTS; ++i)
+    {
+        if (c->longs[i].line == idx)
+            return &c->longs[i];
+    }
+    return NULL;
+}
+
+/* Forget the long-line index of line idx, or of every line if idx is (size_t)-1 */
+static void long_forget(WrapCache *c, size_t idx)
+{
+    for (size_t i = 0; i < WRAP_LONG_SLOTS; ++i)
+    {
+        if (idx == (size_t)-1 || c->longs[i].line == idx)
+            c->longs[i].line = (size_t)-1;
+    }
+}
+
+static int long_rows(const WrapLongLine *l, int width)
+{
+    if (l->total_cols == 0)
+        return 1;
+    size_t rows = (l->total_cols + (size_t)width - 1) / (size_t)width;
+    return rows > 0x7fffffff ? 0x7fffffff : (int)rows;
+}
+
+static int long_push(WrapLongLine *l, size_t bytes, size_t cols)
+{
+    if (l->n + 1 >= l->cap)
+    {
+        size_t cap = l->cap ? l->cap * 2 : 256;
+        size_t *nb = (size_t *)realloc(l->bytes, cap * sizeof(size_t));
+        if (!nb)
+            return 0;
+        l->bytes = nb;
+        size_t *nc = (size_t *)realloc(l->cols, cap * sizeof(size_t));
+        if (!nc)
+            return 0;
+        l->cols = nc;
+        l->cap = cap;
+    }
+    l->n++;
+    l->bytes[l->n] = bytes;
+    l->cols[l->n] = cols;
+    return 1;
+}
+
+/* Walk the line once, cutting it into chunks, and index it as line idx */
+static WrapLongLine *long_build(WrapCache *c, const char *line, size_t idx)
+{
+    WrapLongLine *l = &c->longs[c->long_next];
+    c->long_next = (c->long_next + 1) % WRAP_LONG_SLOTS;
+    l->line = (size_t)-1;
+    l->n = 0;
+    l->total_cols = 0;
+    size_t i = 0;
+    while (line[i])
+    {
+        size_t start = i, cols = 0;
+        for (;;)
+        {
+            int cp = 0;
+            int adv = wrap_decode(line + i, &cp);
+            if (adv <= 0)
+                break;
+            int w = wrap_char_width(cp);
+            /* Cut before a character that takes a column, so zero-width marks stay with their base */
+            if (w > 0 && i - start >= WRAP_LONG_CHUNK)
+                break;
+            cols += (size_t)w;
+            i += (size_t)adv;
+        }
+        if (!long_push(l, i - start, cols))
+            return NULL;
+        l->total_cols += cols;
+    }
+    if (l->n == 0)
+        return NULL;
+    fenwick_build(l->bytes, l->n);
+    fenwick_build(l->cols, l->n);
+    l->line = idx;
+    return l;
+}
+
+/* Chunk that position 'at' (counted in l->bytes or l->cols, given as 'tree') falls
+   in, and how far into it in *rest; past the end it is the end of the last chunk */
+static size_t long_chunk(const WrapLongLine *l, const size_t *tree, size_t at, size_t *rest)
+{
+    size_t k = fenwick_find(tree, l->n, at, rest);
+    if (k >= l->n)
+    {
+        k = l->n - 1;
+        *rest = fenwick_sum(tree, l->n) - fenwick_sum(tree, k);
+    }
+    return k;
+}
+
+static void reset_counts(WrapCache *c)
+{
+    for (size_t i = 0; i < c->count; ++i)
+        c->counts[i] = -1;
+    c->fill_next = 0;
+    tree_build(c);
+}
+
 void wrap_cache_init(WrapCache *c, size_t count)
 {
     c->width = -1;
     c->cap = count ? count : 1;
     c->count = count;
     c->counts = (int *)malloc(c->cap * sizeof(int));
-    if (c->counts)
+    c->tree = (size_t *)malloc((c->cap + 1) * sizeof(size_t));
+    c->tree_valid = 0;
+    c->fill_next = 0;
+    c->cols = NULL;
+    c->long_min = 0;
+    c->long_next = 0;
+    for (size_t i = 0; i < WRAP_LONG_SLOTS; ++i)
+    {
+        c->longs[i].line = (size_t)-1;
+        c->longs[i].n = c->longs[i].cap = 0;
+        c->longs[i].bytes = c->longs[i].cols = NULL;
+    }
+    if (c->counts && c->tree)
     {
         for (size_t i = 0; i < c->cap; ++i)
             c->counts[i] = -1;
+        tree_build(c);
     }
     else
     {
+        free(c->counts);
+        free(c->tree);
+        c->counts = NULL;
+        c->tree = NULL;
         c->cap = c->count = 0;
     }
 }
@@ -23,7 +233,25 @@ void wrap_cache_free(WrapCache *c)
 {
     if (c->counts)
         free(c->counts);
+    free(c->tree);
+    if (c->cols)
+    {
+        for (size_t i = 0; i < WRAP_COL_SLOTS; ++i)
+            free(c->cols[i].marks);
+        free(c->cols);
+    }
+    for (size_t i = 0; i < WRAP_LONG_SLOTS; ++i)
+    {
+        free(c->longs[i].bytes);
+        free(c->longs[i].cols);
+        c->longs[i].bytes = c->longs[i].cols = NULL;
+        c->longs[i].n = c->longs[i].cap = 0;
+        c->longs[i].line = (size_t)-1;
+    }
+    c->cols = NULL;
     c->counts = NULL;
+    c->tree = NULL;
+    c->tree_valid = 0;
     c->cap = c->count = 0;
     c->width = -1;
 }
@@ -33,8 +261,7 @@ void wrap_cache_set_width(WrapCache *c, int width)
     if (c->width != width)
     {
         c->width = width;
-        for (size_t i = 0; i < c->count; ++i)
-            c->counts[i] = -1;
+        reset_counts(c);
     }
 }
 
@@ -49,23 +276,81 @@ void wrap_cache_ensure(WrapCache *c, size_t count)
         if (!new_counts)
             return; /* allocation failed; keep old cache, don't update count */
         c->counts = new_counts;
+        size_t *new_tree = (size_t *)realloc(c->tree, (new_cap + 1) * sizeof(size_t));
+        if (!new_tree)
+            return;
+        c->tree = new_tree;
         for (size_t i = c->cap; i < new_cap; ++i)
             c->counts[i] = -1;
         c->cap = new_cap;
     }
+    if (count == c->count)
+        return;
+    /* entries past the old count may hold stale values from before a shrink */
+    for (size_t i = c->count; i < count; ++i)
+        c->counts[i] = -1;
+    if (count < c->fill_next)
+        c->fill_next = count;
     c->count = count;
+    c->tree_valid = 0;
 }
 
 void wrap_cache_invalidate_line(WrapCache *c, size_t idx)
 {
     if (idx < c->count)
+    {
+        tree_update(c, idx, c->counts[idx], -1);
         c->counts[idx] = -1;
+        cols_forget(c, idx);
+        long_forget(c, idx);
+        if (idx < c->fill_next)
+            c->fill_next = idx;
+    }
 }
 
 void wrap_cache_invalidate_all(WrapCache *c)
 {
-    for (size_t i = 0; i < c->count; ++i)
-        c->counts[i] = -1;
+    reset_counts(c);
+    cols_forget(c, (size_t)-1);
+    long_forget(c, (size_t)-1);
+}
+
+void wrap_cache_splice(WrapCache *c, size_t at, size_t removed, size_t inserted)
+{
+    if (at > c->count)
+        return;
+    if (removed > c->count - at)
+        removed = c->count - at;
+    size_t old_count = c->count;
+    size_t new_count = old_count - removed + inserted;
+    wrap_cache_ensure(c, new_count);
+    if (c->count != new_count)
+    {
+        /* could not grow: fall back to recomputing everything */
+        wrap_cache_invalidate_all(c);
+        return;
+    }
+    size_t tail = old_count - at - removed;
+    if (inserted != removed && tail > 0)
+        memmove(&c->counts[at + inserted], &c->counts[at + removed], tail * sizeof(int));
+    for (size_t i = 0; i < inserted; ++i)
+        c->counts[at + i] = -1;
+    if (at < c->fill_next)
+        c->fill_next = at;
+    /* Shifting entries moves every tree node after 'at'; rebuild when next asked */
+    c->tree_valid = 0;
+    cols_forget(c, (size_t)-1);
+    /* Long-line indexes are costly to make again: move them with their lines */
+    for (size_t i = 0; i < WRAP_LONG_SLOTS; ++i)
+    {
+        WrapLongLine *l = &c->longs[i];
+        if (l->line == (size_t)-1 || l->line < at)
+            continue;
+        if (l->line < at + removed)
+            l->line = (size_t)-1;
+        else
+            l->line = l->line - removed + inserted;
+    }
 }
 
 int wrap_cache_get(WrapCache *c, const char *line, size_t idx)
@@ -76,7 +361,252 @@ int wrap_cache_get(WrapCache *c, const char *line, size_t idx)
     int v = c->counts[idx];
     if (v >= 0)
         return v;
-    v = wrap_calc_visual_lines(line, width);
+    WrapLongLine *l = long_slot(c, idx);
+    if (!l && c->long_min > 0 && !memchr(line, 0, c->long_min))
+        l = long_build(c, line, idx);
+    v = l ? long_rows(l, width) : wrap_calc_visual_lines(line, width);
+    tree_update(c, idx, -1, v);
     c->counts[idx] = v;
     return v;
 }
+
+int wrap_cache_peek(WrapCache *c, size_t idx)
+{
+    if (idx >= c->count)
+        return -1;
+    if (c->counts[idx] < 0)
+    {
+        WrapLongLine *l = long_slot(c, idx);
+        if (!l)
+            return -1;
+        c->counts[idx] = long_rows(l, c->width < 1 ? 1 : c->width);
+        tree_update(c, idx, -1, c->counts[idx]);
+    }
+    return c->counts[idx];
+}
+
+size_t wrap_cache_prefix(WrapCache *c, size_t idx)
+{
+    if (idx > c->count)
+        idx = c->count;
+    if (!c->tree_valid)
+        tree_build(c);
+    size_t sum = 0;
+    if (!c->tree_valid)
+    {
+        for (size_t i = 0; i < idx; ++i)
+            sum += rows_of(c->counts[i]);
+        return sum;
+    }
+    return fenwick_sum(c->tree, idx);
+}
+
+size_t wrap_cache_find(WrapCache *c, size_t row, size_t *sub)
+{
+    if (c->count == 0)
+    {
+        *sub = 0;
+        return 0;
+    }
+    if (!c->tree_valid)
+        tree_build(c);
+    size_t idx = 0; /* lines known to end at or before 'row' */
+    if (c->tree_valid)
+        idx = fenwick_find(c->tree, c->count, row, &row);
+    else
+    {
+        while (idx < c->count && rows_of(c->counts[idx]) <= row)
+            row -= rows_of(c->counts[idx++]);
+    }
+    if (idx >= c->count)
+    {
+        idx = c->count - 1;
+        row = rows_of(c->counts[idx]) - 1;
+    }
+    *sub = row;
+    return idx;
+}
+
+int wrap_cache_fill(WrapCache *c, char **lines, size_t max_lines, size_t skip)
+{
+    size_t i = c->fill_next;
+    for (; i < c->count && max_lines > 0; ++i)
+    {
+        if (c->counts[i] >= 0 || i == skip)
+            continue;
+        wrap_cache_get(c, lines[i], i);
+        max_lines--;
+    }
+    /* Only move the mark over lines that are really known */
+    while (c->fill_next < i && c->counts[c->fill_next] >= 0)
+        c->fill_next++;
+    return i < c->count;
+}
+
+/* Column index slot for line idx, started afresh if it holds another line */
+static WrapColIndex *cols_slot(WrapCache *c, const char *line, size_t idx)
+{
+    if (!c->cols)
+    {
+        c->cols = (WrapColIndex *)calloc(WRAP_COL_SLOTS, sizeof(WrapColIndex));
+        if (!c->cols)
+            return NULL;
+        for (size_t i = 0; i < WRAP_COL_SLOTS; ++i)
+            c->cols[i].line = (size_t)-1;
+    }
+    WrapColIndex *ci = &c->cols[idx % WRAP_COL_SLOTS];
+    if (ci->line != idx || ci->text != line)
+    {
+        if (!ci->marks)
+        {
+            ci->marks = (size_t *)malloc(16 * sizeof(size_t));
+            if (!ci->marks)
+                return NULL;
+            ci->cap = 16;
+        }
+        ci->line = idx;
+        ci->text = line;
+        ci->marks[0] = 0;
+        ci->count = 1;
+        ci->complete = 0;
+    }
+    return ci;
+}
+
+/* Walk on to the next mark; returns 0 at the end of the line */
+static int cols_extend(WrapColIndex *ci, const char *line)
+{
+    if (ci->complete)
+        return 0;
+    size_t next = wrap_next_segment(line, ci->marks[ci->count - 1], WRAP_COL_STEP);
+    if (!line[next])
+    {
+        ci->complete = 1;
+        return 0;
+    }
+    if (ci->count == ci->cap)
+    {
+        size_t *nm = (size_t *)realloc(ci->marks, ci->cap * 2 * sizeof(size_t));
+        if (!nm)
+        {
+            ci->complete = 1;
+            return 0;
+        }
+        ci->marks = nm;
+        ci->cap *= 2;
+    }
+    ci->marks[ci->count++] = next;
+    return 1;
+}
+
+size_t wrap_cache_col_byte(WrapCache *c, const char *line, size_t idx, size_t col)
+{
+    size_t into, len;
+    size_t start = wrap_cache_long_col(c, idx, col, &into, &len);
+    if (start != (size_t)-1)
+        return col == 0 ? 0 : wrap_next_segment(line, start, (int)into);
+    WrapColIndex *ci = cols_slot(c, line, idx);
+    if (!ci)
+        return wrap_byte_index_for_col(line, (int)col);
+    size_t k = col / WRAP_COL_STEP;
+    while (ci->count <= k && cols_extend(ci, line))
+        ;
+    if (k >= ci->count)
+        k = ci->count - 1;
+    size_t rest = col - k * WRAP_COL_STEP;
+    /* Past the last mark the line ends within WRAP_COL_STEP columns */
+    if (rest > WRAP_COL_STEP)
+        rest = WRAP_COL_STEP;
+    return wrap_next_segment(line, ci->marks[k], (int)rest);
+}
+
+size_t wrap_cache_byte_col(WrapCache *c, const char *line, size_t idx, size_t byte)
+{
+    size_t first, len;
+    size_t start = wrap_cache_long_byte(c, idx, byte, &first, &len);
+    if (start != (size_t)-1)
+        return first + (size_t)wrap_cols_for_prefix(line + start, byte - start);
+    WrapColIndex *ci = cols_slot(c, line, idx);
+    if (!ci)
+        return (size_t)wrap_cols_for_prefix(line, byte);
+    while (ci->marks[ci->count - 1] < byte && cols_extend(ci, line))
+        ;
+    /* Last mark at or before 'byte' */
+    size_t lo = 0, hi = ci->count;
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ci->marks[mid] <= byte)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo * WRAP_COL_STEP + (size_t)wrap_cols_for_prefix(line + ci->marks[lo], byte - ci->marks[lo]);
+}
+
+void wrap_cache_set_long_min(WrapCache *c, size_t bytes)
+{
+    if (c->long_min == bytes)
+        return;
+    c->long_min = bytes;
+    /* Lines change sides of the threshold: measure them again */
+    wrap_cache_invalidate_all(c);
+}
+
+int wrap_cache_is_long(WrapCache *c, size_t idx)
+{
+    return long_slot(c, idx) != NULL;
+}
+
+size_t wrap_cache_long_col(WrapCache *c, size_t idx, size_t col, size_t *rest, size_t *len)
+{
+    WrapLongLine *l = long_slot(c, idx);
+    if (!l)
+        return (size_t)-1;
+    size_t k = long_chunk(l, l->cols, col, rest);
+    size_t start = fenwick_sum(l->bytes, k);
+    *len = fenwick_sum(l->bytes, k + 1) - start;
+    /* Columns never outnumber bytes, and past the end the walk stops at the chunk end */
+    if (*rest > *len)
+        *rest = *len;
+    return start;
+}
+
+size_t wrap_cache_long_byte(WrapCache *c, size_t idx, size_t byte, size_t *col, size_t *len)
+{
+    WrapLongLine *l = long_slot(c, idx);
+    if (!l)
+        return (size_t)-1;
+    size_t rest;
+    size_t k = long_chunk(l, l->bytes, byte, &rest);
+    size_t start = fenwick_sum(l->bytes, k);
+    *len = fenwick_sum(l->bytes, k + 1) - start;
+    *col = fenwick_sum(l->cols, k);
+    return start;
+}
+
+int wrap_cache_long_edit(WrapCache *c, size_t idx, size_t at, size_t removed, size_t removed_cols,
+                         size_t inserted, size_t inserted_cols)
+{
+    WrapLongLine *l = long_slot(c, idx);
+    if (!l || idx >= c->count)
+        return 0;
+    size_t rest;
+    size_t k = long_chunk(l, l->bytes, at, &rest);
+    size_t bytes = fenwick_sum(l->bytes, k + 1) - fenwick_sum(l->bytes, k);
+    size_t cols = fenwick_sum(l->cols, k + 1) - fenwick_sum(l->cols, k);
+    if (rest + removed > bytes || removed_cols > cols)
+    {
+        long_forget(c, idx);
+        return 0;
+    }
+    fenwick_change(l->bytes, l->n, k, bytes, bytes - removed + inserted);
+    fenwick_change(l->cols, l->n, k, cols, cols - removed_cols + inserted_cols);
+    l->total_cols = l->total_cols - removed_cols + inserted_cols;
+    /* The count follows without a walk; column marks for the old text are stale */
+    int v = long_rows(l, c->width < 1 ? 1 : c->width);
+    tree_update(c, idx, c->counts[idx], v);
+    c->counts[idx] = v;
+    cols_forget(c, idx);
+    return 1;
+}
@@ -3,13 +3,54 @@
 
 #include <stddef.h>
 
-/* Cache of per-line visual wrap counts at a specific text width */
+/* Column index for one line: the byte offset of every WRAP_COL_STEP-th display
+   column, so finding a column in a long line takes at most WRAP_COL_STEP steps
+   once the line has been walked. Kept for the last few lines looked at. */
+#define WRAP_COL_STEP 256
+#define WRAP_COL_SLOTS 64
+
+typedef struct WrapColIndex
+{
+    size_t line;      /* line index, (size_t)-1 when the slot is empty */
+    const char *text; /* the text the marks were taken from */
+    size_t *marks;    /* marks[k] = byte offset of column k * WRAP_COL_STEP */
+    size_t count, cap;
+    int complete;     /* the marks reach the end of the line */
+} WrapColIndex;
+
+/* Index for a line of at least long_min bytes, made the first time the line is
+   measured: the line cut into chunks of about WRAP_LONG_CHUNK bytes (ending before
+   a character that takes a column), with Fenwick trees over the bytes and columns
+   of the chunks. Its row count, column/byte lookups and single edits then cost
+   O(log n + WRAP_LONG_CHUNK) instead of a walk over the whole line. */
+#define WRAP_LONG_CHUNK 4096
+#define WRAP_LONG_SLOTS 4
+
+typedef struct WrapLongLine
+{
+    size_t line;          /* line index, (size_t)-1 when the slot is empty */
+    size_t n, cap;        /* chunks */
+    size_t *bytes, *cols; /* Fenwick trees over chunk lengths and widths, 1-based */
+    size_t total_cols;
+} WrapLongLine;
+
+/* Cache of per-line visual wrap counts at a specific text width, with a prefix
+   index (Fenwick tree) over them so the visual row of a line and the line at a
+   visual row are O(log n). Counts are computed on demand; lines not computed yet
+   count as one row in the index until wrap_cache_fill() gets to them. */
 typedef struct WrapCache
 {
-    int width;    /* cached text width; -1 when invalid */
-    size_t cap;   /* allocated size of counts array */
-    size_t count; /* logical number of lines tracked */
-    int *counts;  /* per-line visual line counts; -1 means unknown */
+    int width;        /* cached text width; -1 when invalid */
+    size_t cap;       /* allocated size of counts array */
+    size_t count;     /* logical number of lines tracked */
+    int *counts;      /* per-line visual line counts; -1 means unknown */
+    size_t *tree;     /* Fenwick tree over the counts, 1-based, cap + 1 entries */
+    int tree_valid;   /* 0 after a splice until the next index query rebuilds it */
+    size_t fill_next; /* lines before this have all been computed */
+    WrapColIndex *cols; /* WRAP_COL_SLOTS column indexes, by line index */
+    size_t long_min;    /* lines of at least this many bytes get a WrapLongLine; 0 = never */
+    WrapLongLine longs[WRAP_LONG_SLOTS];
+    size_t long_next;   /* slot to reuse next */
 } WrapCache;
 
 void wrap_cache_init(WrapCache *c, size_t count);
@@ -18,6 +59,51 @@ void wrap_cache_set_width(WrapCache *c, int width);
 void wrap_cache_ensure(WrapCache *c, size_t count);
 void wrap_cache_invalidate_line(WrapCache *c, size_t idx);
 void wrap_cache_invalidate_all(WrapCache *c);
+/* Follow a line splice: 'removed' entries at 'at' become 'inserted' unknown ones */
+void wrap_cache_splice(WrapCache *c, size_t at, size_t removed, size_t inserted);
 int wrap_cache_get(WrapCache *c, const char *line, size_t idx);
+/* The count of line idx if it is known without looking at the text, else -1 */
+int wrap_cache_peek(WrapCache *c, size_t idx);
+
+/* Visual rows taken by the lines before 'idx' */
+size_t wrap_cache_prefix(WrapCache *c, size_t idx);
+/* Line that visual row 'row' falls on, and the row within that line in *sub.
+   Rows past the end map to the last row of the last line. */
+size_t wrap_cache_find(WrapCache *c, size_t row, size_t *sub);
+
+/* Compute up to 'max_lines' counts not known yet, in file order, so the index
+   becomes exact a slice at a time while the editor is idle. Line 'skip' (the
+   one being edited, whose text is elsewhere) is left alone. Returns nonzero
+   if it stopped before the end, i.e. there may be more to do. */
+int wrap_cache_fill(WrapCache *c, char **lines, size_t max_lines, size_t skip);
+
+/* Column mapping through the column index, for drawing without wrapping: the
+   byte offset at which display column 'col' of line idx starts (the end of the
+   line if it is shorter), and the display column of byte offset 'byte'. 'line'
+   is the line's current text; edits reach the index through the invalidate and
+   splice calls above. */
+size_t wrap_cache_col_byte(WrapCache *c, const char *line, size_t idx, size_t col);
+size_t wrap_cache_byte_col(WrapCache *c, const char *line, size_t idx, size_t byte);
+
+/* Long lines. Lines measured from now on with at least 'bytes' bytes get a long-line
+   index (0 turns it off). The calls above use the index by themselves; the ones
+   below are for a line whose text is not contiguous (the line editor's gap
+   buffer), where the caller reads the chunk and finishes the walk in it. */
+void wrap_cache_set_long_min(WrapCache *c, size_t bytes);
+int wrap_cache_is_long(WrapCache *c, size_t idx);
+/* The chunk display column 'col' falls in: its first byte (returned), its length
+   in *len and the columns into it in *rest (walk them with wrap_next_segment(),
+   which steps over marks at the chunk start). Past the end of the line it is the
+   end of the last chunk. Returns (size_t)-1 if line idx has no long-line index. */
+size_t wrap_cache_long_col(WrapCache *c, size_t idx, size_t col, size_t *rest, size_t *len);
+/* The chunk byte offset 'byte' falls in: its first byte (returned), its length in
+   *len and its first display column in *col. (size_t)-1 without an index. */
+size_t wrap_cache_long_byte(WrapCache *c, size_t idx, size_t byte, size_t *col, size_t *len);
+/* Follow an edit of a long line in place: 'removed' bytes taking 'removed_cols'
+   columns at 'at' were replaced by 'inserted' bytes taking 'inserted_cols'. Returns
+   0 if the index could not follow it (no index, or the edit spans chunks); the
+   caller then invalidates the line. */
+int wrap_cache_long_edit(WrapCache *c, size_t idx, size_t at, size_t removed, size_t removed_cols,
+                         size_t inserted, size_t inserted_cols);
 
 #endif /* VTE_WRAP_CACHE_H */
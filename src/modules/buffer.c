@@ -1,18 +1,119 @@
 #include "buffer.h"
+#include "undo.h"
+#include "line_store.h"
+#include "../platform/platform.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
-#define MAX_BUFFERS 16
 static Buffer buffers[MAX_BUFFERS];
 static size_t buf_count = 0;
 static int cur_buf = 0;
+static int save_fsync = 1;
+
+/* Saving: lines of SAVE_COPY_MAX bytes or more are written straight from the line
+   store; shorter ones (and newlines) are copied into a staging area, where a run
+   of them becomes one chunk, since each chunk of a writev costs more than copying
+   a few dozen bytes. */
+#define SAVE_CHUNKS 1024
+#define SAVE_STAGE (64 * 1024)
+#define SAVE_COPY_MAX 256
+
+typedef struct
+{
+    PlatformSaveFile *f;
+    PlatformChunk chunks[SAVE_CHUNKS];
+    size_t n;
+    char *stage;
+    size_t used, run; /* stage[run..used) is not in chunks yet */
+    int failed;
+} SaveBatch;
+
+static void batch_close_run(SaveBatch *s)
+{
+    if (s->used > s->run)
+    {
+        s->chunks[s->n].data = s->stage + s->run;
+        s->chunks[s->n++].len = s->used - s->run;
+        s->run = s->used;
+    }
+}
+
+static void batch_flush(SaveBatch *s)
+{
+    batch_close_run(s);
+    if (s->n > 0 && !s->failed && platform_save_write(s->f, s->chunks, s->n) != 0)
+        s->failed = 1;
+    s->n = s->used = s->run = 0;
+}
+
+/* Add bytes by copying them (len < SAVE_STAGE) */
+static void batch_copy(SaveBatch *s, const char *p, size_t len)
+{
+    if (s->used + len > SAVE_STAGE)
+        batch_flush(s);
+    memcpy(s->stage + s->used, p, len);
+    s->used += len;
+}
+
+/* Add bytes that stay where they are until the next flush */
+static void batch_ref(SaveBatch *s, const char *p, size_t len)
+{
+    if (s->n + 2 > SAVE_CHUNKS)
+        batch_flush(s);
+    batch_close_run(s);
+    s->chunks[s->n].data = p;
+    s->chunks[s->n++].len = len;
+}
+
+static SaveBatch *batch_open(const char *path)
+{
+    SaveBatch *s = (SaveBatch *)calloc(1, sizeof(SaveBatch));
+    if (!s || !(s->stage = (char *)malloc(SAVE_STAGE)) || !(s->f = platform_save_begin(path)))
+    {
+        if (s)
+            free(s->stage);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+static void batch_free(SaveBatch *s)
+{
+    free(s->stage);
+    free(s);
+}
+
+/* FNV-1a over the content as it is written to disk (each line followed by '\n');
+   identifies a file version for the undo journal. */
+#define CONTENT_HASH_SEED 14695981039346656037ULL
+
+static uint64_t content_hash_update(uint64_t h, const char *s, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
 
 static void buffer_init(Buffer *b)
 {
+    b->lines = NULL;
     b->count = 0;
+    b->cap = 0;
     b->path = NULL;
     b->dirty = 0;
+    b->undo = NULL;
+    b->spare_lines = NULL;
+    b->disk_mtime = -1;
+    b->disk_size = -1;
+    b->disk_read = 0;
+    b->follow = 0;
 }
 
 void buffer_pool_init(void)
@@ -33,11 +134,131 @@ size_t buffer_count(void)
     return buf_count;
 }
 
+Buffer *buffer_at(size_t i)
+{
+    return i < buf_count ? &buffers[i] : NULL;
+}
+
 int buffer_index(void)
 {
     return cur_buf;
 }
 
+/* Append a line read from a file, trimming its line ending */
+static int load_line(Buffer *b, const char *text, size_t len, uint64_t *hash)
+{
+    while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r'))
+        len--;
+    *hash = content_hash_update(*hash, text, len);
+    *hash = content_hash_update(*hash, "\n", 1);
+    char *line;
+    if (buffer_reserve(b, b->count + 1) != 0 || !(line = line_new(text, len)))
+        return -1;
+    b->lines[b->count++] = line;
+    return 0;
+}
+
+/* Read the lines of an open file into b (always at least one). Of the line store only
+   line_new() is used, so a loader thread may call this for a buffer of its own.
+   Returns 0, or -1 if memory ran out and only the lines before that were read. */
+static int read_lines(Buffer *b, FILE *f, uint64_t *hash)
+{
+    char linebuf[8192];
+    *hash = CONTENT_HASH_SEED;
+    int result = 0;
+    char *part = NULL; /* line being read: fgets hands over long lines in pieces */
+    size_t len = 0, cap = 0;
+    while (fgets(linebuf, sizeof(linebuf), f))
+    {
+        size_t n = strlen(linebuf);
+        int ends = n > 0 && linebuf[n - 1] == '\n';
+        b->disk_read += n;
+        if (len == 0 && ends)
+        {
+            if (load_line(b, linebuf, n, hash) != 0)
+            {
+                result = -1;
+                break; /* out of memory, stop loading */
+            }
+            continue;
+        }
+        /* Grow by doubling so a line of many pieces is not copied once per piece */
+        if (len + n > cap)
+        {
+            size_t grown_cap = len + n > 2 * cap ? len + n : 2 * cap;
+            char *grown = (char *)realloc(part, grown_cap);
+            if (!grown)
+            {
+                result = -1;
+                break;
+            }
+            part = grown;
+            cap = grown_cap;
+        }
+        memcpy(part + len, linebuf, n);
+        len += n;
+        if (!ends)
+            continue; /* the rest of the line is still to come */
+        if (load_line(b, part, len, hash) != 0)
+        {
+            result = -1;
+            break;
+        }
+        len = 0;
+    }
+    /* Last line without a newline */
+    if (result == 0 && len > 0 && load_line(b, part, len, hash) != 0)
+        result = -1;
+    free(part);
+    if (b->count == 0 && buffer_reserve(b, 1) == 0)
+    {
+        b->lines[0] = line_new("", 0);
+        if (b->lines[0])
+            b->count = 1;
+    }
+    return b->count > 0 ? result : -1;
+}
+
+static void note_stamp(Buffer *b, const char *path)
+{
+    if (platform_file_stamp(path, &b->disk_mtime, &b->disk_size) != 0)
+        b->disk_mtime = b->disk_size = -1;
+}
+
+/* Read 'path' into b, fresh from buffer_init(); -1 if it cannot be opened */
+static int load_file(Buffer *b, const char *path, uint64_t *hash)
+{
+    /* Stamped before reading: a change made meanwhile shows as a newer stamp later */
+    note_stamp(b, path);
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    read_lines(b, f, hash);
+    fclose(f);
+    b->dirty = 0;
+    return 0;
+}
+
+/* Slot a new buffer goes to: the first one while nothing was ever put in it (so one
+   file makes one buffer), else the next free one; -1 if the pool is full */
+static int free_slot(void)
+{
+    if (buf_count == 1 && buffers[0].count == 0 && !buffers[0].path)
+        return 0;
+    return buf_count < MAX_BUFFERS ? (int)buf_count : -1;
+}
+
+/* Put a loaded buffer (with its path) into free_slot(), which must be there */
+static int add_buffer(const Buffer *loaded, uint64_t hash)
+{
+    int i = free_slot();
+    buffers[i] = *loaded;
+    if ((size_t)i == buf_count)
+        buf_count++;
+    undo_journal_open(&buffers[i], buffers[i].path, hash);
+    return i;
+}
+
 int buffer_open_file(const char *path)
 {
     if (!path)
@@ -51,65 +272,438 @@ int buffer_open_file(const char *path)
             return (int)i;
         }
     }
-    if (buf_count >= MAX_BUFFERS)
+    if (free_slot() < 0)
         return -1;
-    Buffer *b = &buffers[buf_count];
-    buffer_init(b);
-    FILE *f = fopen(path, "rb");
-    if (!f)
+    Buffer b;
+    buffer_init(&b);
+    uint64_t hash;
+    if (load_file(&b, path, &hash) != 0)
         return -1;
-    char linebuf[8192];
-    while (fgets(linebuf, sizeof(linebuf), f))
+    b.path = strdup(path);
+    cur_buf = add_buffer(&b, hash);
+    return cur_buf;
+}
+
+static void free_lines(Buffer *b)
+{
+    for (size_t i = 0; i < b->count; ++i)
+        line_release(b->lines[i]);
+    free(b->lines);
+}
+
+/* Files from the command line, each read by a thread of its own into a buffer off
+   the pool; loads[load_next..load_count) are not added yet */
+typedef struct
+{
+    char *path;
+    Buffer b;
+    uint64_t hash;
+    int result; /* written by the loader before it sets 'done' */
+    atomic_int done;
+    PlatformThread *thread;
+} BufferLoad;
+
+static BufferLoad loads[MAX_BUFFERS];
+static size_t load_count, load_next;
+
+static void load_thread(void *arg)
+{
+    BufferLoad *l = (BufferLoad *)arg;
+    l->result = load_file(&l->b, l->path, &l->hash);
+    atomic_store(&l->done, 1);
+}
+
+size_t buffer_load_start(char *const *paths, size_t n)
+{
+    size_t started = 0;
+    for (size_t i = 0; i < n; ++i)
     {
-        size_t len = strlen(linebuf);
-        while (len > 0 && (linebuf[len - 1] == '\n' || linebuf[len - 1] == '\r'))
-            linebuf[--len] = '\0';
-        char *newline = malloc(len + 1);
-        if (!newline)
-            break; /* out of memory, stop loading */
-        memcpy(newline, linebuf, len);
-        newline[len] = '\0';
-        b->lines[b->count] = newline;
-        b->count++;
-        if (b->count >= MAX_LINES)
+        int seen = 0;
+        for (size_t k = 0; k < load_count && !seen; ++k)
+            seen = loads[k].path && strcmp(loads[k].path, paths[i]) == 0;
+        if (seen)
+        {
+            started++; /* the same file twice is read once */
+            continue;
+        }
+        if (load_count == MAX_BUFFERS)
             break;
+        BufferLoad *l = &loads[load_count++];
+        buffer_init(&l->b);
+        atomic_init(&l->done, 0);
+        l->thread = NULL;
+        l->result = -1;
+        if (!(l->path = strdup(paths[i])))
+            atomic_store(&l->done, 1);
+        else if (!(l->thread = platform_thread_start(load_thread, l)))
+            load_thread(l); /* no thread to be had: read it right here */
+        started++;
     }
-    if (b->count == 0)
+    return started;
+}
+
+size_t buffer_load_pending(void)
+{
+    return load_count - load_next;
+}
+
+int buffer_load_next(int wait, const char **path, int *index)
+{
+    if (load_next == load_count)
+        return 0;
+    BufferLoad *l = &loads[load_next];
+    if (!wait && !atomic_load(&l->done))
+        return 0;
+    if (l->thread)
+        platform_thread_join(l->thread);
+    l->thread = NULL;
+    load_next++;
+    *path = l->path ? l->path : "";
+    *index = -1;
+    if (l->result != 0)
+        return 1;
+    if (free_slot() < 0)
     {
-        b->lines[0] = malloc(1);
-        if (b->lines[0])
+        free_lines(&l->b);
+        return 1;
+    }
+    /* the buffer takes the path */
+    l->b.path = l->path;
+    l->path = NULL;
+    *index = add_buffer(&l->b, l->hash);
+    return 1;
+}
+
+int buffer_reload(Buffer *b, LineHunk **hunks, size_t *count)
+{
+    *hunks = NULL;
+    *count = 0;
+    if (!b->path)
+        return -1;
+    FILE *f = fopen(b->path, "rb");
+    if (!f)
+        return -1;
+    Buffer fresh;
+    buffer_init(&fresh);
+    uint64_t hash;
+    int failed = read_lines(&fresh, f, &hash) != 0;
+    fclose(f);
+    LineHunk *h = NULL;
+    size_t n = 0;
+    if (!failed)
+        failed = line_diff(b->lines, b->count, fresh.lines, fresh.count, &h, &n) != 0;
+    /* Room for the most lines there are while the hunks go in, from the last one */
+    size_t most = b->count, lines = b->count;
+    for (size_t i = n; i-- > 0;)
+    {
+        lines = lines - h[i].removed + h[i].inserted;
+        if (lines > most)
+            most = lines;
+    }
+    if (failed || buffer_reserve(b, most) != 0)
+    {
+        free(h);
+        free_lines(&fresh);
+        return -1;
+    }
+    b->disk_read = fresh.disk_read;
+    if (n > 0)
+    {
+        undo_begin_group(b);
+        for (size_t i = n; i-- > 0;)
         {
-            b->lines[0][0] = '\0';
-            b->count = 1;
+            const LineHunk *k = &h[i];
+            undo_record_lines(b, k->old_at, &b->lines[k->old_at], k->removed, &fresh.lines[k->new_at], k->inserted);
+            buffer_splice_lines(b, k->old_at, k->removed, &fresh.lines[k->new_at], k->inserted);
+            /* the buffer has those lines now */
+            memset(&fresh.lines[k->new_at], 0, k->inserted * sizeof(char *));
         }
+        undo_end_group(b);
+        b->dirty = 0;
+        undo_journal_saved(b, b->path, hash);
     }
-    fclose(f);
-    b->path = strdup(path);
-    b->dirty = 0;
-    cur_buf = (int)buf_count;
-    buf_count++;
-    return cur_buf;
+    free_lines(&fresh);
+    *hunks = h;
+    *count = n;
+    return 0;
 }
-/* this hurts */
-int buffer_save_current(const char *path)
+
+int buffer_read_appended(Buffer *b, size_t budget, size_t *first)
 {
-    Buffer *b = buffer_current();
-    const char *p = path ? path : b->path;
-    if (!p)
+    *first = b->count;
+    long long mtime, size;
+    if (!b->path || platform_file_stamp(b->path, &mtime, &size) != 0)
+        return -1;
+    b->disk_mtime = mtime;
+    b->disk_size = size;
+    if ((unsigned long long)size < b->disk_read)
         return -1;
-    FILE *f = fopen(p, "wb");
+    size_t want = (size_t)((unsigned long long)size - b->disk_read);
+    if (want == 0)
+        return 0;
+    if (want > budget)
+        want = budget;
+    FILE *f = fopen(b->path, "rb");
     if (!f)
         return -1;
-    for (size_t i = 0; i < b->count; ++i)
-        fprintf(f, "%s\n", b->lines[i]);
+    /* The last line goes on unless the file ended in a newline so far */
+    int open_line = 1;
+    if (b->disk_read > 0)
+        open_line = platform_seek_file(f, (long long)b->disk_read - 1, SEEK_SET) != 0 || fgetc(f) != '\n';
+    char *data = (char *)malloc(want);
+    size_t got = data ? fread(data, 1, want, f) : 0;
     fclose(f);
+    size_t pieces = 0;
+    for (size_t i = 0; i < got; ++i)
+        pieces += data[i] == '\n';
+    if (got > 0 && data[got - 1] != '\n')
+        pieces++;
+    char **lines = pieces ? (char **)malloc(pieces * sizeof(char *)) : NULL;
+    size_t at = open_line ? b->count - 1 : b->count;
+    size_t made = 0, start = 0;
+    for (; lines && made < pieces; ++made)
+    {
+        const char *nl = (const char *)memchr(data + start, '\n', got - start);
+        size_t seg = nl ? (size_t)(nl - (data + start)) : got - start;
+        size_t keep = seg;
+        while (nl && keep > 0 && data[start + keep - 1] == '\r')
+            keep--;
+        char *line;
+        if (made == 0 && open_line)
+        {
+            const char *last = b->lines[at];
+            size_t last_len = line_len(last);
+            /* a read can end between the '\r' and the '\n' of a line ending */
+            while (nl && keep == 0 && last_len > 0 && last[last_len - 1] == '\r')
+                last_len--;
+            line = line_new(last, last_len);
+            char *grown = line ? line_writable(line, last_len + keep) : NULL;
+            if (!grown)
+                line_release(line);
+            else
+            {
+                memcpy(grown + last_len, data + start, keep);
+                line_set_len(grown, last_len + keep);
+            }
+            line = grown;
+        }
+        else
+            line = line_new(data + start, keep);
+        if (!line)
+            break;
+        lines[made] = line;
+        start += seg + 1;
+    }
+    int dirty = b->dirty;
+    /* out of memory: nothing is taken in, the same bytes are tried again next time */
+    if (!lines || made < pieces || buffer_splice_lines(b, at, open_line ? 1 : 0, lines, pieces) != 0)
+    {
+        for (size_t i = 0; i < made; ++i)
+            line_release(lines[i]);
+        free(lines);
+        free(data);
+        return 0;
+    }
+    b->dirty = dirty;
+    b->disk_read += got;
+    *first = at;
+    free(lines);
+    free(data);
+    return b->disk_read < (unsigned long long)size ? 1 : 0;
+}
+
+void buffer_set_fsync(int enabled)
+{
+    save_fsync = enabled;
+}
+
+/* Write the lines and replace the file with them; *hash and *total describe what was
+   written. 'done' (if given) follows the number of lines written, for another thread. */
+static int save_lines(SaveBatch *s, char *const *lines, size_t count, int sync,
+                      uint64_t *hash, size_t *total, atomic_size_t *done)
+{
+    uint64_t h = CONTENT_HASH_SEED;
+    size_t bytes = 0;
+    for (size_t i = 0; i < count && !s->failed; ++i)
+    {
+        size_t len = line_len(lines[i]);
+        if (len < SAVE_COPY_MAX)
+            batch_copy(s, lines[i], len);
+        else
+            batch_ref(s, lines[i], len);
+        batch_copy(s, "\n", 1);
+        h = content_hash_update(h, lines[i], len);
+        h = content_hash_update(h, "\n", 1);
+        bytes += len + 1;
+        if (done && (i & 4095) == 4095)
+            atomic_store_explicit(done, i + 1, memory_order_relaxed);
+    }
+    batch_flush(s);
+    int failed = s->failed;
+    if (failed)
+        platform_save_abort(s->f);
+    else
+        failed = platform_save_commit(s->f, sync) != 0;
+    *hash = h;
+    *total = bytes;
+    return failed ? -1 : 0;
+}
+
+/* b was saved to 'path' with content 'hash' ('total' bytes): take the path and the
+   file's stamp, and mark the save in the undo journal unless b changed since the
+   content was taken (the marker has to sit where that content was, which is then
+   behind the newer records) */
+static void save_done(Buffer *b, const char *path, uint64_t hash, size_t total)
+{
+    char *saved_path = strdup(path);
     if (b->path)
         free(b->path);
-    b->path = strdup(p);
+    b->path = saved_path;
+    note_stamp(b, path);
+    b->disk_read = total;
+    if (!b->dirty)
+        undo_journal_saved(b, b->path, hash);
+}
+
+int buffer_save_current(const char *path, size_t *written)
+{
+    Buffer *b = buffer_current();
+    const char *p = path ? path : b->path;
+    if (!p)
+        return -1;
+    SaveBatch *s = batch_open(p);
+    if (!s)
+        return -1;
+    uint64_t hash = 0;
+    size_t total = 0;
+    int failed = save_lines(s, b->lines, b->count, save_fsync, &hash, &total, NULL) != 0;
+    batch_free(s);
+    if (failed)
+        return -1;
     b->dirty = 0;
+    save_done(b, p, hash, total);
+    if (written)
+        *written = total;
     return 0;
 }
 
+struct BufferSave
+{
+    Buffer *b;
+    char *path;
+    char **lines; /* the buffer's line array when the save started */
+    size_t count;
+    int sync;
+    int was_dirty;
+    long long started;
+    SaveBatch *batch;
+    PlatformThread *thread;
+    atomic_size_t lines_done;
+    atomic_int finished;
+    /* written by the writer before it sets 'finished' */
+    int result;
+    uint64_t hash;
+    size_t total;
+    long long us;
+};
+
+static void save_thread(void *arg)
+{
+    BufferSave *s = (BufferSave *)arg;
+    s->result = save_lines(s->batch, s->lines, s->count, s->sync, &s->hash, &s->total, &s->lines_done);
+    s->us = platform_now_us() - s->started;
+    atomic_store(&s->finished, 1);
+}
+
+BufferSave *buffer_save_start(const char *path)
+{
+    Buffer *b = buffer_current();
+    const char *p = path ? path : b->path;
+    if (!p)
+        return NULL;
+    BufferSave *s = (BufferSave *)calloc(1, sizeof(BufferSave));
+    char **spare = (char **)malloc((b->cap ? b->cap : 1) * sizeof(char *));
+    if (!s || !spare || !(s->path = strdup(p)) || !(s->batch = batch_open(p)))
+    {
+        if (s)
+            free(s->path);
+        free(s);
+        free(spare);
+        return NULL;
+    }
+    s->b = b;
+    s->lines = b->lines;
+    s->count = b->count;
+    s->sync = save_fsync;
+    s->started = platform_now_us();
+    atomic_init(&s->lines_done, 0);
+    atomic_init(&s->finished, 0);
+    /* From here on neither the array nor the lines change under the writer */
+    b->spare_lines = spare;
+    line_hold();
+    s->thread = platform_thread_start(save_thread, s);
+    if (!s->thread)
+    {
+        line_unhold();
+        b->spare_lines = NULL;
+        free(spare);
+        platform_save_abort(s->batch->f);
+        batch_free(s->batch);
+        free(s->path);
+        free(s);
+        return NULL;
+    }
+    s->was_dirty = b->dirty;
+    b->dirty = 0;
+    return s;
+}
+
+int buffer_save_progress(BufferSave *s)
+{
+    if (atomic_load(&s->finished))
+        return 100;
+    size_t done = atomic_load_explicit(&s->lines_done, memory_order_relaxed);
+    return s->count > 0 ? (int)(done * 99 / s->count) : 0;
+}
+
+int buffer_save_finish(BufferSave *s, size_t *written, long long *us)
+{
+    platform_thread_join(s->thread);
+    Buffer *b = s->b;
+    line_unhold();
+    /* The array the writer read is either still the buffer's or was left to the save */
+    if (b->spare_lines)
+    {
+        free(b->spare_lines);
+        b->spare_lines = NULL;
+    }
+    else
+        free(s->lines);
+    int result = s->result;
+    if (result == 0)
+        save_done(b, s->path, s->hash, s->total);
+    else if (s->was_dirty)
+        b->dirty = 1;
+    if (written)
+        *written = s->total;
+    if (us)
+        *us = s->us;
+    batch_free(s->batch);
+    free(s->path);
+    free(s);
+    return result;
+}
+
+void buffer_own_lines(Buffer *b)
+{
+    if (!b->spare_lines)
+        return;
+    /* The save keeps the array it is reading and frees it when it finishes */
+    memcpy(b->spare_lines, b->lines, b->count * sizeof(char *));
+    b->lines = b->spare_lines;
+    b->spare_lines = NULL;
+}
+
 int buffer_next(void)
 {
     if (buf_count == 0)
@@ -126,14 +720,82 @@ int buffer_prev(void)
     return cur_buf;
 }
 
+int buffer_reserve(Buffer *b, size_t n)
+{
+    if (n <= b->cap)
+        return 0;
+    buffer_own_lines(b);
+    size_t new_cap = b->cap > 0 ? b->cap : 64;
+    while (new_cap < n)
+        new_cap *= 2;
+    char **grown = (char **)realloc(b->lines, new_cap * sizeof(char *));
+    if (!grown)
+        return -1;
+    b->lines = grown;
+    b->cap = new_cap;
+    return 0;
+}
+
+int buffer_insert_line(Buffer *b, size_t at, char *line)
+{
+    if (!b || !line || at > b->count || buffer_reserve(b, b->count + 1) != 0)
+        return -1;
+    buffer_own_lines(b);
+    memmove(&b->lines[at + 1], &b->lines[at], (b->count - at) * sizeof(char *));
+    b->lines[at] = line;
+    b->count++;
+    b->dirty = 1;
+    return 0;
+}
+
+int buffer_delete_line(Buffer *b, size_t at)
+{
+    if (!b || at >= b->count || b->count <= 1)
+        return -1;
+    buffer_own_lines(b);
+    line_release(b->lines[at]);
+    memmove(&b->lines[at], &b->lines[at + 1], (b->count - at - 1) * sizeof(char *));
+    b->count--;
+    b->dirty = 1;
+    return 0;
+}
+
+int buffer_splice_lines(Buffer *b, size_t at, size_t remove, char **lines, size_t n)
+{
+    if (!b || at > b->count || remove > b->count - at)
+        return -1;
+    if (n > remove && buffer_reserve(b, b->count - remove + n) != 0)
+        return -1;
+    buffer_own_lines(b);
+    for (size_t i = 0; i < remove; ++i)
+        line_release(b->lines[at + i]);
+    if (n != remove)
+        memmove(&b->lines[at + n], &b->lines[at + remove], (b->count - at - remove) * sizeof(char *));
+    if (n > 0)
+        memcpy(&b->lines[at], lines, n * sizeof(char *));
+    b->count = b->count - remove + n;
+    b->dirty = 1;
+    return 0;
+}
+
 void buffer_free_all(void)
 {
+    /* quitting before every file was added: the rest are read to the end */
+    for (size_t i = 0; i < load_count; ++i)
+    {
+        BufferLoad *l = &loads[i];
+        if (l->thread)
+            platform_thread_join(l->thread);
+        if (i >= load_next)
+            free_lines(&l->b);
+        free(l->path);
+    }
     for (size_t i = 0; i < buf_count; ++i)
     {
         Buffer *b = &buffers[i];
-        for (size_t j = 0; j < b->count; ++j)
-            free(b->lines[j]);
+        free_lines(b);
         if (b->path)
             free(b->path);
+        undo_history_free(b);
     }
 }
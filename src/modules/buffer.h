@@ -2,26 +2,96 @@
 #define VTE_BUFFER_H
 
 #include <stddef.h>
+#include "line_diff.h"
 
-#define MAX_LINES 65536
+#define MAX_BUFFERS 16
+
+struct UndoHistory;
 
 typedef struct Buffer
 {
-    char *lines[MAX_LINES];
+    char **lines;             /* line array, grown on demand; lines come from line_store.h */
     size_t count;
-    char *path; /* optional filename for this buffer */
-    int dirty;  /* modified since last save */
+    size_t cap;               /* allocated slots in lines */
+    char *path;               /* optional filename for this buffer */
+    int dirty;                /* modified since the last save began */
+    struct UndoHistory *undo; /* undo/redo history, owned by the undo module */
+    char **spare_lines;       /* while a background save reads 'lines': room for the buffer's own copy */
+    long long disk_mtime;     /* stamp of the file as last loaded or saved (platform_file_stamp); */
+    long long disk_size;      /* both -1 if it was not there */
+    size_t disk_read;         /* bytes of the file the lines were read from or written to */
+    int follow;               /* follow mode: take in what is appended to the file */
 } Buffer;
 
 /* Buffer pool management */
 void buffer_pool_init(void);
 Buffer *buffer_current(void);
 size_t buffer_count(void);
+Buffer *buffer_at(size_t i);
 int buffer_open_file(const char *path); /* returns index or -1 on error */
-int buffer_save_current(const char *path);
+/* Opening many files at once (vte a b c): each file is read by a thread of its own,
+   so the whole takes about as long as the largest. buffer_load_start() returns how
+   many of the paths are being read (up to MAX_BUFFERS, each file once). */
+size_t buffer_load_start(char *const *paths, size_t n);
+/* Files started but not yet added */
+size_t buffer_load_pending(void);
+/* Add the next of those files, in the order given, once it is read (waiting for it
+   if 'wait'), so the first can be used while the rest come in behind it. Returns 0
+   if none is ready or left; else 1 with *path the file and *index the buffer it
+   became, or -1 if it could not be opened or no buffer is free. *path stays valid
+   until buffer_free_all(). */
+int buffer_load_next(int wait, const char **path, int *index);
+/* Write the current buffer to 'path' (or its own path) by replacing the file as a
+   whole, so a failed save leaves the old one intact. *written gets the size. */
+int buffer_save_current(const char *path, size_t *written);
+/* Bring b in line with its file after another program changed it. The file is read
+   again and only the lines that differ are replaced (see line_diff.h), as one undo
+   step, so unchanged lines stay where they are along with anything kept per line.
+   The changes come back in *hunks (malloc'd, in order, positions in the old and the
+   new lines); applying them from the last one keeps the earlier positions valid.
+   Returns 0 on success; on failure b is unchanged. */
+int buffer_reload(Buffer *b, LineHunk **hunks, size_t *count);
+/* Take in what was appended to b's file since it was read or written (follow mode,
+   for logs and other growing files), at most 'budget' bytes per call. The new lines
+   go at the end without an undo step, as if loaded with the rest; an unfinished last
+   line is completed by a later call. *first is the first line that changed (b->count
+   if none). Returns 1 if more is waiting, 0 if caught up, -1 if the file is shorter
+   than what was read (truncated or replaced), which takes a reload instead. */
+int buffer_read_appended(Buffer *b, size_t budget, size_t *first);
+/* Flush saved files to disk before they replace the original (on by default) */
+void buffer_set_fsync(int enabled);
+
+/* Background save of the current buffer. Starting takes O(1): the writer thread
+   reads the line array as it is, the lines are held (line_hold()) and the buffer
+   moves to a copy of the array when it next changes it. The buffer counts as
+   saved from the start; edits made meanwhile mark it dirty again. One save at a
+   time; returns NULL if it could not be started. */
+typedef struct BufferSave BufferSave;
+BufferSave *buffer_save_start(const char *path);
+/* Percentage of the lines written so far; 100 once the writer is done */
+int buffer_save_progress(BufferSave *s);
+/* Wait for the writer and apply the result: the new path and, if nothing changed
+   since the start, the undo journal's save marker. A failed save marks the buffer
+   dirty again. Frees s; returns 0 on success with the size in *written and the
+   time the writer took in *us. */
+int buffer_save_finish(BufferSave *s, size_t *written, long long *us);
+/* Call before storing into b->lines directly (the calls below do it themselves) */
+void buffer_own_lines(Buffer *b);
 int buffer_next(void);  /* switch to next buffer, returns new index */
 int buffer_prev(void);  /* switch to previous buffer */
 int buffer_index(void); /* current buffer index */
 void buffer_free_all(void);
 
+/* Line-level edits; the buffer takes over the caller's reference to 'line'. Return 0 on success, -1 if full/out of range. */
+int buffer_insert_line(Buffer *b, size_t at, char *line);
+int buffer_delete_line(Buffer *b, size_t at);
+
+/* Make room for at least n lines without further reallocation */
+int buffer_reserve(Buffer *b, size_t n);
+/* Replace 'remove' lines starting at 'at' with the n lines in 'lines' using a single
+   move of the tail. The removed lines are released and the buffer takes over the
+   references to the new ones (the array itself stays with the caller). Returns 0 on success, -1 on failure
+   (nothing changed, the caller still owns the new lines). */
+int buffer_splice_lines(Buffer *b, size_t at, size_t remove, char **lines, size_t n);
+
 #endif /* VTE_BUFFER_H */
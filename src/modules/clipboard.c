@@ -1,58 +1,154 @@
 #include "clipboard.h"
+#include "line_store.h"
 #include <stdlib.h>
 #include <string.h>
 
-static char *clip_content = NULL;
-static ClipboardType clip_type = CLIP_CHAR;
+/* Register contents: a vector of line references shared with the buffers
+   (see line_store.h). Character yanks keep a single entry. */
+typedef struct
+{
+    ClipboardType type;
+    char **lines;
+    size_t count;
+} Register;
+
+#define REG_COUNT 27 /* unnamed + 'a'-'z' */
+
+static Register registers[REG_COUNT];
+static int unnamed_slot = 0; /* slot the unnamed register currently refers to */
+
+static void register_clear(Register *r)
+{
+    for (size_t i = 0; i < r->count; ++i)
+        line_release(r->lines[i]);
+    free(r->lines);
+    r->lines = NULL;
+    r->count = 0;
+    r->type = CLIP_CHAR;
+}
+
+/* Slot for a register name, or -1 */
+static int slot_for(int reg)
+{
+    if (reg == CLIP_UNNAMED)
+        return 0;
+    if (reg >= 'a' && reg <= 'z')
+        return 1 + (reg - 'a');
+    if (reg >= 'A' && reg <= 'Z')
+        return 1 + (reg - 'A');
+    return -1;
+}
+
+/* Slot to read from: the unnamed register follows the last yank */
+static const Register *lookup(int reg)
+{
+    int slot = slot_for(reg);
+    if (slot < 0)
+        return NULL;
+    if (slot == 0)
+        slot = unnamed_slot;
+    return &registers[slot];
+}
 
 void clipboard_init(void)
 {
-    clip_content = NULL;
-    clip_type = CLIP_CHAR;
+    memset(registers, 0, sizeof(registers));
+    unnamed_slot = 0;
 }
 
 void clipboard_free(void)
 {
-    if (clip_content)
-    {
-        free(clip_content);
-        clip_content = NULL;
-    }
+    for (int i = 0; i < REG_COUNT; ++i)
+        register_clear(&registers[i]);
+    unnamed_slot = 0;
 }
 
-void clipboard_yank_char(const char *text)
+int clipboard_valid_register(int reg)
 {
-    clipboard_free();
-    if (text)
-    {
-        clip_content = strdup(text);
-        clip_type = CLIP_CHAR;
-    }
+    return slot_for(reg) >= 0;
+}
+
+/* Replace a register's content with the given line vector (references already taken) */
+static void store(int slot, ClipboardType type, char **lines, size_t n)
+{
+    Register *r = &registers[slot];
+    register_clear(r);
+    r->type = type;
+    r->lines = lines;
+    r->count = n;
+    unnamed_slot = slot;
 }
 
-void clipboard_yank_line(const char *text)
+int clipboard_yank_char(int reg, const char *text)
 {
-    clipboard_free();
-    if (text)
+    int slot = slot_for(reg);
+    if (slot < 0 || !text)
+        return -1;
+    char **lines = (char **)malloc(sizeof(char *));
+    if (!lines)
+        return -1;
+    lines[0] = line_new(text, strlen(text));
+    if (!lines[0])
     {
-        clip_content = strdup(text);
-        clip_type = CLIP_LINE;
+        free(lines);
+        return -1;
     }
+    store(slot, CLIP_CHAR, lines, 1);
+    return 0;
 }
 
-char *clipboard_paste(void)
+int clipboard_yank_lines(int reg, char *const *lines, size_t n)
 {
-    if (!clip_content)
+    int slot = slot_for(reg);
+    if (slot < 0 || n == 0)
+        return -1;
+    /* Only pointers are copied; the text stays shared with the buffer */
+    char **refs = (char **)malloc(n * sizeof(char *));
+    if (!refs)
+        return -1;
+    for (size_t i = 0; i < n; ++i)
+        refs[i] = line_retain(lines[i]);
+    store(slot, CLIP_LINE, refs, n);
+    return 0;
+}
+
+char *clipboard_paste(int reg)
+{
+    const Register *r = lookup(reg);
+    if (!r || r->count == 0)
         return NULL;
-    return strdup(clip_content);
+    return strdup(r->lines[0]);
+}
+
+char **clipboard_paste_lines(int reg, size_t *n)
+{
+    *n = 0;
+    const Register *r = lookup(reg);
+    if (!r || r->count == 0)
+        return NULL;
+    char **out = (char **)malloc(r->count * sizeof(char *));
+    if (!out)
+        return NULL;
+    for (size_t i = 0; i < r->count; ++i)
+        out[i] = line_retain(r->lines[i]);
+    *n = r->count;
+    return out;
+}
+
+size_t clipboard_line_count(int reg)
+{
+    const Register *r = lookup(reg);
+    return r ? r->count : 0;
 }
 
-ClipboardType clipboard_type(void)
+ClipboardType clipboard_type(int reg)
 {
-    return clip_type;
+    const Register *r = lookup(reg);
+    return r ? r->type : CLIP_CHAR;
 }
 
-int clipboard_has_content(void)
+int clipboard_has_content(int reg)
 {
-    return clip_content != NULL;
+    const Register *r = lookup(reg);
+    return r && r->count > 0;
 }
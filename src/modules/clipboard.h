@@ -10,17 +10,31 @@ typedef enum
     CLIP_LINE, /* Line clipboard */
 } ClipboardType;
 
+/* Registers: the unnamed register '"' plus named registers 'a'-'z'.
+   Yanking into a named register also makes it the one '"' refers to. */
+#define CLIP_UNNAMED '"'
+
 /* Initialize clipboard system */
 void clipboard_init(void);
 void clipboard_free(void);
 
-/* Yank (copy) operations */
-void clipboard_yank_char(const char *text);
-void clipboard_yank_line(const char *text);
+/* Returns 1 if 'reg' names a register */
+int clipboard_valid_register(int reg);
+
+/* Yank (copy) operations - return 0 on success, -1 on bad register or out of memory */
+int clipboard_yank_char(int reg, const char *text);
+/* 'lines' are line store lines (line_store.h); the register takes references, not copies */
+int clipboard_yank_lines(int reg, char *const *lines, size_t n);
 
-/* Paste operations - returns malloc'ed string (caller frees), or NULL if empty */
-char *clipboard_paste(void);
-ClipboardType clipboard_type(void);
-int clipboard_has_content(void);
+/* Paste operations */
+/* Character content as a malloc'ed string (caller frees), or NULL if empty */
+char *clipboard_paste(int reg);
+/* The register's lines as a malloc'ed array holding one new reference per line (the
+   caller frees the array and owns the references), or NULL if empty; *n receives the
+   number of lines. No text is copied. */
+char **clipboard_paste_lines(int reg, size_t *n);
+size_t clipboard_line_count(int reg);
+ClipboardType clipboard_type(int reg);
+int clipboard_has_content(int reg);
 
 #endif /* VTE_CLIPBOARD_H */
@@ -0,0 +1,96 @@
+#include "file_watch.h"
+#include "buffer.h"
+#include "../platform/platform.h"
+#include <stdlib.h>
+#include <string.h>
+
+static PlatformWatch *watch;
+static int polling;                /* no notification to be had: compare stamps every FILE_WATCH_POLL_MS */
+static char *watched[MAX_BUFFERS]; /* the path watched for each buffer */
+static int scanning = 1;           /* comparing the buffers' stamps, next at scan_at */
+static size_t scan_at;
+static long last_poll;
+
+/* Watch the path each buffer has now; returns 1 if one is new */
+static int follow_paths(void)
+{
+    int added = 0;
+    for (size_t i = 0; i < buffer_count(); ++i)
+    {
+        const char *path = buffer_at(i)->path;
+        if (watched[i] && path && strcmp(watched[i], path) == 0)
+            continue;
+        if (!watched[i] && !path)
+            continue;
+        if (watched[i])
+        {
+            if (watch)
+                platform_watch_remove(watch, watched[i]);
+            free(watched[i]);
+            watched[i] = NULL;
+        }
+        if (!path || !(watched[i] = strdup(path)))
+            continue;
+        added = 1;
+        if (!watch && !polling)
+            watch = platform_watch_new();
+        /* One file that cannot be watched and all of them are polled */
+        if (watch && platform_watch_add(watch, path) != 0)
+        {
+            platform_watch_free(watch);
+            watch = NULL;
+        }
+        polling = !watch;
+    }
+    return added;
+}
+
+int file_watch_next(void)
+{
+    if (follow_paths())
+    {
+        scanning = 1;
+        scan_at = 0;
+    }
+    if (!scanning)
+    {
+        if (watch)
+            scanning = platform_watch_changed(watch);
+        else if (platform_now_ms() - last_poll >= FILE_WATCH_POLL_MS)
+        {
+            scanning = 1;
+            last_poll = platform_now_ms();
+        }
+        if (!scanning)
+            return -1;
+        scan_at = 0;
+    }
+    while (scan_at < buffer_count())
+    {
+        Buffer *b = buffer_at(scan_at++);
+        long long mtime, size;
+        if (!b->path)
+            continue;
+        if (platform_file_stamp(b->path, &mtime, &size) != 0)
+            mtime = size = -1;
+        if (mtime != b->disk_mtime || size != b->disk_size)
+        {
+            b->disk_mtime = mtime;
+            b->disk_size = size;
+            return (int)(scan_at - 1);
+        }
+    }
+    scanning = 0;
+    return -1;
+}
+
+void file_watch_free(void)
+{
+    for (size_t i = 0; i < MAX_BUFFERS; ++i)
+    {
+        free(watched[i]);
+        watched[i] = NULL;
+    }
+    platform_watch_free(watch);
+    watch = NULL;
+}
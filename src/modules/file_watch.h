@@ -0,0 +1,17 @@
+#ifndef VTE_FILE_WATCH_H
+#define VTE_FILE_WATCH_H
+
+/* Noticing files that other programs change while they are open in buffers. Where
+   the platform has change notification (inotify) the files are only looked at after
+   it reported something; elsewhere, or if a watch cannot be set up, every
+   FILE_WATCH_POLL_MS. Either way a change is confirmed by the file's stamp
+   (modification time and size) against the one the buffer keeps. */
+#define FILE_WATCH_POLL_MS 500
+
+/* Index of a buffer whose file changed since the buffer last loaded, saved or was
+   told about it, or -1 once there are none. The buffer takes the new stamp, so
+   each change is reported once. Buffer paths are followed as they change. */
+int file_watch_next(void);
+void file_watch_free(void);
+
+#endif /* VTE_FILE_WATCH_H */
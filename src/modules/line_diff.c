@@ -0,0 +1,227 @@
+#include "line_diff.h"
+#include "line_store.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    LineHunk *items;
+    size_t count;
+    size_t cap;
+} HunkList;
+
+static int same_line(const char *x, const char *y)
+{
+    size_t len = line_len(x);
+    return x == y || (len == line_len(y) && memcmp(x, y, len) == 0);
+}
+
+static uint64_t line_hash(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    size_t len = line_len(s);
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t *hash_lines(char *const *lines, size_t n)
+{
+    uint64_t *h = (uint64_t *)malloc(n * sizeof(uint64_t));
+    if (h)
+        for (size_t i = 0; i < n; ++i)
+            h[i] = line_hash(lines[i]);
+    return h;
+}
+
+static int add_hunk(HunkList *l, size_t old_at, size_t removed, size_t new_at, size_t inserted)
+{
+    if (removed == 0 && inserted == 0)
+        return 0;
+    if (l->count == l->cap)
+    {
+        size_t cap = l->cap ? l->cap * 2 : 16;
+        LineHunk *grown = (LineHunk *)realloc(l->items, cap * sizeof(LineHunk));
+        if (!grown)
+            return -1;
+        l->items = grown;
+        l->cap = cap;
+    }
+    LineHunk *h = &l->items[l->count++];
+    h->old_at = old_at;
+    h->removed = removed;
+    h->new_at = new_at;
+    h->inserted = inserted;
+    return 0;
+}
+
+/* Round d of the search keeps, for each diagonal k in [-d, d] (step 2), the furthest
+   x reached with d edits, or -1; the rounds are stored one after another, round d
+   at offset d * d. This is where diagonal k of round d starts, before its snake:
+   one line further in b from diagonal k + 1 or one further in a from k - 1,
+   whichever gets further. *down tells which. */
+static ptrdiff_t edit_start(const ptrdiff_t *prev, ptrdiff_t d, ptrdiff_t k, ptrdiff_t n, ptrdiff_t m, int *down)
+{
+    ptrdiff_t from_down = k + 1 <= d - 1 ? prev[k + 1 + d - 1] : -1;
+    ptrdiff_t from_right = k - 1 >= -(d - 1) ? prev[k - 1 + d - 1] : -1;
+    if (from_down >= 0 && from_down - k > m)
+        from_down = -1;
+    if (from_right >= 0)
+        from_right = from_right + 1 > n ? -1 : from_right + 1;
+    *down = from_down >= from_right;
+    return *down ? from_down : from_right;
+}
+
+/* Myers' O(ND) search for the fewest inserted and removed lines that turn a[0..n)
+   into b[0..m). The hunks (between the runs of equal lines on that path) are added
+   to 'out' with a0/b0 added to their positions. Returns 0, 1 if more than
+   LINE_DIFF_MAX_EDITS edits would be needed, or -1 if out of memory. */
+static int myers(char *const *a, const uint64_t *ha, size_t n, char *const *b, const uint64_t *hb, size_t m,
+                 size_t a0, size_t b0, HunkList *out)
+{
+    ptrdiff_t N = (ptrdiff_t)n, M = (ptrdiff_t)m;
+    ptrdiff_t *trace = NULL;
+    size_t trace_cap = 0;
+    ptrdiff_t d, end_k = 0;
+    int found = 0;
+    for (d = 0; d <= LINE_DIFF_MAX_EDITS && !found; ++d)
+    {
+        size_t need = (size_t)(d + 1) * (size_t)(d + 1);
+        if (need > trace_cap)
+        {
+            size_t cap = trace_cap ? trace_cap * 2 : 1024;
+            while (cap < need)
+                cap *= 2;
+            ptrdiff_t *grown = (ptrdiff_t *)realloc(trace, cap * sizeof(ptrdiff_t));
+            if (!grown)
+            {
+                free(trace);
+                return -1;
+            }
+            trace = grown;
+            trace_cap = cap;
+        }
+        ptrdiff_t *v = trace + d * d;
+        const ptrdiff_t *prev = d > 0 ? trace + (d - 1) * (d - 1) : NULL;
+        for (ptrdiff_t k = -d; k <= d; k += 2)
+        {
+            int down;
+            ptrdiff_t x = d == 0 ? 0 : edit_start(prev, d, k, N, M, &down);
+            if (x < 0)
+            {
+                v[k + d] = -1;
+                continue;
+            }
+            ptrdiff_t y = x - k;
+            while (x < N && y < M && ha[x] == hb[y] && same_line(a[x], b[y]))
+            {
+                x++;
+                y++;
+            }
+            v[k + d] = x;
+            if (x == N && y == M)
+            {
+                found = 1;
+                end_k = k;
+                break;
+            }
+        }
+    }
+    if (!found)
+    {
+        free(trace);
+        return 1;
+    }
+    d--;
+
+    /* Walk back from the end, collecting the runs of equal lines (at most d + 1) */
+    size_t *runs = (size_t *)malloc((size_t)(d + 1) * 3 * sizeof(size_t));
+    if (!runs)
+    {
+        free(trace);
+        return -1;
+    }
+    size_t run_count = 0;
+    ptrdiff_t k = end_k;
+    ptrdiff_t x = trace[d * d + k + d];
+    for (; d > 0; --d)
+    {
+        int down;
+        ptrdiff_t start = edit_start(trace + (d - 1) * (d - 1), d, k, N, M, &down);
+        if (x > start)
+        {
+            runs[run_count * 3] = (size_t)start;
+            runs[run_count * 3 + 1] = (size_t)(start - k);
+            runs[run_count * 3 + 2] = (size_t)(x - start);
+            run_count++;
+        }
+        k = down ? k + 1 : k - 1;
+        x = trace[(d - 1) * (d - 1) + k + d - 1];
+    }
+    if (x > 0)
+    {
+        runs[run_count * 3] = 0;
+        runs[run_count * 3 + 1] = 0;
+        runs[run_count * 3 + 2] = (size_t)x;
+        run_count++;
+    }
+    free(trace);
+
+    int result = 0;
+    size_t ox = 0, oy = 0;
+    for (size_t i = run_count; i-- > 0 && result == 0;)
+    {
+        size_t rx = runs[i * 3], ry = runs[i * 3 + 1];
+        result = add_hunk(out, a0 + ox, rx - ox, b0 + oy, ry - oy);
+        ox = rx + runs[i * 3 + 2];
+        oy = ry + runs[i * 3 + 2];
+    }
+    if (result == 0)
+        result = add_hunk(out, a0 + ox, n - ox, b0 + oy, m - oy);
+    free(runs);
+    return result;
+}
+
+int line_diff(char *const *a, size_t n, char *const *b, size_t m, LineHunk **hunks, size_t *count)
+{
+    *hunks = NULL;
+    *count = 0;
+    /* Most changes touch a small part of a file: only the middle goes to the search */
+    size_t pre = 0, post = 0;
+    while (pre < n && pre < m && same_line(a[pre], b[pre]))
+        pre++;
+    while (post < n - pre && post < m - pre && same_line(a[n - 1 - post], b[m - 1 - post]))
+        post++;
+    size_t mn = n - pre - post, mm = m - pre - post;
+    if (mn == 0 && mm == 0)
+        return 0;
+
+    HunkList list = {NULL, 0, 0};
+    int result = 1;
+    if (mn > 0 && mm > 0)
+    {
+        uint64_t *ha = hash_lines(a + pre, mn);
+        uint64_t *hb = ha ? hash_lines(b + pre, mm) : NULL;
+        result = hb ? myers(a + pre, ha, mn, b + pre, hb, mm, pre, pre, &list) : -1;
+        free(ha);
+        free(hb);
+    }
+    if (result == 1)
+    {
+        list.count = 0;
+        result = add_hunk(&list, pre, mn, pre, mm);
+    }
+    if (result != 0)
+    {
+        free(list.items);
+        return -1;
+    }
+    *hunks = list.items;
+    *count = list.count;
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef VTE_LINE_DIFF_H
+#define VTE_LINE_DIFF_H
+
+#include <stddef.h>
+
+/* One stretch where two versions of a text differ: 'removed' old lines starting at
+   old_at were replaced by 'inserted' new lines starting at new_at */
+typedef struct
+{
+    size_t old_at;
+    size_t removed;
+    size_t new_at;
+    size_t inserted;
+} LineHunk;
+
+/* Compare two arrays of line store lines (line_store.h) and find the stretches that
+   differ, in order, each as small as the comparison finds them. Lines are compared
+   by hash first. Texts that differ in more than LINE_DIFF_MAX_EDITS lines (after the
+   common start and end) come back as one hunk covering the whole middle.
+   *hunks is malloc'd (NULL when the texts are equal); returns 0, or -1 if out of memory. */
+#define LINE_DIFF_MAX_EDITS 1024
+int line_diff(char *const *a, size_t n, char *const *b, size_t m, LineHunk **hunks, size_t *count);
+
+#endif /* VTE_LINE_DIFF_H */
@@ -1,101 +1,242 @@
 #include "line_edit.h"
+#include "line_store.h"
 #include <stdlib.h>
 #include <string.h>
 
-static size_t max_size(size_t a, size_t b) { return a > b ? a : b; }
+/* Start tracking changes against the current text */
+static void reset_tracking(LineEdit *le)
+{
+    le->orig = NULL;
+    le->modified = 0;
+    le->lo = le->tail = 0;
+    le->saved = NULL;
+    le->saved_cap = le->saved_start = le->saved_end = 0;
+}
+
+/* Take 'line' (a writable line store line) as the storage, gap at the end */
+static void attach(LineEdit *le, char *line)
+{
+    le->buf = line;
+    le->len = line_len(line);
+    le->cap = line_capacity(line);
+    le->gap = le->pos = le->len;
+    /* the text is terminated at cap as well as at len (see ensure_gap) */
+    le->buf[le->cap] = '\0';
+}
 
 void le_init(LineEdit *le, const char *src)
 {
     if (!le)
         return;
-    size_t sl = src ? strlen(src) : 0;
-    size_t cap = max_size((size_t)16, sl + 1);
-    le->buf = (char *)malloc(cap);
-    if (!le->buf)
+    reset_tracking(le);
+    char *line = line_new(src ? src : "", src ? strlen(src) : 0);
+    if (!line)
+    {
+        le->buf = NULL;
+        le->len = le->cap = le->pos = le->gap = 0;
+        return;
+    }
+    attach(le, line); /* default cursor at end */
+}
+
+void le_adopt(LineEdit *le, char *line)
+{
+    if (!le)
+        return;
+    reset_tracking(le);
+    if (line_shared(line))
     {
-        le->len = le->cap = le->pos = 0;
+        /* copy-on-write: keep the original until we know whether it changed */
+        le_init(le, line);
+        le->orig = line;
         return;
     }
-    if (src)
-        memcpy(le->buf, src, sl);
-    le->buf[sl] = '\0';
-    le->len = sl;
-    le->cap = cap;
-    le->pos = sl; /* default cursor at end */
+    attach(le, line);
 }
 
 void le_free(LineEdit *le)
 {
     if (!le)
         return;
-    free(le->buf);
+    line_release(le->buf);
+    line_release(le->orig);
+    free(le->saved);
     le->buf = NULL;
-    le->len = le->cap = le->pos = 0;
+    le->len = le->cap = le->pos = le->gap = 0;
+    reset_tracking(le);
+}
+
+/* Move the gap so it starts at text offset 'to' */
+static void move_gap(LineEdit *le, size_t to)
+{
+    size_t gap_len = le->cap - le->len;
+    if (to < le->gap)
+        memmove(le->buf + to + gap_len, le->buf + to, le->gap - to);
+    else if (to > le->gap)
+        memmove(le->buf + le->gap, le->buf + le->gap + gap_len, to - le->gap);
+    le->gap = to;
+}
+
+/* Copy text [from, from + n) to dst, reading around the gap */
+static void copy_text(const LineEdit *le, size_t from, size_t n, char *dst)
+{
+    size_t end = from + n;
+    size_t gap_len = le->cap - le->len;
+    if (from < le->gap)
+    {
+        size_t k = (end < le->gap ? end : le->gap) - from;
+        memcpy(dst, le->buf + from, k);
+        dst += k;
+        from += k;
+    }
+    if (from < end)
+        memcpy(dst, le->buf + from + gap_len, end - from);
 }
 
-static int ensure_capacity(LineEdit *le, size_t needed)
+/* Room for 'front' more bytes before and 'back' more bytes after the saved range */
+static int saved_reserve(LineEdit *le, size_t front, size_t back)
 {
-    if (needed <= le->cap)
+    if (le->saved && le->saved_start >= front && le->saved_cap - le->saved_end >= back)
         return 1;
-    size_t newcap = le->cap > 0 ? le->cap * 2 : 16;
-    if (newcap < needed)
-        newcap = needed;
-    char *n = (char *)realloc(le->buf, newcap);
-    if (!n)
+    size_t used = le->saved_end - le->saved_start;
+    size_t cap = (used + front + back) * 2 + 16;
+    char *d = (char *)malloc(cap);
+    if (!d)
         return 0;
-    le->buf = n;
-    le->cap = newcap;
+    /* keep spare room on both sides: edits grow the range in either direction */
+    size_t start = front + (cap - used - front - back) / 2;
+    if (used > 0)
+        memcpy(d + start, le->saved + le->saved_start, used);
+    free(le->saved);
+    le->saved = d;
+    le->saved_cap = cap;
+    le->saved_start = start;
+    le->saved_end = start + used;
     return 1;
 }
 
-int le_insert_char(LineEdit *le, int ch)
+/* Called before text [start, end) is replaced: widen the changed range to cover it,
+   saving the original bytes that become part of it. Bytes outside the range are
+   still original, so they can be read from the text itself. */
+static int touch(LineEdit *le, size_t start, size_t end)
 {
-    if (!le || !le->buf)
-        return 0;
-    if (le->len + 1 + 1 > le->cap)
+    if (!le->modified)
     {
-        if (!ensure_capacity(le, le->len + 2))
+        if (!saved_reserve(le, 0, end - start))
             return 0;
+        copy_text(le, start, end - start, le->saved + le->saved_end);
+        le->saved_end += end - start;
+        le->lo = start;
+        le->tail = le->len - end;
+        le->modified = 1;
+        return 1;
+    }
+    size_t hi = le->len - le->tail;
+    size_t front = start < le->lo ? le->lo - start : 0;
+    size_t back = end > hi ? end - hi : 0;
+    if ((front || back) && !saved_reserve(le, front, back))
+        return 0;
+    if (front)
+    {
+        le->saved_start -= front;
+        copy_text(le, start, front, le->saved + le->saved_start);
+        le->lo = start;
+    }
+    if (back)
+    {
+        copy_text(le, hi, back, le->saved + le->saved_end);
+        le->saved_end += back;
+        le->tail = le->len - end;
     }
-    /* shift right using memmove for better performance */
-    if (le->pos < le->len)
-        memmove(le->buf + le->pos + 1, le->buf + le->pos, le->len - le->pos);
-    le->buf[le->pos] = (char)ch;
-    le->len++;
-    le->pos++;
-    le->buf[le->len] = '\0';
     return 1;
 }
 
-int le_backspace(LineEdit *le)
+/* Make the gap at least n bytes. One byte past cap always holds a NUL, so the
+   text is terminated whenever the gap sits at either end (see le_cstr). */
+static int ensure_gap(LineEdit *le, size_t n)
+{
+    size_t gap_len = le->cap - le->len;
+    if (gap_len >= n)
+        return 1;
+    size_t newcap = le->cap > 0 ? le->cap * 2 : 16;
+    if (newcap < le->len + n)
+        newcap = le->len + n;
+    char *nb = line_writable(le->buf, newcap);
+    if (!nb)
+        return 0;
+    newcap = line_capacity(nb);
+    /* text after the gap moves to the end of the larger allocation */
+    size_t tail = le->len - le->gap;
+    memmove(nb + newcap - tail, nb + le->gap + gap_len, tail);
+    nb[newcap] = '\0';
+    le->buf = nb;
+    le->cap = newcap;
+    return 1;
+}
+
+int le_insert_bytes(LineEdit *le, const char *s, size_t n)
 {
     if (!le || !le->buf)
         return 0;
-    if (le->pos == 0)
+    if (n == 0)
+        return 1;
+    if (!ensure_gap(le, n) || !touch(le, le->pos, le->pos))
         return 0;
-    /* remove char before pos using memmove */
-    if (le->pos < le->len)
-        memmove(le->buf + le->pos - 1, le->buf + le->pos, le->len - le->pos);
-    le->pos--;
-    le->len--;
-    le->buf[le->len] = '\0';
+    move_gap(le, le->pos);
+    memcpy(le->buf + le->gap, s, n);
+    le->gap += n;
+    le->len += n;
+    le->pos += n;
     return 1;
 }
 
-int le_delete(LineEdit *le)
+int le_insert_char(LineEdit *le, int ch)
 {
-    if (!le || !le->buf)
+    char c = (char)ch;
+    return le_insert_bytes(le, &c, 1);
+}
+
+int le_erase_before(LineEdit *le, size_t n)
+{
+    if (!le || !le->buf || n == 0 || n > le->pos || !touch(le, le->pos - n, le->pos))
         return 0;
-    if (le->pos >= le->len)
+    move_gap(le, le->pos);
+    le->gap -= n;
+    le->len -= n;
+    le->pos -= n;
+    return 1;
+}
+
+int le_erase_after(LineEdit *le, size_t n)
+{
+    if (!le || !le->buf || n == 0 || n > le->len - le->pos || !touch(le, le->pos, le->pos + n))
         return 0;
-    /* remove char at pos */
-    if (le->pos < le->len - 1)
-        memmove(le->buf + le->pos, le->buf + le->pos + 1, le->len - le->pos - 1);
-    le->len--;
-    le->buf[le->len] = '\0';
+    move_gap(le, le->pos);
+    /* widening the gap drops the bytes right after it */
+    le->len -= n;
     return 1;
 }
 
+int le_backspace(LineEdit *le)
+{
+    return le_erase_before(le, 1);
+}
+
+int le_delete(LineEdit *le)
+{
+    return le_erase_after(le, 1);
+}
+
+char le_byte_at(const LineEdit *le, size_t i)
+{
+    return i < le->gap ? le->buf[i] : le->buf[i + (le->cap - le->len)];
+}
+
+void le_copy(const LineEdit *le, size_t from, size_t n, char *dst)
+{
+    copy_text(le, from, n, dst);
+}
+
 void le_move_left(LineEdit *le)
 {
     if (le && le->pos > 0)
@@ -125,15 +266,36 @@ char *le_split(LineEdit *le)
     char *right = (char *)malloc(right_len + 1);
     if (!right)
         return NULL;
+    if (!touch(le, le->pos, le->len))
+    {
+        free(right);
+        return NULL;
+    }
+    move_gap(le, le->pos);
     if (right_len > 0)
-        memcpy(right, le->buf + le->pos, right_len);
+        memcpy(right, le->buf + le->cap - right_len, right_len);
     right[right_len] = '\0';
-    /* truncate left side */
-    le->buf[le->pos] = '\0';
+    /* truncate left side: the gap now runs to the end */
     le->len = le->pos;
     return right;
 }
 
+const char *le_cstr(LineEdit *le)
+{
+    if (!le || !le->buf)
+        return NULL;
+    /* Close the gap at whichever end is nearer; at the front the text runs up to
+       the terminator kept past cap. */
+    if (le->gap * 2 < le->len)
+    {
+        move_gap(le, 0);
+        return le->buf + (le->cap - le->len);
+    }
+    move_gap(le, le->len);
+    le->buf[le->len] = '\0';
+    return le->buf;
+}
+
 char *le_take_string(const LineEdit *le)
 {
     if (!le || !le->buf)
@@ -141,7 +303,44 @@ char *le_take_string(const LineEdit *le)
     char *out = (char *)malloc(le->len + 1);
     if (!out)
         return NULL;
-    memcpy(out, le->buf, le->len);
+    size_t tail = le->len - le->gap;
+    memcpy(out, le->buf, le->gap);
+    memcpy(out + le->gap, le->buf + le->cap - tail, tail);
     out[le->len] = '\0';
     return out;
 }
+
+int le_change(LineEdit *le, LineEditChange *out)
+{
+    if (!le || !le->buf || !le->modified)
+        return 0;
+    move_gap(le, le->len);
+    out->pos = le->lo;
+    out->removed = le->saved + le->saved_start;
+    out->removed_len = le->saved_end - le->saved_start;
+    out->inserted = le->buf + le->lo;
+    out->inserted_len = le->len - le->tail - le->lo;
+    return 1;
+}
+
+char *le_release(LineEdit *le)
+{
+    if (!le)
+        return NULL;
+    char *line;
+    if (!le->buf || (!le->modified && le->orig))
+    {
+        /* the copy of a shared line was never changed: return the original */
+        line = le->orig;
+        le->orig = NULL;
+    }
+    else
+    {
+        move_gap(le, le->len);
+        line_set_len(le->buf, le->len);
+        line = le->buf;
+        le->buf = NULL;
+    }
+    le_free(le);
+    return line;
+}
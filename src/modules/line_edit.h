@@ -3,28 +3,77 @@
 
 #include <stddef.h>
 
+/* Gap buffer: buf holds the text before the gap, the gap (cap - len unused bytes),
+   then the text after it. Edits happen at the gap, which is moved to 'pos' lazily
+   on the next edit, so typing costs O(1) and only a cursor jump moves bytes.
+
+   The storage is a line store line (line_store.h), so a buffer line can be handed
+   to the editor with le_adopt() and handed back with le_release() without copying.
+   The editor remembers the original bytes of the range it changed, so the change
+   can be recorded for undo without keeping a copy of the whole old line. */
 typedef struct
 {
-    char *buf;  /* NUL-terminated buffer owned by struct */
-    size_t len; /* length (bytes) excluding NUL */
-    size_t cap; /* allocated capacity including NUL */
+    char *buf;  /* storage owned by struct; not NUL-terminated, see le_cstr */
+    size_t len; /* text length (bytes) excluding the gap */
+    size_t cap; /* allocated bytes, gap included */
     size_t pos; /* cursor position in [0..len] */
+    size_t gap; /* text offset where the gap starts */
+
+    char *orig;         /* adopted line that was shared and had to be copied, or NULL */
+    int modified;       /* 1 once any edit touched the text */
+    size_t lo;          /* text before lo is unchanged */
+    size_t tail;        /* the last 'tail' bytes are unchanged */
+    char *saved;        /* original bytes of the changed range, at saved[saved_start..saved_end) */
+    size_t saved_cap;
+    size_t saved_start;
+    size_t saved_end;
 } LineEdit;
 
+/* What changed since le_init/le_adopt: 'removed' bytes at 'pos' were replaced by 'inserted' */
+typedef struct
+{
+    size_t pos;
+    const char *removed;
+    size_t removed_len;
+    const char *inserted;
+    size_t inserted_len;
+} LineEditChange;
+
 void le_init(LineEdit *le, const char *src);
+/* Edit a line store line in place, taking over the caller's reference. A shared line is
+   copied first (copy-on-write). Cursor starts at the end. */
+void le_adopt(LineEdit *le, char *line);
+/* Hand the text back as a line store line and reset le. O(1) when nothing changed:
+   the adopted line itself is returned. */
+char *le_release(LineEdit *le);
+/* Describe the changes made so far; returns 0 if the text was never modified. The
+   pointers stay valid until the next call on le. */
+int le_change(LineEdit *le, LineEditChange *out);
 /* Free internal memory (safe to call on uninitialized fields after init). */
 void le_free(LineEdit *le);
+/* Insert n bytes at the current cursor position and move past them. Returns 1 on success, 0 on failure. */
+int le_insert_bytes(LineEdit *le, const char *s, size_t n);
 /* Insert a character at the current cursor position. Returns 1 on success, 0 on failure. */
 int le_insert_char(LineEdit *le, int ch);
 int le_backspace(LineEdit *le);
 int le_delete(LineEdit *le);
+/* Remove n bytes before / after the cursor. Returns 1 if anything was removed. */
+int le_erase_before(LineEdit *le, size_t n);
+int le_erase_after(LineEdit *le, size_t n);
+/* Byte at text offset i (i < len) */
+char le_byte_at(const LineEdit *le, size_t i);
+/* Copy text [from, from + n) to dst, reading around the gap without moving it */
+void le_copy(const LineEdit *le, size_t from, size_t n, char *dst);
 void le_move_left(LineEdit *le);
 void le_move_right(LineEdit *le);
 void le_move_home(LineEdit *le);
 void le_move_end(LineEdit *le);
 /* Split the buffer at current cursor position. The right side is returned as a malloc'ed string (caller frees). */
 char *le_split(LineEdit *le);
-/* Return a malloc'ed copy of the current buffer and leave le unchanged. Caller frees. */
+/* Contiguous NUL-terminated view of the text; closes the gap by moving it to the nearer
+   end of the text. Valid until the next edit. */
+const char *le_cstr(LineEdit *le);
+/* Return a malloc'ed contiguous copy of the current text and leave le unchanged. Caller frees. */
 char *le_take_string(const LineEdit *le);
 
 #endif /* LINE_EDIT_H */
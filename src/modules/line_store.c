@@ -0,0 +1,132 @@
+#include "line_store.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    size_t refs;
+    size_t len;
+    size_t cap; /* bytes available for text, NUL excluded */
+} LineHeader;
+
+static LineHeader *header(const char *line)
+{
+    return (LineHeader *)(line - sizeof(LineHeader));
+}
+
+/* Lines released while held, freed by the last line_unhold() */
+static size_t holds;
+static LineHeader **kept;
+static size_t kept_count, kept_cap;
+
+static void keep(LineHeader *h)
+{
+    if (kept_count == kept_cap)
+    {
+        size_t cap = kept_cap ? kept_cap * 2 : 256;
+        LineHeader **grown = (LineHeader **)realloc(kept, cap * sizeof(LineHeader *));
+        if (!grown)
+            return; /* a reader may still be on it: leaking is the safe way out */
+        kept = grown;
+        kept_cap = cap;
+    }
+    kept[kept_count++] = h;
+}
+
+char *line_new(const char *s, size_t len)
+{
+    LineHeader *h = (LineHeader *)malloc(sizeof(LineHeader) + len + 1);
+    if (!h)
+        return NULL;
+    h->refs = 1;
+    h->len = len;
+    h->cap = len;
+    char *line = (char *)(h + 1);
+    if (len > 0)
+        memcpy(line, s, len);
+    line[len] = '\0';
+    return line;
+}
+
+char *line_retain(char *line)
+{
+    if (line)
+        header(line)->refs++;
+    return line;
+}
+
+void line_release(char *line)
+{
+    if (!line)
+        return;
+    LineHeader *h = header(line);
+    if (--h->refs > 0)
+        return;
+    if (holds > 0)
+        keep(h);
+    else
+        free(h);
+}
+
+size_t line_len(const char *line)
+{
+    return header(line)->len;
+}
+
+size_t line_capacity(const char *line)
+{
+    return header(line)->cap;
+}
+
+int line_shared(const char *line)
+{
+    return holds > 0 || header(line)->refs > 1;
+}
+
+char *line_writable(char *line, size_t room)
+{
+    LineHeader *h = header(line);
+    size_t size = room > h->len ? room : h->len;
+    if (h->refs > 1 || holds > 0)
+    {
+        /* copy-on-write: the other holders (or a reader under a hold) keep the original */
+        LineHeader *copy = (LineHeader *)malloc(sizeof(LineHeader) + size + 1);
+        if (!copy)
+            return NULL;
+        copy->refs = 1;
+        copy->len = h->len;
+        copy->cap = size;
+        memcpy(copy + 1, line, h->len + 1);
+        line_release(line);
+        return (char *)(copy + 1);
+    }
+    if (room <= h->cap)
+        return line;
+    LineHeader *grown = (LineHeader *)realloc(h, sizeof(LineHeader) + size + 1);
+    if (!grown)
+        return NULL;
+    grown->cap = size;
+    return (char *)(grown + 1);
+}
+
+void line_set_len(char *line, size_t len)
+{
+    header(line)->len = len;
+    line[len] = '\0';
+}
+
+void line_hold(void)
+{
+    holds++;
+}
+
+void line_unhold(void)
+{
+    if (holds == 0 || --holds > 0)
+        return;
+    for (size_t i = 0; i < kept_count; ++i)
+        free(kept[i]);
+    free(kept);
+    kept = NULL;
+    kept_count = kept_cap = 0;
+}
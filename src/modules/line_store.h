@@ -0,0 +1,40 @@
+#ifndef VTE_LINE_STORE_H
+#define VTE_LINE_STORE_H
+
+#include <stddef.h>
+
+/* Buffer lines are reference-counted strings. A small header (reference count
+   and length) sits in front of the text, so a line is still a plain
+   NUL-terminated 'char *' for readers. Lines are shared rather than copied
+   (yank, paste, registers); anything that modifies a line goes through
+   line_writable(), which copies it first if someone else still holds it. */
+
+/* New unshared line holding a copy of s[0..len); NULL on allocation failure */
+char *line_new(const char *s, size_t len);
+/* Take another reference to a line; returns the line */
+char *line_retain(char *line);
+/* Drop a reference, freeing the line with the last one (NULL is ignored) */
+void line_release(char *line);
+size_t line_len(const char *line);
+/* Bytes the line can hold without reallocating (NUL excluded) */
+size_t line_capacity(const char *line);
+/* 1 if more than one reference exists */
+int line_shared(const char *line);
+
+/* Return a line with the same content that may be modified in place and has room
+   for at least 'room' bytes plus NUL. This is 'line' itself when it is unshared and
+   large enough; otherwise the line is reallocated or copied and the caller's
+   reference moves to the result. On failure NULL is returned and 'line' is untouched. */
+char *line_writable(char *line, size_t room);
+/* Set the length of a writable line after changing its bytes (writes the NUL) */
+void line_set_len(char *line, size_t len);
+
+/* Holds, for a reader on another thread (a background save) that only looks at the
+   text and length of lines it was given. While a hold is active every line counts as
+   shared, so line_writable() copies instead of changing a line in place, and lines
+   losing their last reference are kept until the last hold is dropped. Holds and
+   all other calls but line_new() stay on the main thread. */
+void line_hold(void);
+void line_unhold(void);
+
+#endif /* VTE_LINE_STORE_H */
@@ -0,0 +1,241 @@
+#include "stream.h"
+#include "line_store.h"
+#include "../platform/platform.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_READ (64 * 1024)          /* bytes asked for per read */
+#define STREAM_BATCH_LINES 4096
+#define STREAM_BATCH_BYTES (256 * 1024) /* a batch is handed over once it holds this much */
+
+/* Batches go from the reader to the editor through a single-producer single-consumer
+   list: the reader links them after 'tail', the editor takes them after 'head',
+   which is the last batch it took (the empty first one to begin with) and is only
+   freed once the next one is taken, so the reader never links onto a freed batch. */
+typedef struct StreamBatch
+{
+    _Atomic(struct StreamBatch *) next;
+    size_t count;
+    size_t bytes;
+    char *lines[STREAM_BATCH_LINES];
+} StreamBatch;
+
+struct Stream
+{
+    int fd;
+    PlatformThread *thread;
+    PlatformSignal *room;  /* the editor took lines: the reader may go on */
+    StreamBatch *tail;     /* reader side */
+    StreamBatch *head;     /* editor side */
+    atomic_size_t pending; /* bytes handed over and not taken yet */
+    atomic_size_t lines;   /* lines handed over */
+    atomic_int ended;      /* the reader is done */
+    atomic_int stop;       /* the editor is going away */
+    int failed;            /* written by the reader before it sets 'ended' */
+    int lost;              /* editor side: lines dropped for lack of memory */
+    int taken;             /* editor side: lines were appended already */
+};
+
+static StreamBatch *batch_new(void)
+{
+    StreamBatch *b = (StreamBatch *)malloc(sizeof(StreamBatch));
+    if (b)
+    {
+        atomic_init(&b->next, NULL);
+        b->count = 0;
+        b->bytes = 0;
+    }
+    return b;
+}
+
+static void hand_over(Stream *s, StreamBatch *b)
+{
+    atomic_fetch_add(&s->lines, b->count);
+    atomic_fetch_add(&s->pending, b->bytes);
+    atomic_store(&s->tail->next, b);
+    s->tail = b;
+}
+
+/* Add a finished line ('\n' cut off) to the batch being filled. Only line_new() is
+   used on this thread: it touches no state shared with the editor's lines. Returns
+   -1 for lack of memory. */
+static int add_line(Stream *s, StreamBatch **batch, const char *text, size_t len)
+{
+    while (len > 0 && text[len - 1] == '\r')
+        len--;
+    if (!*batch && !(*batch = batch_new()))
+        return -1;
+    StreamBatch *b = *batch;
+    if (!(b->lines[b->count] = line_new(text, len)))
+        return -1;
+    b->count++;
+    b->bytes += len + 1;
+    if (b->count == STREAM_BATCH_LINES)
+    {
+        hand_over(s, b);
+        *batch = NULL;
+    }
+    return 0;
+}
+
+static void reader_main(void *arg)
+{
+    Stream *s = (Stream *)arg;
+    char *chunk = (char *)malloc(STREAM_READ);
+    StreamBatch *batch = NULL;
+    char *part = NULL; /* start of a line a read ended in the middle of */
+    size_t part_len = 0, part_cap = 0;
+    int failed = !chunk;
+    long n = 0;
+    while (!failed && !atomic_load(&s->stop) && (n = platform_read_fd(s->fd, chunk, STREAM_READ)) > 0)
+    {
+        size_t at = 0;
+        while (at < (size_t)n && !failed)
+        {
+            const char *nl = (const char *)memchr(chunk + at, '\n', (size_t)n - at);
+            size_t seg = nl ? (size_t)(nl - (chunk + at)) : (size_t)n - at;
+            if (nl && part_len == 0)
+                failed = add_line(s, &batch, chunk + at, seg) != 0;
+            else
+            {
+                if (part_len + seg > part_cap)
+                {
+                    size_t cap = part_len + seg > 2 * part_cap ? part_len + seg : 2 * part_cap;
+                    char *grown = (char *)realloc(part, cap);
+                    if (!grown)
+                    {
+                        failed = 1;
+                        break;
+                    }
+                    part = grown;
+                    part_cap = cap;
+                }
+                memcpy(part + part_len, chunk + at, seg);
+                part_len += seg;
+                if (nl)
+                {
+                    failed = add_line(s, &batch, part, part_len) != 0;
+                    part_len = 0;
+                }
+            }
+            at += seg + (nl ? 1 : 0);
+        }
+        /* Hand over when the batch is full enough or the pipe has nothing more for now,
+           so slow output shows up as it comes */
+        if (batch && (batch->bytes >= STREAM_BATCH_BYTES || n < STREAM_READ))
+        {
+            hand_over(s, batch);
+            batch = NULL;
+        }
+        while (atomic_load(&s->pending) > STREAM_PENDING_MAX && !atomic_load(&s->stop))
+            platform_signal_wait(s->room, 100);
+    }
+    if (part_len > 0 && !failed)
+        failed = add_line(s, &batch, part, part_len) != 0;
+    if (batch)
+        hand_over(s, batch);
+    free(part);
+    free(chunk);
+    s->failed = failed || n < 0;
+    atomic_store(&s->ended, 1);
+}
+
+Stream *stream_start(int fd)
+{
+    Stream *s = (Stream *)calloc(1, sizeof(Stream));
+    StreamBatch *first = batch_new();
+    if (!s || !first || !(s->room = platform_signal_new()))
+    {
+        free(s);
+        free(first);
+        return NULL;
+    }
+    s->fd = fd;
+    s->head = s->tail = first;
+    atomic_init(&s->pending, 0);
+    atomic_init(&s->lines, 0);
+    atomic_init(&s->ended, 0);
+    atomic_init(&s->stop, 0);
+    s->thread = platform_thread_start(reader_main, s);
+    if (!s->thread)
+    {
+        platform_signal_free(s->room);
+        free(first);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+size_t stream_take(Stream *s, Buffer *b, size_t budget)
+{
+    size_t first = b->count, taken = 0;
+    int dirty = b->dirty;
+    StreamBatch *next;
+    while (taken < budget && (next = atomic_load(&s->head->next)) != NULL)
+    {
+        size_t at = b->count, remove = 0;
+        if (!s->taken && b->count == 1 && line_len(b->lines[0]) == 0)
+        {
+            at = 0;
+            remove = 1;
+        }
+        if (next->count > 0 && buffer_splice_lines(b, at, remove, next->lines, next->count) != 0)
+        {
+            for (size_t i = 0; i < next->count; ++i)
+                line_release(next->lines[i]);
+            s->lost = 1;
+        }
+        else if (next->count > 0)
+        {
+            if (at < first)
+                first = at;
+            s->taken = 1;
+        }
+        next->count = 0;
+        taken += next->bytes;
+        atomic_fetch_sub(&s->pending, next->bytes);
+        free(s->head);
+        s->head = next;
+    }
+    b->dirty = dirty;
+    if (taken > 0)
+        platform_signal_raise(s->room);
+    return first;
+}
+
+size_t stream_lines(Stream *s)
+{
+    return atomic_load(&s->lines);
+}
+
+int stream_finished(Stream *s, int *failed)
+{
+    if (!atomic_load(&s->ended) || atomic_load(&s->head->next))
+        return 0;
+    *failed = s->failed || s->lost;
+    return 1;
+}
+
+void stream_close(Stream *s)
+{
+    if (!s)
+        return;
+    atomic_store(&s->stop, 1);
+    platform_signal_raise(s->room);
+    if (!atomic_load(&s->ended))
+        return; /* blocked in a read: it may still touch s, so s stays */
+    platform_thread_join(s->thread);
+    while (s->head)
+    {
+        StreamBatch *next = atomic_load(&s->head->next);
+        for (size_t i = 0; i < s->head->count; ++i)
+            line_release(s->head->lines[i]);
+        free(s->head);
+        s->head = next;
+    }
+    platform_close_fd(s->fd);
+    platform_signal_free(s->room);
+    free(s);
+}
@@ -0,0 +1,30 @@
+#ifndef VTE_STREAM_H
+#define VTE_STREAM_H
+
+#include <stddef.h>
+#include "buffer.h"
+
+/* Reading a pipe into a buffer while the editor runs (cmd | vte -). A reader thread
+   cuts the data into lines and hands them over in batches; the editor appends them
+   with stream_take() between keys. The reader stops while STREAM_PENDING_MAX bytes
+   wait to be taken, so a fast producer is held back by the editor rather than
+   filling memory. */
+#define STREAM_PENDING_MAX ((size_t)16 * 1024 * 1024)
+
+typedef struct Stream Stream;
+
+/* Start reading 'fd' (see platform_stdin_take()); the stream owns it. NULL on failure. */
+Stream *stream_start(int fd);
+/* Append the lines read so far, about 'budget' bytes of them, to the end of b without
+   an undo step (a buffer holding just one empty line has it replaced). Returns the
+   first line that changed, b->count if none. */
+size_t stream_take(Stream *s, Buffer *b, size_t budget);
+/* Lines the reader has cut so far */
+size_t stream_lines(Stream *s);
+/* 1 once the data ended and every line was taken; *failed tells if it ended on a
+   read error or for lack of memory */
+int stream_finished(Stream *s, int *failed);
+/* Stop and free. A reader still waiting for data is left to the end of the process. */
+void stream_close(Stream *s);
+
+#endif /* VTE_STREAM_H */
@@ -1,164 +1,744 @@
 #include "undo.h"
+#include "undo_journal.h"
+#include "line_store.h"
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_UNDO_STACK 1000
+/* A single undo action. The bytes an edit removed and inserted live back to
+   back in the owning ring's arena, starting at absolute offset 'off'. */
+typedef struct
+{
+    UndoActionType type;
+    unsigned long group; /* Actions sharing a group are undone/redone together */
+    size_t line;         /* Line number where action occurred */
+    size_t pos;          /* Byte offset within line */
+    size_t off;          /* Arena offset of removed bytes, inserted bytes follow */
+    size_t removed_len;  /* Bytes the action removed (UNDO_EDIT and UNDO_LINES) */
+    size_t inserted_len; /* Bytes the action inserted (UNDO_EDIT and UNDO_LINES) */
+    uint64_t jend;       /* Journal offset just past this action's record, 0 if not journaled */
+} UndoAction;
+
+/* Append-only byte store. Offsets are absolute (they never change once handed
+   out); 'base' is the absolute offset of data[0], so compaction only moves bytes. */
+typedef struct
+{
+    char *data;
+    size_t cap;
+    size_t base;  /* absolute offset of data[0] */
+    size_t start; /* absolute offset of the first live byte */
+    size_t end;   /* absolute offset just past the last byte */
+} UndoArena;
+
+/* Undo and redo histories are ring buffers: the oldest entry lives at 'head'
+   and the newest at head + count - 1 (mod cap). Discarding the oldest entry
+   when the byte budget is exceeded just advances 'head', so a push onto a
+   full history never shifts the other entries. */
+typedef struct
+{
+    UndoAction *items;
+    size_t cap;   /* allocated slots */
+    size_t head;  /* index of the oldest entry */
+    size_t count; /* number of live entries */
+    size_t bytes; /* approximate memory held by live entries */
+    UndoArena arena;
+} UndoRing;
+
+/* Per-buffer history, hung off Buffer.undo so switching buffers keeps it in place */
+struct UndoHistory
+{
+    UndoRing undo;
+    UndoRing redo;
+    int group_depth;          /* nesting level of undo_begin_group() */
+    unsigned long group;      /* group id of the open transaction */
+    unsigned long next_group; /* next id to hand out */
+    UndoJournal *journal;     /* on-disk history, NULL when not persisted */
+    uint64_t disk_cursor;     /* journal offset where history older than the rings ends */
+    uint64_t disk_skip;       /* undo markers pending at disk_cursor */
+};
 
-static UndoAction undo_stack[MAX_UNDO_STACK];
-static size_t undo_count = 0;
+static size_t undo_budget = UNDO_DEFAULT_BUDGET;
+static int undo_persistent = 0;
 
-static UndoAction redo_stack[MAX_UNDO_STACK];
-static size_t redo_count = 0;
+static size_t action_cost(const UndoAction *action)
+{
+    return sizeof(UndoAction) + action->removed_len + action->inserted_len;
+}
 
-void undo_init(void)
+static const char *arena_ptr(const UndoArena *a, size_t off)
 {
-    undo_count = 0;
-    redo_count = 0;
+    return a->data + (off - a->base);
 }
 
-static void free_action(UndoAction *action)
+/* Append n bytes and return their absolute offset, or (size_t)-1 on allocation failure */
+static size_t arena_append(UndoArena *a, const char *bytes, size_t n)
 {
-    if (action->data)
+    size_t used = a->end - a->base;
+    if (used + n > a->cap)
     {
-        free(action->data);
-        action->data = NULL;
+        /* Reclaim the space of discarded records before growing */
+        size_t dead = a->start - a->base;
+        if (dead > 0)
+        {
+            memmove(a->data, a->data + dead, a->end - a->start);
+            a->base = a->start;
+            used -= dead;
+        }
+        if (used + n > a->cap)
+        {
+            size_t new_cap = a->cap ? a->cap * 2 : 4096;
+            while (new_cap < used + n)
+                new_cap *= 2;
+            char *d = (char *)realloc(a->data, new_cap);
+            if (!d)
+                return (size_t)-1;
+            a->data = d;
+            a->cap = new_cap;
+        }
     }
-    if (action->data2)
+    size_t off = a->end;
+    if (n > 0)
+        memcpy(a->data + used, bytes, n);
+    a->end += n;
+    return off;
+}
+
+static UndoAction *ring_at(UndoRing *r, size_t i)
+{
+    return &r->items[(r->head + i) % r->cap];
+}
+
+static UndoAction *ring_newest(UndoRing *r)
+{
+    return r->count ? ring_at(r, r->count - 1) : NULL;
+}
+
+static void ring_drop_oldest(UndoRing *r)
+{
+    if (r->count == 0)
+        return;
+    UndoAction *a = &r->items[r->head];
+    r->bytes -= action_cost(a);
+    r->arena.start = a->off + a->removed_len + a->inserted_len;
+    r->head = (r->head + 1) % r->cap;
+    r->count--;
+}
+
+static void ring_drop_newest(UndoRing *r)
+{
+    if (r->count == 0)
+        return;
+    UndoAction *a = ring_newest(r);
+    r->bytes -= action_cost(a);
+    r->arena.end = a->off;
+    r->count--;
+}
+
+static void ring_clear(UndoRing *r)
+{
+    r->count = 0;
+    r->head = 0;
+    r->bytes = 0;
+    r->arena.start = r->arena.end;
+}
+
+/* Grow the slot array (doubling, so amortized O(1)); entries are unrolled to start at 0. */
+static int ring_grow(UndoRing *r)
+{
+    size_t new_cap = r->cap ? r->cap * 2 : 64;
+    UndoAction *n = (UndoAction *)malloc(new_cap * sizeof(UndoAction));
+    if (!n)
+        return 0;
+    for (size_t i = 0; i < r->count; ++i)
+        n[i] = *ring_at(r, i);
+    free(r->items);
+    r->items = n;
+    r->cap = new_cap;
+    r->head = 0;
+    return 1;
+}
+
+/* Drop the oldest group of a ring, but never its newest group.
+   *jend receives the journal offset just past the dropped group. */
+static int ring_drop_oldest_group(UndoRing *r, uint64_t *jend)
+{
+    if (r->count == 0 || r->items[r->head].group == ring_newest(r)->group)
+        return 0;
+    unsigned long g = r->items[r->head].group;
+    while (r->count > 0 && r->items[r->head].group == g)
     {
-        free(action->data2);
-        action->data2 = NULL;
+        *jend = r->items[r->head].jend;
+        ring_drop_oldest(r);
     }
+    return 1;
 }
 
-void undo_free(void)
+/* Evict the oldest history until both rings fit the budget. Whole groups are
+   evicted, and the newest group of each ring is kept so the last change stays undoable. */
+static void enforce_budget(UndoHistory *h)
 {
-    for (size_t i = 0; i < undo_count; ++i)
-        free_action(&undo_stack[i]);
-    for (size_t i = 0; i < redo_count; ++i)
-        free_action(&redo_stack[i]);
-    undo_count = 0;
-    redo_count = 0;
+    while (h->undo.bytes + h->redo.bytes > undo_budget)
+    {
+        uint64_t jend = 0;
+        if (ring_drop_oldest_group(&h->undo, &jend))
+        {
+            /* The evicted group is still in the journal: continue the disk history from it */
+            h->disk_cursor = h->journal ? jend : 0;
+            h->disk_skip = 0;
+        }
+        else if (!ring_drop_oldest_group(&h->redo, &jend))
+            break;
+    }
 }
 
-static void push_action(UndoActionType type, size_t line, size_t pos, const char *data, const char *data2)
+/* Append an action, copying its removed/inserted bytes into the ring's arena.
+   Returns the stored action, or NULL if memory ran out. */
+static UndoAction *ring_push(UndoHistory *h, UndoRing *r, UndoActionType type, unsigned long group,
+                      size_t line, size_t pos,
+                      const char *removed, size_t removed_len,
+                      const char *inserted, size_t inserted_len)
 {
-    if (undo_count >= MAX_UNDO_STACK)
+    if (r->count == r->cap && !ring_grow(r))
+    {
+        if (r->count == 0)
+            return NULL;
+        /* Out of memory for more slots: recycle the oldest one */
+        ring_drop_oldest(r);
+    }
+    size_t off = arena_append(&r->arena, removed, removed_len);
+    if (off == (size_t)-1 || arena_append(&r->arena, inserted, inserted_len) == (size_t)-1)
     {
-        /* Stack full, discard oldest */
-        free_action(&undo_stack[0]);
-        memmove(&undo_stack[0], &undo_stack[1], sizeof(UndoAction) * (MAX_UNDO_STACK - 1));
-        undo_count = MAX_UNDO_STACK - 1;
+        r->arena.end = off == (size_t)-1 ? r->arena.end : off;
+        return NULL;
     }
+    UndoAction *a = ring_at(r, r->count);
+    a->type = type;
+    a->group = group;
+    a->line = line;
+    a->pos = pos;
+    a->off = off;
+    a->removed_len = removed_len;
+    a->inserted_len = inserted_len;
+    a->jend = 0;
+    r->count++;
+    r->bytes += action_cost(a);
+    enforce_budget(h);
+    /* enforce_budget only evicts older groups, so 'a' is still the newest slot */
+    return a;
+}
 
-    UndoAction *action = &undo_stack[undo_count++];
-    action->type = type;
-    action->line = line;
-    action->pos = pos;
-    action->data = data ? strdup(data) : NULL;
-    action->data2 = data2 ? strdup(data2) : NULL;
+/* Stop persisting: the rings keep working from memory only */
+static void drop_journal(UndoHistory *h)
+{
+    journal_close(h->journal);
+    h->journal = NULL;
+    h->disk_cursor = 0;
+    h->disk_skip = 0;
+    for (size_t i = 0; i < h->undo.count; ++i)
+        ring_at(&h->undo, i)->jend = 0;
 }
 
-void undo_push_insert_char(size_t line, size_t pos, const char *ch_utf8)
+/* Append a freshly pushed undo action to the journal */
+static void journal_action(UndoHistory *h, UndoAction *a)
 {
-    push_action(UNDO_INSERT_CHAR, line, pos, ch_utf8, NULL);
+    if (!h->journal || !a)
+        return;
+    const char *bytes = arena_ptr(&h->undo.arena, a->off);
+    a->jend = journal_append_action(h->journal, (int)a->type, a->group, a->line, a->pos,
+                                    bytes, a->removed_len, bytes + a->removed_len, a->inserted_len);
+    if (a->jend == 0)
+        drop_journal(h);
 }
 
-void undo_push_delete_char(size_t line, size_t pos, const char *ch_utf8)
+/* Copy the newest action of 'from' onto 'to'; NULL if memory ran out */
+static UndoAction *ring_copy_newest(UndoHistory *h, UndoRing *from, UndoRing *to)
 {
-    push_action(UNDO_DELETE_CHAR, line, pos, ch_utf8, NULL);
+    UndoAction a = *ring_newest(from);
+    const char *bytes = arena_ptr(&from->arena, a.off);
+    return ring_push(h, to, a.type, a.group, a.line, a.pos,
+                     bytes, a.removed_len, bytes + a.removed_len, a.inserted_len);
 }
 
-void undo_push_insert_line(size_t line, const char *left, const char *right)
+/* Return the buffer's history, creating it on first use */
+static UndoHistory *history(Buffer *b)
 {
-    push_action(UNDO_INSERT_LINE, line, 0, left, right);
+    if (!b->undo)
+        b->undo = (UndoHistory *)calloc(1, sizeof(UndoHistory));
+    return b->undo;
 }
 
-void undo_push_delete_line(size_t line, const char *deleted)
+void undo_history_free(Buffer *b)
 {
-    push_action(UNDO_DELETE_LINE, line, 0, deleted, NULL);
+    UndoHistory *h = b->undo;
+    if (!h)
+        return;
+    free(h->undo.items);
+    free(h->undo.arena.data);
+    free(h->redo.items);
+    free(h->redo.arena.data);
+    journal_close(h->journal);
+    free(h);
+    b->undo = NULL;
 }
 
-void undo_push_replace_line(size_t line, const char *old_content)
+void undo_set_budget(size_t bytes)
 {
-    push_action(UNDO_REPLACE_LINE, line, 0, old_content, NULL);
+    undo_budget = bytes;
 }
 
-void undo_push_replace_line_full(size_t line, const char *old_content, const char *new_content)
+void undo_set_persistent(int enabled)
 {
-    push_action(UNDO_REPLACE_LINE, line, 0, old_content, new_content);
+    undo_persistent = enabled;
 }
 
-int undo_can_undo(void)
+void undo_journal_open(Buffer *b, const char *path, uint64_t content_hash)
 {
-    return undo_count > 0;
+    if (!undo_persistent || !path)
+        return;
+    UndoHistory *h = history(b);
+    if (!h)
+        return;
+    drop_journal(h);
+    uint64_t history_end = 0;
+    h->journal = journal_open(path, content_hash, &history_end);
+    /* Older history is only usable while the rings hold nothing newer than it */
+    if (h->undo.count == 0 && h->redo.count == 0)
+        h->disk_cursor = history_end;
 }
 
-int undo_can_redo(void)
+void undo_journal_saved(Buffer *b, const char *path, uint64_t content_hash)
 {
-    return redo_count > 0;
+    if (!undo_persistent || !path)
+        return;
+    UndoHistory *h = history(b);
+    if (!h)
+        return;
+    const char *current = journal_file_path(h->journal);
+    char *wanted = journal_path_for(path);
+    int same = current && wanted && strcmp(current, wanted) == 0;
+    free(wanted);
+    if (!same)
+    {
+        /* Saved under a new name: history recorded so far stays in memory only */
+        drop_journal(h);
+        uint64_t ignored = 0;
+        h->journal = journal_open(path, content_hash, &ignored);
+    }
+    if (h->journal && journal_append_save(h->journal, content_hash) == 0)
+        drop_journal(h);
 }
 
-const UndoAction *undo_peek(void)
+void undo_set_journal_delay(int ms)
 {
-    if (undo_count == 0)
-        return NULL;
-    return &undo_stack[undo_count - 1];
+    journal_set_delay(ms);
 }
 
-const UndoAction *redo_peek(void)
+int undo_journal_has_unsaved(const Buffer *b)
 {
-    if (redo_count == 0)
-        return NULL;
-    return &redo_stack[redo_count - 1];
+    return b->undo && journal_unsaved(b->undo->journal) > 0;
 }
 
-void undo_pop(void)
+size_t undo_memory_used(const Buffer *b)
 {
-    if (undo_count > 0)
+    return b->undo ? b->undo->undo.bytes + b->undo->redo.bytes : 0;
+}
+
+void undo_begin_group(Buffer *b)
+{
+    UndoHistory *h = history(b);
+    if (h && h->group_depth++ == 0)
+        h->group = ++h->next_group;
+}
+
+void undo_end_group(Buffer *b)
+{
+    UndoHistory *h = b->undo;
+    if (h && h->group_depth > 0)
+        h->group_depth--;
+}
+
+/* New action entry point: picks the group id and clears the redo history */
+static void record(Buffer *b, UndoActionType type, size_t line, size_t pos,
+                   const char *removed, size_t removed_len,
+                   const char *inserted, size_t inserted_len)
+{
+    UndoHistory *h = history(b);
+    if (!h)
+        return;
+    ring_clear(&h->redo);
+    unsigned long group = h->group_depth > 0 ? h->group : ++h->next_group;
+    journal_action(h, ring_push(h, &h->undo, type, group, line, pos, removed, removed_len, inserted, inserted_len));
+}
+
+int undo_record_edit(Buffer *b, size_t line, size_t pos,
+                     const char *removed, size_t removed_len,
+                     const char *inserted, size_t inserted_len)
+{
+    size_t min_len = removed_len < inserted_len ? removed_len : inserted_len;
+
+    /* Trim the common prefix and suffix; what is left is the edited range */
+    size_t prefix = 0;
+    while (prefix < min_len && removed[prefix] == inserted[prefix])
+        prefix++;
+    if (prefix == removed_len && removed_len == inserted_len)
+        return 0;
+    size_t suffix = 0;
+    while (suffix < min_len - prefix && removed[removed_len - 1 - suffix] == inserted[inserted_len - 1 - suffix])
+        suffix++;
+
+    record(b, UNDO_EDIT, line, pos + prefix,
+           removed + prefix, removed_len - prefix - suffix,
+           inserted + prefix, inserted_len - prefix - suffix);
+    return 1;
+}
+
+int undo_record_line_change(Buffer *b, size_t line, const char *old_content, const char *new_content)
+{
+    return undo_record_edit(b, line, 0, old_content, strlen(old_content), new_content, strlen(new_content));
+}
+
+void undo_record_split(Buffer *b, size_t line, size_t pos)
+{
+    record(b, UNDO_SPLIT_LINE, line, pos, NULL, 0, NULL, 0);
+}
+
+void undo_record_join(Buffer *b, size_t line, size_t pos)
+{
+    record(b, UNDO_JOIN_LINE, line, pos, NULL, 0, NULL, 0);
+}
+
+/* Lines joined into one block, each followed by '\n'; *len receives the size */
+static char *join_lines(char *const *lines, size_t n, size_t *len)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i)
+        total += line_len(lines[i]) + 1;
+    char *out = (char *)malloc(total + 1);
+    if (!out)
+        return NULL;
+    char *p = out;
+    for (size_t i = 0; i < n; ++i)
     {
-        undo_count--;
-        free_action(&undo_stack[undo_count]);
+        size_t l = line_len(lines[i]);
+        memcpy(p, lines[i], l);
+        p[l] = '\n';
+        p += l + 1;
     }
+    *p = '\0';
+    *len = total;
+    return out;
 }
 
-void redo_pop(void)
+void undo_record_lines(Buffer *b, size_t line, char *const *old_lines, size_t old_n,
+                       char *const *new_lines, size_t new_n)
 {
-    if (redo_count > 0)
+    size_t old_len = 0, new_len = 0;
+    char *removed = join_lines(old_lines, old_n, &old_len);
+    char *inserted = join_lines(new_lines, new_n, &new_len);
+    if (removed && inserted)
+        record(b, UNDO_LINES, line, 0, removed, old_len, inserted, new_len);
+    free(removed);
+    free(inserted);
+}
+
+int undo_can_undo(const Buffer *b)
+{
+    return b->undo && (b->undo->undo.count > 0 || b->undo->disk_cursor > 0);
+}
+
+int undo_can_redo(const Buffer *b)
+{
+    return b->undo && b->undo->redo.count > 0;
+}
+
+/* Replace 'expect' at line:pos with 'with', editing the line in place.
+   Fails (returns 0) if the line no longer holds the expected bytes. */
+static int replace_bytes(Buffer *b, size_t line, size_t pos,
+                         const char *expect, size_t expect_len,
+                         const char *with, size_t with_len)
+{
+    if (line >= b->count)
+        return 0;
+    char *s = b->lines[line];
+    size_t len = line_len(s);
+    if (pos > len || expect_len > len - pos || memcmp(s + pos, expect, expect_len) != 0)
+        return 0;
+    buffer_own_lines(b);
+    s = line_writable(s, len - expect_len + with_len);
+    if (!s)
+        return 0;
+    b->lines[line] = s;
+    /* shift the tail and drop the replacement in */
+    memmove(s + pos + with_len, s + pos + expect_len, len - pos - expect_len);
+    memcpy(s + pos, with, with_len);
+    line_set_len(s, len - expect_len + with_len);
+    b->dirty = 1;
+    return 1;
+}
+
+static int split_line(Buffer *b, size_t line, size_t pos)
+{
+    if (line >= b->count || pos > line_len(b->lines[line]))
+        return 0;
+    buffer_own_lines(b);
+    char *left = line_writable(b->lines[line], pos);
+    if (!left)
+        return 0;
+    b->lines[line] = left;
+    char *right = line_new(left + pos, line_len(left) - pos);
+    if (!right)
+        return 0;
+    if (buffer_insert_line(b, line + 1, right) != 0)
     {
-        redo_count--;
-        free_action(&redo_stack[redo_count]);
+        line_release(right);
+        return 0;
     }
+    line_set_len(left, pos);
+    return 1;
 }
 
-void undo_push_to_redo(UndoAction *action)
+static int join_line(Buffer *b, size_t line, size_t pos)
 {
-    if (redo_count >= MAX_UNDO_STACK)
+    if (line + 1 >= b->count)
+        return 0;
+    size_t left_len = line_len(b->lines[line]);
+    size_t right_len = line_len(b->lines[line + 1]);
+    if (left_len != pos)
+        return 0;
+    buffer_own_lines(b);
+    char *joined = line_writable(b->lines[line], left_len + right_len);
+    if (!joined)
+        return 0;
+    memcpy(joined + left_len, b->lines[line + 1], right_len);
+    line_set_len(joined, left_len + right_len);
+    b->lines[line] = joined;
+    buffer_delete_line(b, line + 1);
+    return 1;
+}
+
+/* Replace the lines at 'line' that make up 'expect' with the lines in 'with' (both are
+   '\n'-terminated line blocks) in one splice. Fails if the lines don't match. */
+static int replace_lines(Buffer *b, size_t line, const char *expect, size_t expect_len,
+                         const char *with, size_t with_len)
+{
+    size_t remove = 0;
+    for (size_t at = 0; at < expect_len; ++remove)
+    {
+        const char *nl = (const char *)memchr(expect + at, '\n', expect_len - at);
+        size_t l = nl ? (size_t)(nl - (expect + at)) : expect_len - at;
+        if (line + remove >= b->count)
+            return 0;
+        const char *cur = b->lines[line + remove];
+        if (line_len(cur) != l || memcmp(cur, expect + at, l) != 0)
+            return 0;
+        at += l + 1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < with_len; ++i)
+        n += with[i] == '\n';
+    char **lines = (char **)malloc((n ? n : 1) * sizeof(char *));
+    if (!lines)
+        return 0;
+    size_t made = 0;
+    for (size_t at = 0; made < n; ++made)
     {
-        /* Stack full, discard oldest */
-        free_action(&redo_stack[0]);
-        memmove(&redo_stack[0], &redo_stack[1], sizeof(UndoAction) * (MAX_UNDO_STACK - 1));
-        redo_count = MAX_UNDO_STACK - 1;
+        const char *nl = (const char *)memchr(with + at, '\n', with_len - at);
+        size_t l = (size_t)(nl - (with + at));
+        lines[made] = line_new(with + at, l);
+        if (!lines[made])
+            break;
+        at += l + 1;
     }
+    int ok = made == n && buffer_splice_lines(b, line, remove, lines, n) == 0;
+    if (!ok)
+    {
+        for (size_t i = 0; i < made; ++i)
+            line_release(lines[i]);
+    }
+    free(lines);
+    return ok;
+}
 
-    redo_stack[redo_count++] = *action;
+/* Apply an action forwards (redo) or backwards (undo) */
+static int apply_action(Buffer *b, const UndoRing *r, const UndoAction *a, int forward, UndoResult *out)
+{
+    int ok = 0;
+    const char *removed = arena_ptr(&r->arena, a->off);
+    const char *inserted = removed + a->removed_len;
+    out->line = a->line;
+    out->col = a->pos;
+    out->structural = 0;
+    switch (a->type)
+    {
+    case UNDO_EDIT:
+        if (forward)
+            ok = replace_bytes(b, a->line, a->pos, removed, a->removed_len, inserted, a->inserted_len);
+        else
+            ok = replace_bytes(b, a->line, a->pos, inserted, a->inserted_len, removed, a->removed_len);
+        break;
+    case UNDO_SPLIT_LINE:
+        ok = forward ? split_line(b, a->line, a->pos) : join_line(b, a->line, a->pos);
+        out->structural = 1;
+        if (forward)
+        {
+            out->line = a->line + 1;
+            out->col = 0;
+        }
+        break;
+    case UNDO_JOIN_LINE:
+        ok = forward ? join_line(b, a->line, a->pos) : split_line(b, a->line, a->pos);
+        out->structural = 1;
+        if (!forward)
+        {
+            out->line = a->line + 1;
+            out->col = 0;
+        }
+        break;
+    case UNDO_LINES:
+        if (forward)
+            ok = replace_lines(b, a->line, removed, a->removed_len, inserted, a->inserted_len);
+        else
+            ok = replace_lines(b, a->line, inserted, a->inserted_len, removed, a->removed_len);
+        out->structural = 1;
+        out->col = 0;
+        break;
+    }
+    return ok;
 }
 
-void redo_push_to_undo(UndoAction *action)
+/* Apply every action of the newest group on 'from', moving each onto 'to'.
+   Undo walks the group newest-first; since that reverses the order on the
+   other ring, redo then replays it oldest-first. Each action is copied onto 'to'
+   before it is applied, so running out of memory stops the group with the rest
+   still on 'from' (out->incomplete) and both rings matching the text. */
+static int apply_group(Buffer *b, UndoRing *from, UndoRing *to, int forward, UndoResult *out)
 {
-    if (undo_count >= MAX_UNDO_STACK)
+    UndoHistory *h = b->undo;
+    UndoAction *a = ring_newest(from);
+    out->incomplete = 0;
+    if (!a)
+        return 0;
+    unsigned long group = a->group;
+    int structural = 0;
+    size_t applied = 0;
+    while ((a = ring_newest(from)) != NULL && a->group == group)
     {
-        /* Stack full, discard oldest */
-        free_action(&undo_stack[0]);
-        memmove(&undo_stack[0], &undo_stack[1], sizeof(UndoAction) * (MAX_UNDO_STACK - 1));
-        undo_count = MAX_UNDO_STACK - 1;
+        UndoAction *moved = ring_copy_newest(h, from, to);
+        if (!moved)
+        {
+            out->incomplete = 1;
+            break;
+        }
+        if (!apply_action(b, from, a, forward, out))
+        {
+            /* History no longer matches the buffer; discard the stale group */
+            ring_drop_newest(to);
+            while ((a = ring_newest(from)) != NULL && a->group == group)
+                ring_drop_newest(from);
+            break;
+        }
+        structural |= out->structural;
+        applied++;
+        ring_drop_newest(from);
+        /* Redone actions go back into the journal as new pushes */
+        if (to == &h->undo)
+            journal_action(h, moved);
     }
+    out->structural = structural;
+    return applied > 0;
+}
+
+/* Journal callback: queue one action of a group read back from disk */
+static void load_action(void *ctx, const JournalAction *ja)
+{
+    UndoHistory *h = (UndoHistory *)ctx;
+    UndoAction *a = ring_push(h, &h->undo, (UndoActionType)ja->type, h->next_group, ja->line, ja->pos,
+                              ja->removed, ja->removed_len, ja->inserted, ja->inserted_len);
+    if (a)
+        a->jend = ja->end;
+}
+
+/* Pull the next older group from the journal once the in-memory history runs dry */
+static void load_from_disk(UndoHistory *h)
+{
+    if (h->undo.count > 0 || h->disk_cursor == 0 || !h->journal)
+        return;
+    h->next_group++;
+    if (!journal_read_group(h->journal, &h->disk_cursor, &h->disk_skip, load_action, h))
+        h->disk_cursor = 0;
+}
+
+int undo_apply(Buffer *b, UndoResult *out)
+{
+    UndoHistory *h = b->undo;
+    if (!h || h->group_depth > 0)
+        return 0;
+    load_from_disk(h);
+    if (!apply_group(b, &h->undo, &h->redo, 0, out))
+        return 0;
+    /* An undo marker stands for a whole group: half of one cannot be recorded */
+    if (h->journal && (out->incomplete || journal_append_undo(h->journal) == 0))
+        drop_journal(h);
+    return 1;
+}
 
-    undo_stack[undo_count++] = *action;
+int redo_apply(Buffer *b, UndoResult *out)
+{
+    if (!b->undo || b->undo->group_depth > 0)
+        return 0;
+    return apply_group(b, &b->undo->redo, &b->undo->undo, 1, out);
+}
+
+size_t undo_journal_recover(Buffer *b, UndoResult *out)
+{
+    UndoHistory *h = b->undo;
+    size_t len = 0;
+    char *data = h && h->journal && h->group_depth == 0 ? journal_take_unsaved(h->journal, &len) : NULL;
+    if (!data)
+        return 0;
+    /* Replay in order: actions are applied and recorded anew (consecutive ones of one
+       group stay a group), undo markers undo the newest group as they did then */
+    size_t at = 0, replayed = 0;
+    uint64_t group = 0;
+    int kind = 0, in_group = 0;
+    JournalAction ja;
+    while (journal_next_record(data, len, &at, &kind, &ja))
+    {
+        if (kind == JOURNAL_RECORD_UNDO)
+        {
+            if (!undo_apply(b, out))
+                break;
+            replayed++;
+            in_group = 0;
+            continue;
+        }
+        if (kind != JOURNAL_RECORD_ACTION)
+            continue;
+        if (!in_group || ja.group != group)
+        {
+            h->next_group++;
+            group = ja.group;
+            in_group = 1;
+        }
+        ring_clear(&h->redo);
+        UndoAction *a = ring_push(h, &h->undo, (UndoActionType)ja.type, h->next_group, ja.line, ja.pos,
+                                  ja.removed, ja.removed_len, ja.inserted, ja.inserted_len);
+        if (!a)
+            break;
+        if (!apply_action(b, &h->undo, a, 1, out))
+        {
+            /* The buffer does not match what was recorded */
+            ring_drop_newest(&h->undo);
+            break;
+        }
+        journal_action(h, a);
+        replayed++;
+    }
+    free(data);
+    return replayed;
 }
 
-void undo_clear_redo(void)
+void undo_clear_redo(Buffer *b)
 {
-    for (size_t i = 0; i < redo_count; ++i)
-        free_action(&redo_stack[i]);
-    redo_count = 0;
+    if (b->undo)
+        ring_clear(&b->undo->redo);
 }
@@ -2,50 +2,87 @@
 #define VTE_UNDO_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include "buffer.h"
 
-/* Undo action types */
+/* Default memory budget shared by the undo and redo histories */
+#define UNDO_DEFAULT_BUDGET ((size_t)8 * 1024 * 1024)
+
+/* Undo action types. Records only describe what changed: an edit keeps the
+   byte range it replaced, splits and joins keep just a line and a byte offset. */
 typedef enum
 {
-    UNDO_INSERT_CHAR,  /* Single character insertion */
-    UNDO_DELETE_CHAR,  /* Single character deletion */
-    UNDO_INSERT_LINE,  /* Line break/split */
-    UNDO_DELETE_LINE,  /* Line join/deletion */
-    UNDO_REPLACE_LINE, /* Full line replacement */
+    UNDO_EDIT,       /* Bytes replaced inside one line (insertions and deletions) */
+    UNDO_SPLIT_LINE, /* Line broken in two at pos */
+    UNDO_JOIN_LINE,  /* Next line appended to line at pos */
+    UNDO_LINES,      /* Whole lines replaced from line on; bytes hold the lines, each ending in '\n' */
 } UndoActionType;
 
-/* A single undo action */
+/* Per-buffer history (see Buffer.undo); created on the first recorded action */
+typedef struct UndoHistory UndoHistory;
+
+/* Where the buffer changed after applying an undo or redo */
 typedef struct
 {
-    UndoActionType type;
-    size_t line; /* Line number where action occurred */
-    size_t pos;  /* Position within line (for char ops) */
-    char *data;  /* Saved data (character, line content, etc.) */
-    char *data2; /* Optional second data field (for line splits) */
-} UndoAction;
-
-/* Undo stack management */
-void undo_init(void);
-void undo_free(void);
-
-/* Record actions */
-void undo_push_insert_char(size_t line, size_t pos, const char *ch_utf8);
-void undo_push_delete_char(size_t line, size_t pos, const char *ch_utf8);
-void undo_push_insert_line(size_t line, const char *left, const char *right);
-void undo_push_delete_line(size_t line, const char *deleted);
-void undo_push_replace_line(size_t line, const char *old_content);
-void undo_push_replace_line_full(size_t line, const char *old_content, const char *new_content);
-
-/* Undo/redo operations - return 1 if action performed, 0 if stack empty */
-int undo_can_undo(void);
-int undo_can_redo(void);
-const UndoAction *undo_peek(void);
-const UndoAction *redo_peek(void);
-void undo_pop(void);                        /* Remove from undo stack after applying */
-void redo_pop(void);                        /* Remove from redo stack after applying */
-void undo_push_to_redo(UndoAction *action); /* Move action to redo stack */
-void redo_push_to_undo(UndoAction *action); /* Move action from redo to undo stack */
+    size_t line;    /* cursor line after the change */
+    size_t col;     /* cursor byte offset after the change */
+    int structural; /* 1 if lines were inserted or removed */
+    int incomplete; /* 1 if memory ran out part way; the rest of the group is still to apply */
+} UndoResult;
+
+/* Release a buffer's history */
+void undo_history_free(Buffer *b);
+
+/* Cap the memory held by each buffer's undo + redo history; oldest groups are discarded first */
+void undo_set_budget(size_t bytes);
+size_t undo_memory_used(const Buffer *b);
+
+/* Persistent history: when enabled, each action is also appended to a journal
+   next to the file (see undo_journal.h) and reloaded lazily when the file is
+   reopened with the same content. */
+void undo_set_persistent(int enabled);
+/* Attach the journal after loading 'path'; content_hash identifies the loaded text */
+void undo_journal_open(Buffer *b, const char *path, uint64_t content_hash);
+/* Mark the current history state as matching the file just written to 'path' */
+void undo_journal_saved(Buffer *b, const char *path, uint64_t content_hash);
+/* How long journal records gather before they are written out together */
+void undo_set_journal_delay(int ms);
+/* 1 if the journal holds changes to the loaded content that an earlier session
+   never saved. They are given up by the next recorded change, or replayed onto the
+   buffer (and into the history, as if just made) by undo_journal_recover(), which
+   returns how many changes it applied and where the last one was in *out. */
+int undo_journal_has_unsaved(const Buffer *b);
+size_t undo_journal_recover(Buffer *b, UndoResult *out);
+
+/* Transactions: actions recorded between begin and end (which may nest) form
+   one group that a single undo or redo applies as a whole. */
+void undo_begin_group(Buffer *b);
+void undo_end_group(Buffer *b);
+
+/* Record actions. Every new action clears the redo history. */
+/* Record the difference between two versions of a line; only the changed range is stored.
+   Returns 1 if the line changed, 0 if old and new are identical. */
+int undo_record_line_change(Buffer *b, size_t line, const char *old_content, const char *new_content);
+/* Same for a known range: 'removed' bytes at line:pos were replaced by 'inserted' */
+int undo_record_edit(Buffer *b, size_t line, size_t pos,
+                     const char *removed, size_t removed_len,
+                     const char *inserted, size_t inserted_len);
+void undo_record_split(Buffer *b, size_t line, size_t pos);
+void undo_record_join(Buffer *b, size_t line, size_t pos);
+/* Record that old_n lines starting at 'line' are about to be replaced by new_n lines
+   (paste, line deletion); call before changing the buffer. */
+void undo_record_lines(Buffer *b, size_t line, char *const *old_lines, size_t old_n,
+                       char *const *new_lines, size_t new_n);
+
+/* Undo/redo the newest group - return 1 if applied (maybe only part of it, see
+   UndoResult.incomplete), 0 if history empty, out of sync, out of memory or a group
+   is still open */
+int undo_can_undo(const Buffer *b);
+int undo_can_redo(const Buffer *b);
+int undo_apply(Buffer *b, UndoResult *out);
+int redo_apply(Buffer *b, UndoResult *out);
 
 /* Clear redo stack when new action is performed */
-void undo_clear_redo(void);
+void undo_clear_redo(Buffer *b);
 
 #endif /* VTE_UNDO_H */
@@ -0,0 +1,598 @@
+#include "undo_journal.h"
+#include "../platform/platform.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOURNAL_MAGIC "VTEUNDO1"
+#define JOURNAL_HEADER_SIZE 24 /* magic, offset of the last save marker, reserved */
+
+/* Record kinds */
+#define REC_ACTION JOURNAL_RECORD_ACTION
+#define REC_UNDO JOURNAL_RECORD_UNDO
+#define REC_SAVE JOURNAL_RECORD_SAVE
+
+/* Fixed part of an action record: kind, type, group, line, pos, removed_len, inserted_len */
+#define ACTION_FIXED (1 + 1 + 8 * 5)
+#define SAVE_SIZE (1 + 8 + 8 + 8)
+#define UNDO_SIZE (1 + 8)
+
+struct UndoJournal
+{
+    FILE *f;
+    char *path;
+    uint64_t end;       /* file length once everything queued is written */
+    uint64_t last_save; /* offset of the newest save marker, as in the header */
+    uint64_t unsaved;   /* records from here to 'end' were never saved to the file; 0 if none */
+    const char *map;    /* read-only view used to walk older history */
+    size_t map_len;
+    uint64_t wpos;      /* writer thread: file position, (uint64_t)-1 if unknown */
+    atomic_int failed;  /* writer thread: a write went wrong */
+};
+
+/* Records are written by one thread for all journals, so an edit costs a copy into
+   a queue instead of file I/O on the editor's thread. The queue is a single-producer
+   single-consumer linked list: the editor links items after 'tail', the writer
+   takes them from 'head' (always the last item it finished, or the stub). Once
+   woken, the writer lets a batch gather for 'delay_ms' and flushes it at once. */
+typedef struct JournalWrite
+{
+    _Atomic(struct JournalWrite *) next;
+    UndoJournal *j;
+    uint64_t off;
+    size_t len;
+    unsigned char data[];
+} JournalWrite;
+
+static struct
+{
+    PlatformThread *thread;
+    PlatformSignal *wake;  /* work arrived while the writer was idle, or a sync waits */
+    PlatformSignal *done;  /* the writer finished a batch */
+    JournalWrite *tail;    /* editor side */
+    JournalWrite *head;    /* writer side */
+    size_t queued;         /* editor side: items linked so far */
+    atomic_size_t written; /* items the writer has finished */
+    atomic_int idle;       /* the writer is about to sleep until woken */
+    atomic_int hurry;      /* a sync is waiting: skip the batching delay */
+    atomic_int delay_ms;
+} writer = {.delay_ms = JOURNAL_DEFAULT_DELAY_MS};
+static JournalWrite writer_stub; /* the queue's first 'head' */
+
+static void put_u64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+char *journal_path_for(const char *file_path)
+{
+    if (!file_path || !file_path[0])
+        return NULL;
+    const char *slash = strrchr(file_path, '/');
+#ifdef _WIN32
+    const char *bslash = strrchr(file_path, '\\');
+    if (bslash && (!slash || bslash > slash))
+        slash = bslash;
+#endif
+    size_t dir_len = slash ? (size_t)(slash - file_path) + 1 : 0;
+    const char *name = file_path + dir_len;
+    size_t n = dir_len + 1 + strlen(name) + strlen(".vteundo") + 1;
+    char *out = (char *)malloc(n);
+    if (!out)
+        return NULL;
+    snprintf(out, n, "%.*s.%s.vteundo", (int)dir_len, file_path, name);
+    return out;
+}
+
+void journal_set_delay(int ms)
+{
+    atomic_store(&writer.delay_ms, ms < 0 ? 0 : ms);
+}
+
+/* Write one item where it belongs; consecutive appends need no seek */
+static void write_item(JournalWrite *w)
+{
+    UndoJournal *j = w->j;
+    if (atomic_load(&j->failed))
+        return;
+    if (j->wpos != w->off && platform_seek_file(j->f, (long long)w->off, SEEK_SET) != 0)
+    {
+        atomic_store(&j->failed, 1);
+        j->wpos = (uint64_t)-1;
+        return;
+    }
+    if (fwrite(w->data, 1, w->len, j->f) != w->len)
+    {
+        atomic_store(&j->failed, 1);
+        j->wpos = (uint64_t)-1;
+        return;
+    }
+    j->wpos = w->off + w->len;
+}
+
+static void writer_main(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        atomic_store(&writer.idle, 1);
+        if (!atomic_load(&writer.head->next))
+            platform_signal_wait(writer.wake, -1);
+        atomic_store(&writer.idle, 0);
+        if (!atomic_load(&writer.hurry) && atomic_load(&writer.delay_ms) > 0)
+            platform_signal_wait(writer.wake, atomic_load(&writer.delay_ms));
+        JournalWrite *next;
+        UndoJournal *last = NULL;
+        size_t done = 0;
+        while ((next = atomic_load(&writer.head->next)) != NULL)
+        {
+            if (last && last != next->j && fflush(last->f) != 0)
+                atomic_store(&last->failed, 1);
+            write_item(next);
+            last = next->j;
+            if (writer.head != &writer_stub)
+                free(writer.head);
+            writer.head = next;
+            done++;
+        }
+        if (last && fflush(last->f) != 0)
+            atomic_store(&last->failed, 1);
+        /* Counted only once flushed: writer_sync() returning lets the main thread read,
+           close and free the journals these items went to */
+        atomic_fetch_add(&writer.written, done);
+        platform_signal_raise(writer.done);
+    }
+}
+
+static int writer_start(void)
+{
+    if (writer.thread)
+        return 1;
+    writer.wake = platform_signal_new();
+    writer.done = platform_signal_new();
+    atomic_init(&writer_stub.next, NULL);
+    writer.tail = writer.head = &writer_stub;
+    if (writer.wake && writer.done)
+        writer.thread = platform_thread_start(writer_main, NULL);
+    if (!writer.thread)
+    {
+        platform_signal_free(writer.wake);
+        platform_signal_free(writer.done);
+        writer.wake = writer.done = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Queue 'len' bytes for offset 'off' of j's file */
+static int queue_write(UndoJournal *j, uint64_t off, const void *data, size_t len)
+{
+    JournalWrite *w = (JournalWrite *)malloc(sizeof(JournalWrite) + len);
+    if (!w)
+        return 0;
+    atomic_init(&w->next, NULL);
+    w->j = j;
+    w->off = off;
+    w->len = len;
+    memcpy(w->data, data, len);
+    /* Linking the item and then checking 'idle' pairs with the writer setting 'idle'
+       and then checking the queue, as in input_queue.c */
+    atomic_store(&writer.tail->next, w);
+    writer.tail = w;
+    writer.queued++;
+    if (atomic_load(&writer.idle))
+        platform_signal_raise(writer.wake);
+    return 1;
+}
+
+/* Wait until everything queued so far is in the files */
+static void writer_sync(void)
+{
+    if (!writer.thread || atomic_load(&writer.written) == writer.queued)
+        return;
+    atomic_store(&writer.hurry, 1);
+    platform_signal_raise(writer.wake);
+    while (atomic_load(&writer.written) != writer.queued)
+        platform_signal_wait(writer.done, 10);
+    atomic_store(&writer.hurry, 0);
+}
+
+static int read_at(FILE *f, uint64_t off, void *dst, size_t n)
+{
+    if (platform_seek_file(f, (long long)off, SEEK_SET) != 0)
+        return 0;
+    return fread(dst, 1, n, f) == n;
+}
+
+static int write_header(UndoJournal *j, uint64_t last_save)
+{
+    unsigned char hdr[JOURNAL_HEADER_SIZE] = {0};
+    memcpy(hdr, JOURNAL_MAGIC, 8);
+    put_u64(hdr + 8, last_save);
+    j->last_save = last_save;
+    return queue_write(j, 0, hdr, sizeof(hdr));
+}
+
+/* Cut the file at 'len' (nothing of j may be queued) */
+static int cut_at(UndoJournal *j, uint64_t len)
+{
+    j->wpos = (uint64_t)-1;
+    if (platform_truncate_file(j->f, (size_t)len) != 0)
+        return 0;
+    j->end = len;
+    return 1;
+}
+
+static void drop_map(UndoJournal *j)
+{
+    platform_unmap_file(j->map, j->map_len);
+    j->map = NULL;
+    j->map_len = 0;
+}
+
+/* Offset of the newest save marker for 'hash', following the chain of save markers (0 if none) */
+static uint64_t find_save(UndoJournal *j, uint64_t hash)
+{
+    unsigned char hdr[JOURNAL_HEADER_SIZE];
+    if (!read_at(j->f, 0, hdr, sizeof(hdr)) || memcmp(hdr, JOURNAL_MAGIC, 8) != 0)
+        return 0;
+    uint64_t save = get_u64(hdr + 8);
+    while (save >= JOURNAL_HEADER_SIZE && save + SAVE_SIZE <= j->end)
+    {
+        unsigned char rec[SAVE_SIZE];
+        if (!read_at(j->f, save, rec, sizeof(rec)) || rec[0] != REC_SAVE)
+            return 0;
+        if (get_u64(rec + 1) == hash)
+            return save;
+        uint64_t prev = get_u64(rec + 9);
+        if (prev >= save)
+            return 0; /* corrupt chain */
+        save = prev;
+    }
+    return 0;
+}
+
+UndoJournal *journal_open(const char *file_path, uint64_t content_hash, uint64_t *history_end)
+{
+    *history_end = 0;
+    if (!writer_start())
+        return NULL;
+    char *path = journal_path_for(file_path);
+    if (!path)
+        return NULL;
+    FILE *f = fopen(path, "r+b");
+    if (!f)
+        f = fopen(path, "w+b");
+    if (!f)
+    {
+        free(path);
+        return NULL;
+    }
+    UndoJournal *j = (UndoJournal *)calloc(1, sizeof(UndoJournal));
+    if (!j)
+    {
+        fclose(f);
+        free(path);
+        return NULL;
+    }
+    j->f = f;
+    j->path = path;
+    j->wpos = (uint64_t)-1;
+    atomic_init(&j->failed, 0);
+    long long size;
+    if (platform_seek_file(f, 0, SEEK_END) == 0 && (size = platform_tell_file(f)) >= 0)
+        j->end = (uint64_t)size;
+
+    uint64_t save = j->end >= JOURNAL_HEADER_SIZE ? find_save(j, content_hash) : 0;
+    if (save == 0)
+    {
+        /* No history for this content: start over from a save marker for it, so the
+           edits that follow can be told apart from the file if they are never saved */
+        if (!cut_at(j, 0) || !write_header(j, 0))
+        {
+            journal_close(j);
+            return NULL;
+        }
+        j->end = JOURNAL_HEADER_SIZE;
+        if (journal_append_save(j, content_hash) == 0)
+        {
+            journal_close(j);
+            return NULL;
+        }
+    }
+    else
+    {
+        /* Edits recorded after the matching save were never written to the file: a
+           session ended without saving them. They stay until journal_take_unsaved()
+           or the next record. */
+        uint64_t keep = save + SAVE_SIZE;
+        j->last_save = save;
+        if (keep < j->end)
+            j->unsaved = keep;
+        *history_end = keep;
+    }
+    return j;
+}
+
+/* Drop the unsaved records (after a sync): cut the file back to the matching save */
+static int drop_unsaved(UndoJournal *j)
+{
+    uint64_t keep = j->unsaved;
+    j->unsaved = 0;
+    return cut_at(j, keep) && write_header(j, j->last_save);
+}
+
+uint64_t journal_unsaved(const UndoJournal *j)
+{
+    return j && j->unsaved ? j->end - j->unsaved : 0;
+}
+
+char *journal_take_unsaved(UndoJournal *j, size_t *len)
+{
+    if (!journal_unsaved(j))
+        return NULL;
+    writer_sync();
+    size_t n = (size_t)(j->end - j->unsaved);
+    char *data = (char *)malloc(n);
+    j->wpos = (uint64_t)-1;
+    if (!data || !read_at(j->f, j->unsaved, data, n))
+    {
+        free(data);
+        return NULL;
+    }
+    if (!drop_unsaved(j))
+        atomic_store(&j->failed, 1);
+    *len = n;
+    return data;
+}
+
+int journal_next_record(const char *data, size_t len, size_t *at, int *kind, JournalAction *a)
+{
+    const unsigned char *rec = (const unsigned char *)data + *at;
+    size_t left = len - *at;
+    if (*at >= len)
+        return 0;
+    uint64_t total;
+    *kind = rec[0];
+    if (*kind == REC_ACTION && left >= ACTION_FIXED + 8)
+    {
+        a->type = rec[1];
+        a->group = get_u64(rec + 2);
+        a->line = (size_t)get_u64(rec + 10);
+        a->pos = (size_t)get_u64(rec + 18);
+        a->removed_len = (size_t)get_u64(rec + 26);
+        a->inserted_len = (size_t)get_u64(rec + 34);
+        if (a->removed_len > left || a->inserted_len > left)
+            return 0;
+        a->removed = (const char *)rec + ACTION_FIXED;
+        a->inserted = a->removed + a->removed_len;
+        total = ACTION_FIXED + a->removed_len + a->inserted_len + 8;
+    }
+    else if (*kind == REC_UNDO)
+        total = UNDO_SIZE;
+    else if (*kind == REC_SAVE)
+        total = SAVE_SIZE;
+    else
+        return 0;
+    /* A record cut short by a crash ends the walk */
+    if (total > left || get_u64(rec + total - 8) != total)
+        return 0;
+    *at += (size_t)total;
+    a->end = *at;
+    return 1;
+}
+
+void journal_close(UndoJournal *j)
+{
+    if (!j)
+        return;
+    writer_sync();
+    drop_map(j);
+    if (j->f)
+        fclose(j->f);
+    free(j->path);
+    free(j);
+}
+
+const char *journal_file_path(const UndoJournal *j)
+{
+    return j ? j->path : NULL;
+}
+
+/* Recording something new gives up the unsaved records of the earlier session */
+static int give_up_unsaved(UndoJournal *j)
+{
+    if (!j->unsaved)
+        return 1;
+    writer_sync();
+    return drop_unsaved(j);
+}
+
+/* Queue one record (payload parts followed by the record length) at the end */
+static uint64_t append(UndoJournal *j, const unsigned char *head, size_t head_len,
+                       const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    if (atomic_load(&j->failed) || !give_up_unsaved(j))
+        return 0;
+    uint64_t total = head_len + a_len + b_len + 8;
+    unsigned char *rec = (unsigned char *)malloc((size_t)total);
+    if (!rec)
+        return 0;
+    memcpy(rec, head, head_len);
+    if (a_len)
+        memcpy(rec + head_len, a, a_len);
+    if (b_len)
+        memcpy(rec + head_len + a_len, b, b_len);
+    put_u64(rec + total - 8, total);
+    int ok = queue_write(j, j->end, rec, (size_t)total);
+    free(rec);
+    if (!ok)
+        return 0;
+    j->end += total;
+    return j->end;
+}
+
+uint64_t journal_append_action(UndoJournal *j, int type, uint64_t group, size_t line, size_t pos,
+                               const char *removed, size_t removed_len,
+                               const char *inserted, size_t inserted_len)
+{
+    unsigned char head[ACTION_FIXED];
+    head[0] = REC_ACTION;
+    head[1] = (unsigned char)type;
+    put_u64(head + 2, group);
+    put_u64(head + 10, line);
+    put_u64(head + 18, pos);
+    put_u64(head + 26, removed_len);
+    put_u64(head + 34, inserted_len);
+    return append(j, head, sizeof(head), removed, removed_len, inserted, inserted_len);
+}
+
+uint64_t journal_append_undo(UndoJournal *j)
+{
+    unsigned char head[1] = {REC_UNDO};
+    return append(j, head, sizeof(head), NULL, 0, NULL, 0);
+}
+
+uint64_t journal_append_save(UndoJournal *j, uint64_t content_hash)
+{
+    if (!give_up_unsaved(j))
+        return 0;
+    uint64_t at = j->end;
+    unsigned char head[1 + 8 + 8];
+    head[0] = REC_SAVE;
+    put_u64(head + 1, content_hash);
+    put_u64(head + 9, j->last_save);
+    uint64_t end = append(j, head, sizeof(head), NULL, 0, NULL, 0);
+    if (end == 0 || !write_header(j, at))
+        return 0;
+    return end;
+}
+
+/* Make sure the mapping covers [0, upto) */
+static int ensure_map(UndoJournal *j, uint64_t upto)
+{
+    if (j->map && upto <= j->map_len)
+        return 1;
+    drop_map(j);
+    writer_sync();
+    j->map = platform_map_file(j->path, &j->map_len);
+    return j->map && upto <= j->map_len;
+}
+
+/* Length of the action record at 'start' as its text lengths give it, checked to end
+   no later than 'limit' (so it stays in the mapping); 0 if it does not fit */
+static uint64_t action_len(const UndoJournal *j, uint64_t start, uint64_t limit)
+{
+    if (start >= limit || limit - start < ACTION_FIXED + 8)
+        return 0;
+    const unsigned char *rec = (const unsigned char *)j->map + start;
+    uint64_t room = limit - start - ACTION_FIXED - 8;
+    uint64_t removed = get_u64(rec + 26), inserted = get_u64(rec + 34);
+    if (removed > room || inserted > room - removed)
+        return 0;
+    uint64_t len = ACTION_FIXED + removed + inserted + 8;
+    return get_u64(rec + len - 8) == len ? len : 0;
+}
+
+/* Start offset and kind of the record ending at 'end', or 0 if malformed */
+static uint64_t record_start(const UndoJournal *j, uint64_t end, int *kind)
+{
+    if (end < JOURNAL_HEADER_SIZE + UNDO_SIZE)
+        return 0;
+    uint64_t len = get_u64((const unsigned char *)j->map + end - 8);
+    if (len < UNDO_SIZE || len > end - JOURNAL_HEADER_SIZE)
+        return 0;
+    uint64_t start = end - len;
+    *kind = (unsigned char)j->map[start];
+    if (*kind == REC_ACTION && action_len(j, start, end) != len)
+        return 0;
+    return start;
+}
+
+static uint64_t action_group(const UndoJournal *j, uint64_t start)
+{
+    return get_u64((const unsigned char *)j->map + start + 2);
+}
+
+int journal_read_group(UndoJournal *j, uint64_t *cursor, uint64_t *skip,
+                       void (*cb)(void *ctx, const JournalAction *a), void *ctx)
+{
+    if (!j || *cursor <= JOURNAL_HEADER_SIZE || !ensure_map(j, *cursor))
+        return 0;
+    uint64_t pos = *cursor;
+    while (pos > JOURNAL_HEADER_SIZE)
+    {
+        int kind = 0;
+        uint64_t start = record_start(j, pos, &kind);
+        if (start == 0)
+            return 0;
+        if (kind == REC_UNDO)
+        {
+            (*skip)++;
+            pos = start;
+            continue;
+        }
+        if (kind != REC_ACTION)
+        {
+            pos = start;
+            continue;
+        }
+        /* Extend backwards over the rest of this group's actions */
+        uint64_t group = action_group(j, start);
+        uint64_t first = start;
+        while (first > JOURNAL_HEADER_SIZE)
+        {
+            int k = 0;
+            uint64_t prev = record_start(j, first, &k);
+            if (prev == 0 || k != REC_ACTION || action_group(j, prev) != group)
+                break;
+            first = prev;
+        }
+        if (*skip > 0)
+        {
+            /* This group was undone later on */
+            (*skip)--;
+            pos = first;
+            continue;
+        }
+        /* Every record up to 'pos' has to join up before any is handed out: a torn or
+           corrupt one makes the group malformed */
+        for (uint64_t at = first; at < pos;)
+        {
+            uint64_t len = action_len(j, at, pos);
+            if (len == 0 || j->map[at] != REC_ACTION)
+                return 0;
+            at += len;
+        }
+        for (uint64_t at = first; at < pos;)
+        {
+            const unsigned char *rec = (const unsigned char *)j->map + at;
+            JournalAction a;
+            a.type = rec[1];
+            a.group = get_u64(rec + 2);
+            a.line = (size_t)get_u64(rec + 10);
+            a.pos = (size_t)get_u64(rec + 18);
+            a.removed_len = (size_t)get_u64(rec + 26);
+            a.inserted_len = (size_t)get_u64(rec + 34);
+            a.removed = (const char *)rec + ACTION_FIXED;
+            a.inserted = a.removed + a.removed_len;
+            at += ACTION_FIXED + a.removed_len + a.inserted_len + 8;
+            a.end = at;
+            cb(ctx, &a);
+        }
+        *cursor = first;
+        return 1;
+    }
+    *cursor = pos;
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef VTE_UNDO_JOURNAL_H
+#define VTE_UNDO_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Append-only on-disk undo journal kept next to a file as ".<name>.vteundo".
+
+   The journal is a stream of records: actions (as pushed onto the undo
+   history), undo markers (one group popped) and save markers carrying a hash
+   of the file content at that moment. Every record ends with its own length,
+   so the history can be walked backwards from any record boundary. Reopening
+   a file only reads the header and the save marker matching the file's hash;
+   older groups are read from a read-only mapping when undo reaches them. */
+
+typedef struct UndoJournal UndoJournal;
+
+/* Records are handed to a writer thread and reach the file in batches; the
+   writer waits this long after the first record of a batch. */
+#define JOURNAL_DEFAULT_DELAY_MS 200
+void journal_set_delay(int ms);
+
+/* Record kinds, as journal_next_record() reports them */
+enum
+{
+    JOURNAL_RECORD_ACTION = 1,
+    JOURNAL_RECORD_UNDO = 2,
+    JOURNAL_RECORD_SAVE = 3
+};
+
+/* One action read back from the journal; pointers stay valid until the next journal call */
+typedef struct
+{
+    int type;
+    uint64_t group;
+    size_t line;
+    size_t pos;
+    const char *removed;
+    size_t removed_len;
+    const char *inserted;
+    size_t inserted_len;
+    uint64_t end; /* journal offset just past this record */
+} JournalAction;
+
+/* Journal path for a file: ".<name>.vteundo" in the same directory. Caller frees. */
+char *journal_path_for(const char *file_path);
+
+/* Open (or create) the journal for 'file_path'. If a save marker matches 'content_hash',
+   *history_end is set to the marker so older history can be loaded; anything recorded
+   after it is kept as unsaved records (below) until the next record is appended.
+   Otherwise the journal is restarted and *history_end is 0. */
+UndoJournal *journal_open(const char *file_path, uint64_t content_hash, uint64_t *history_end);
+void journal_close(UndoJournal *j);
+const char *journal_file_path(const UndoJournal *j);
+
+/* Records after the matching save marker: changes a session made to this very file
+   content and never saved (it crashed or lost its terminal). journal_unsaved() is
+   their size in bytes, 0 if there are none. journal_take_unsaved() cuts them off and
+   returns a malloc'ed copy (caller frees) to walk with journal_next_record(), which
+   returns 0 at the end or at a record cut short. */
+uint64_t journal_unsaved(const UndoJournal *j);
+char *journal_take_unsaved(UndoJournal *j, size_t *len);
+int journal_next_record(const char *data, size_t len, size_t *at, int *kind, JournalAction *a);
+
+/* Append records. They are queued for the writer thread, so a crash loses at most
+   the last batch. Return the offset just past the new record, or 0 on failure (the
+   journal should then be dropped). */
+uint64_t journal_append_action(UndoJournal *j, int type, uint64_t group, size_t line, size_t pos,
+                               const char *removed, size_t removed_len,
+                               const char *inserted, size_t inserted_len);
+uint64_t journal_append_undo(UndoJournal *j);
+uint64_t journal_append_save(UndoJournal *j, uint64_t content_hash);
+
+/* Read the newest live group of the history that ends at *cursor, walking backwards
+   over undo markers (*skip counts groups still to be discarded). 'cb' receives the
+   group's actions oldest first. On success *cursor moves before the group and 1 is
+   returned; 0 means no older history. */
+int journal_read_group(UndoJournal *j, uint64_t *cursor, uint64_t *skip,
+                       void (*cb)(void *ctx, const JournalAction *a), void *ctx);
+
+#endif /* VTE_UNDO_JOURNAL_H */
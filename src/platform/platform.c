@@ -1,7 +1,16 @@
+#ifndef _WIN32
+/* 64-bit off_t for fseeko/ftello on 32-bit systems; before any system header */
+#define _FILE_OFFSET_BITS 64
+#endif
 #include "platform.h"
 
 #ifdef _WIN32
 #include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 void platform_init(void)
 {
@@ -18,8 +27,362 @@ void platform_cleanup(void)
     /* No cleanup needed on Windows currently */
 }
 
+const char *platform_map_file(const char *path, size_t *len)
+{
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER size;
+    const char *data = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping)
+        {
+            data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); /* the view keeps the mapping alive */
+            if (data)
+                *len = (size_t)size.QuadPart;
+        }
+    }
+    CloseHandle(file);
+    return data;
+}
+
+void platform_unmap_file(const char *data, size_t len)
+{
+    (void)len;
+    if (data)
+        UnmapViewOfFile(data);
+}
+
+int platform_seek_file(FILE *f, long long off, int whence)
+{
+    return _fseeki64(f, (__int64)off, whence) == 0 ? 0 : -1;
+}
+
+long long platform_tell_file(FILE *f)
+{
+    return (long long)_ftelli64(f);
+}
+
+int platform_truncate_file(FILE *f, size_t len)
+{
+    fflush(f);
+    return _chsize_s(_fileno(f), (__int64)len) == 0 ? 0 : -1;
+}
+
+struct PlatformSaveFile
+{
+    int fd;
+    char *path;
+    char *tmp; /* NULL when writing in place */
+};
+
+PlatformSaveFile *platform_save_begin(const char *path)
+{
+    PlatformSaveFile *f = (PlatformSaveFile *)calloc(1, sizeof(*f));
+    if (!f)
+        return NULL;
+    size_t n = strlen(path);
+    f->path = _strdup(path);
+    f->tmp = (char *)malloc(n + 16);
+    f->fd = -1;
+    if (!f->path || !f->tmp)
+    {
+        platform_save_abort(f);
+        return NULL;
+    }
+    /* A name nobody else is using, next to the file */
+    for (int i = 0; i < 100 && f->fd < 0; ++i)
+    {
+        snprintf(f->tmp, n + 16, "%s.vte%d~", path, i);
+        f->fd = _open(f->tmp, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+    }
+    if (f->fd < 0)
+    {
+        free(f->tmp);
+        f->tmp = NULL;
+        f->fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+    }
+    if (f->fd < 0)
+    {
+        platform_save_abort(f);
+        return NULL;
+    }
+    return f;
+}
+
+int platform_save_write(PlatformSaveFile *f, const PlatformChunk *chunks, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        const char *p = (const char *)chunks[i].data;
+        size_t left = chunks[i].len;
+        while (left > 0)
+        {
+            unsigned int part = left > 0x40000000 ? 0x40000000 : (unsigned int)left;
+            int w = _write(f->fd, p, part);
+            if (w <= 0)
+                return -1;
+            p += w;
+            left -= (size_t)w;
+        }
+    }
+    return 0;
+}
+
+int platform_save_commit(PlatformSaveFile *f, int sync)
+{
+    int ok = !(sync && _commit(f->fd) != 0);
+    if (_close(f->fd) != 0)
+        ok = 0;
+    f->fd = -1;
+    if (f->tmp && ok &&
+        !MoveFileExA(f->tmp, f->path, MOVEFILE_REPLACE_EXISTING | (sync ? MOVEFILE_WRITE_THROUGH : 0)))
+        ok = 0;
+    if (ok && f->tmp)
+    {
+        free(f->tmp);
+        f->tmp = NULL;
+    }
+    platform_save_abort(f);
+    return ok ? 0 : -1;
+}
+
+void platform_save_abort(PlatformSaveFile *f)
+{
+    if (!f)
+        return;
+    if (f->fd >= 0)
+        _close(f->fd);
+    if (f->tmp)
+        _unlink(f->tmp);
+    free(f->tmp);
+    free(f->path);
+    free(f);
+}
+
+int platform_file_stamp(const char *path, long long *mtime, long long *size)
+{
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &info))
+        return -1;
+    /* FILETIME counts 100 ns steps */
+    *mtime = (long long)(((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) |
+                         info.ftLastWriteTime.dwLowDateTime) * 100;
+    *size = (long long)(((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow);
+    return 0;
+}
+
+/* No change notification yet: the editor compares stamps instead */
+PlatformWatch *platform_watch_new(void)
+{
+    return NULL;
+}
+
+void platform_watch_free(PlatformWatch *w)
+{
+    (void)w;
+}
+
+int platform_watch_add(PlatformWatch *w, const char *path)
+{
+    (void)w;
+    (void)path;
+    return -1;
+}
+
+void platform_watch_remove(PlatformWatch *w, const char *path)
+{
+    (void)w;
+    (void)path;
+}
+
+int platform_watch_changed(PlatformWatch *w)
+{
+    (void)w;
+    return 0;
+}
+
+long platform_now_ms(void)
+{
+    return (long)GetTickCount64();
+}
+
+long long platform_now_us(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (long long)(now.QuadPart / freq.QuadPart * 1000000 + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+}
+
+void platform_sleep_ms(int ms)
+{
+    Sleep((DWORD)ms);
+}
+
+struct PlatformThread
+{
+    HANDLE handle;
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+static DWORD WINAPI thread_entry(LPVOID p)
+{
+    PlatformThread *t = (PlatformThread *)p;
+    t->fn(t->arg);
+    return 0;
+}
+
+PlatformThread *platform_thread_start(void (*fn)(void *arg), void *arg)
+{
+    PlatformThread *t = (PlatformThread *)calloc(1, sizeof(PlatformThread));
+    if (!t)
+        return NULL;
+    t->fn = fn;
+    t->arg = arg;
+    t->handle = CreateThread(NULL, 0, thread_entry, t, 0, NULL);
+    if (!t->handle)
+    {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void platform_thread_join(PlatformThread *t)
+{
+    if (!t)
+        return;
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    free(t);
+}
+
+struct PlatformSignal
+{
+    HANDLE event;
+};
+
+PlatformSignal *platform_signal_new(void)
+{
+    PlatformSignal *s = (PlatformSignal *)calloc(1, sizeof(PlatformSignal));
+    if (!s)
+        return NULL;
+    s->event = CreateEventA(NULL, FALSE, FALSE, NULL); /* auto-reset */
+    if (!s->event)
+    {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void platform_signal_free(PlatformSignal *s)
+{
+    if (!s)
+        return;
+    CloseHandle(s->event);
+    free(s);
+}
+
+void platform_signal_raise(PlatformSignal *s)
+{
+    SetEvent(s->event);
+}
+
+int platform_signal_wait(PlatformSignal *s, int timeout_ms)
+{
+    DWORD wait = timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms;
+    return WaitForSingleObject(s->event, wait) == WAIT_OBJECT_0;
+}
+
+int platform_stdin_take(void)
+{
+    if (_isatty(0))
+        return -1;
+    HANDLE con = CreateFileA("CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                             OPEN_EXISTING, 0, NULL);
+    if (con == INVALID_HANDLE_VALUE)
+        return -1;
+    int data = _dup(0);
+    int fd = _open_osfhandle((intptr_t)con, _O_RDONLY);
+    if (data < 0 || fd < 0)
+    {
+        if (data >= 0)
+            _close(data);
+        if (fd >= 0)
+            _close(fd);
+        else
+            CloseHandle(con);
+        return -1;
+    }
+    _setmode(data, _O_BINARY);
+    _dup2(fd, 0);
+    _close(fd);
+    /* PDCurses reads the console through the standard handle */
+    SetStdHandle(STD_INPUT_HANDLE, (HANDLE)_get_osfhandle(0));
+    return data;
+}
+
+long platform_read_fd(int fd, void *buf, size_t cap)
+{
+    return _read(fd, buf, cap > 0x40000000 ? 0x40000000 : (unsigned int)cap);
+}
+
+void platform_close_fd(int fd)
+{
+    _close(fd);
+}
+
+int platform_input_open(void)
+{
+    return -1; /* PDCurses keeps reading the console itself */
+}
+
+int platform_read_input(unsigned char *buf, size_t cap, int timeout_ms, int *resized)
+{
+    (void)buf;
+    (void)cap;
+    (void)timeout_ms;
+    (void)resized;
+    return -1;
+}
+
+int platform_terminal_size(int *rows, int *cols)
+{
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info))
+        return -1;
+    *rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+    *cols = info.srWindow.Right - info.srWindow.Left + 1;
+    return 0;
+}
+
 #else
 /* Unix/Linux/macOS */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 void platform_init(void)
 {
@@ -31,4 +394,560 @@ void platform_cleanup(void)
     /* No cleanup needed on Unix currently */
 }
 
+const char *platform_map_file(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    const char *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            data = (const char *)p;
+            *len = (size_t)st.st_size;
+        }
+    }
+    close(fd); /* the mapping stays valid after close */
+    return data;
+}
+
+void platform_unmap_file(const char *data, size_t len)
+{
+    if (data)
+        munmap((void *)data, len);
+}
+
+int platform_seek_file(FILE *f, long long off, int whence)
+{
+    return fseeko(f, (off_t)off, whence) == 0 ? 0 : -1;
+}
+
+long long platform_tell_file(FILE *f)
+{
+    return (long long)ftello(f);
+}
+
+int platform_truncate_file(FILE *f, size_t len)
+{
+    fflush(f);
+    return ftruncate(fileno(f), (off_t)len);
+}
+
+struct PlatformSaveFile
+{
+    int fd;
+    char *path; /* the file being replaced, symlinks resolved */
+    char *tmp;  /* NULL when writing in place */
+};
+
+/* Buffers per writev() call; IOV_MAX is at least this on every system we build on */
+#define SAVE_IOV 1024
+
+PlatformSaveFile *platform_save_begin(const char *path)
+{
+    PlatformSaveFile *f = (PlatformSaveFile *)calloc(1, sizeof(*f));
+    if (!f)
+        return NULL;
+    f->fd = -1;
+    /* Replace what a symlink points to, not the link; a new file has no real path yet */
+    char *real = realpath(path, NULL);
+    f->path = strdup(real ? real : path);
+    free(real);
+    if (!f->path)
+    {
+        platform_save_abort(f);
+        return NULL;
+    }
+    size_t n = strlen(f->path);
+    const char *slash = strrchr(f->path, '/');
+    int dir = slash ? (int)(slash - f->path + 1) : 0;
+    f->tmp = (char *)malloc(n + 16);
+    if (f->tmp)
+    {
+        snprintf(f->tmp, n + 16, "%.*s.%s.XXXXXX", dir, f->path, f->path + dir);
+        f->fd = mkstemp(f->tmp);
+    }
+    if (f->fd >= 0)
+    {
+        /* mkstemp makes the file 0600: give it the original's mode and owner */
+        struct stat st;
+        if (stat(f->path, &st) == 0)
+        {
+            fchmod(f->fd, st.st_mode & 07777);
+            if (fchown(f->fd, st.st_uid, st.st_gid) != 0)
+            {
+                /* not ours to give away; the file keeps our ownership */
+            }
+        }
+        else
+        {
+            mode_t mask = umask(0);
+            umask(mask);
+            fchmod(f->fd, 0666 & ~mask);
+        }
+    }
+    else
+    {
+        free(f->tmp);
+        f->tmp = NULL;
+        f->fd = open(f->path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (f->fd < 0)
+    {
+        platform_save_abort(f);
+        return NULL;
+    }
+    return f;
+}
+
+int platform_save_write(PlatformSaveFile *f, const PlatformChunk *chunks, size_t n)
+{
+    struct iovec iov[SAVE_IOV];
+    size_t i = 0;
+    while (i < n)
+    {
+        int cnt = 0;
+        for (; cnt < SAVE_IOV && i < n; ++cnt, ++i)
+        {
+            iov[cnt].iov_base = (void *)chunks[i].data;
+            iov[cnt].iov_len = chunks[i].len;
+        }
+        struct iovec *v = iov;
+        while (cnt > 0)
+        {
+            ssize_t w = writev(f->fd, v, cnt);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            /* A short write ends somewhere in the batch: go on from there */
+            while (cnt > 0 && (size_t)w >= v->iov_len)
+            {
+                w -= (ssize_t)v->iov_len;
+                v++;
+                cnt--;
+            }
+            if (cnt > 0)
+            {
+                v->iov_base = (char *)v->iov_base + w;
+                v->iov_len -= (size_t)w;
+            }
+        }
+    }
+    return 0;
+}
+
+int platform_save_commit(PlatformSaveFile *f, int sync)
+{
+    int ok = !(sync && fsync(f->fd) != 0);
+    if (close(f->fd) != 0)
+        ok = 0;
+    f->fd = -1;
+    if (f->tmp && ok && rename(f->tmp, f->path) != 0)
+        ok = 0;
+    if (ok && f->tmp)
+    {
+        if (sync)
+        {
+            /* The rename is only durable once the directory is flushed too */
+            char *slash = strrchr(f->path, '/');
+            if (slash)
+                *slash = '\0';
+            int dfd = open(slash ? (f->path[0] ? f->path : "/") : ".", O_RDONLY);
+            if (dfd >= 0)
+            {
+                fsync(dfd);
+                close(dfd);
+            }
+        }
+        free(f->tmp);
+        f->tmp = NULL;
+    }
+    platform_save_abort(f);
+    return ok ? 0 : -1;
+}
+
+void platform_save_abort(PlatformSaveFile *f)
+{
+    if (!f)
+        return;
+    if (f->fd >= 0)
+        close(f->fd);
+    if (f->tmp)
+        unlink(f->tmp);
+    free(f->tmp);
+    free(f->path);
+    free(f);
+}
+
+int platform_file_stamp(const char *path, long long *mtime, long long *size)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return -1;
+#ifdef __APPLE__
+    *mtime = (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    *mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    *size = (long long)st.st_size;
+    return 0;
+}
+
+#ifdef __linux__
+/* One inotify watch per directory; each file in it is an entry with its name */
+#define WATCH_FILES 32
+
+struct PlatformWatch
+{
+    int fd;
+    struct
+    {
+        int wd;
+        char *given;      /* path as passed to add() */
+        char *path;       /* resolved */
+        const char *name; /* inside path */
+    } files[WATCH_FILES];
+    size_t count;
+};
+
+PlatformWatch *platform_watch_new(void)
+{
+    PlatformWatch *w = (PlatformWatch *)calloc(1, sizeof(PlatformWatch));
+    if (!w)
+        return NULL;
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0)
+    {
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+void platform_watch_free(PlatformWatch *w)
+{
+    if (!w)
+        return;
+    for (size_t i = 0; i < w->count; ++i)
+    {
+        free(w->files[i].given);
+        free(w->files[i].path);
+    }
+    close(w->fd);
+    free(w);
+}
+
+int platform_watch_add(PlatformWatch *w, const char *path)
+{
+    if (w->count == WATCH_FILES)
+        return -1;
+    char *given = strdup(path);
+    char *full = given ? realpath(path, NULL) : NULL;
+    if (!full)
+    {
+        free(given);
+        return -1;
+    }
+    char *slash = strrchr(full, '/');
+    /* realpath() gives an absolute path, so there is a slash; "/" is the root's directory */
+    *slash = '\0';
+    int wd = inotify_add_watch(w->fd, slash == full ? "/" : full,
+                               IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+    *slash = '/';
+    if (wd < 0)
+    {
+        free(given);
+        free(full);
+        return -1;
+    }
+    w->files[w->count].wd = wd;
+    w->files[w->count].given = given;
+    w->files[w->count].path = full;
+    w->files[w->count].name = slash + 1;
+    w->count++;
+    return 0;
+}
+
+void platform_watch_remove(PlatformWatch *w, const char *path)
+{
+    /* by the name it was added under: the file itself may be gone by now */
+    for (size_t i = 0; i < w->count; ++i)
+    {
+        if (strcmp(w->files[i].given, path) != 0)
+            continue;
+        int wd = w->files[i].wd, shared = 0;
+        free(w->files[i].given);
+        free(w->files[i].path);
+        w->files[i] = w->files[--w->count];
+        for (size_t j = 0; j < w->count; ++j)
+            shared |= w->files[j].wd == wd;
+        if (!shared)
+            inotify_rm_watch(w->fd, wd);
+        break;
+    }
+}
+
+int platform_watch_changed(PlatformWatch *w)
+{
+    union
+    {
+        struct inotify_event ev;
+        char bytes[4096];
+    } buf;
+    int changed = 0;
+    ssize_t n;
+    while ((n = read(w->fd, buf.bytes, sizeof(buf.bytes))) > 0)
+    {
+        for (ssize_t at = 0; at < n;)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)(buf.bytes + at);
+            at += (ssize_t)(sizeof(struct inotify_event) + ev->len);
+            if (ev->mask & IN_Q_OVERFLOW)
+                changed = 1; /* events were lost: anything may have changed */
+            for (size_t i = 0; i < w->count && !changed; ++i)
+                changed = w->files[i].wd == ev->wd && ev->len > 0 && strcmp(w->files[i].name, ev->name) == 0;
+        }
+    }
+    return changed;
+}
+#else
+/* No change notification on this system: the editor compares stamps instead */
+PlatformWatch *platform_watch_new(void)
+{
+    return NULL;
+}
+
+void platform_watch_free(PlatformWatch *w)
+{
+    (void)w;
+}
+
+int platform_watch_add(PlatformWatch *w, const char *path)
+{
+    (void)w;
+    (void)path;
+    return -1;
+}
+
+void platform_watch_remove(PlatformWatch *w, const char *path)
+{
+    (void)w;
+    (void)path;
+}
+
+int platform_watch_changed(PlatformWatch *w)
+{
+    (void)w;
+    return 0;
+}
+#endif
+
+long platform_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long platform_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void platform_sleep_ms(int ms)
+{
+    poll(NULL, 0, ms);
+}
+
+struct PlatformThread
+{
+    pthread_t id;
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+static void *thread_entry(void *p)
+{
+    PlatformThread *t = (PlatformThread *)p;
+    t->fn(t->arg);
+    return NULL;
+}
+
+PlatformThread *platform_thread_start(void (*fn)(void *arg), void *arg)
+{
+    PlatformThread *t = (PlatformThread *)calloc(1, sizeof(PlatformThread));
+    if (!t)
+        return NULL;
+    t->fn = fn;
+    t->arg = arg;
+    if (pthread_create(&t->id, NULL, thread_entry, t) != 0)
+    {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void platform_thread_join(PlatformThread *t)
+{
+    if (!t)
+        return;
+    pthread_join(t->id, NULL);
+    free(t);
+}
+
+/* A pipe: raise() writes a byte, wait() polls for it and drains the pipe */
+struct PlatformSignal
+{
+    int fds[2];
+};
+
+PlatformSignal *platform_signal_new(void)
+{
+    PlatformSignal *s = (PlatformSignal *)calloc(1, sizeof(PlatformSignal));
+    if (!s)
+        return NULL;
+    if (pipe(s->fds) != 0)
+    {
+        free(s);
+        return NULL;
+    }
+    fcntl(s->fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(s->fds[1], F_SETFL, O_NONBLOCK);
+    return s;
+}
+
+void platform_signal_free(PlatformSignal *s)
+{
+    if (!s)
+        return;
+    close(s->fds[0]);
+    close(s->fds[1]);
+    free(s);
+}
+
+void platform_signal_raise(PlatformSignal *s)
+{
+    char c = 1;
+    ssize_t n = write(s->fds[1], &c, 1); /* a full pipe is already raised */
+    (void)n;
+}
+
+int platform_signal_wait(PlatformSignal *s, int timeout_ms)
+{
+    struct pollfd p = {s->fds[0], POLLIN, 0};
+    if (poll(&p, 1, timeout_ms) <= 0)
+        return 0;
+    char drain[64];
+    while (read(s->fds[0], drain, sizeof(drain)) > 0)
+        ;
+    return 1;
+}
+
+int platform_stdin_take(void)
+{
+    if (isatty(STDIN_FILENO))
+        return -1;
+    int tty = open("/dev/tty", O_RDONLY);
+    if (tty < 0)
+        return -1;
+    int data = dup(STDIN_FILENO);
+    if (data < 0 || dup2(tty, STDIN_FILENO) < 0)
+    {
+        if (data >= 0)
+            close(data);
+        close(tty);
+        return -1;
+    }
+    close(tty);
+    fcntl(data, F_SETFD, FD_CLOEXEC);
+    return data;
+}
+
+long platform_read_fd(int fd, void *buf, size_t cap)
+{
+    for (;;)
+    {
+        ssize_t n = read(fd, buf, cap);
+        if (n >= 0)
+            return (long)n;
+        if (errno != EINTR)
+            return -1;
+    }
+}
+
+void platform_close_fd(int fd)
+{
+    close(fd);
+}
+
+/* SIGWINCH only writes to a pipe; the input thread notices it in poll() */
+static int resize_pipe[2] = {-1, -1};
+
+static void on_sigwinch(int sig)
+{
+    (void)sig;
+    char c = 1;
+    ssize_t n = write(resize_pipe[1], &c, 1);
+    (void)n;
+}
+
+int platform_input_open(void)
+{
+    if (resize_pipe[0] >= 0)
+        return 0;
+    if (pipe(resize_pipe) != 0)
+        return -1;
+    fcntl(resize_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(resize_pipe[1], F_SETFL, O_NONBLOCK);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigwinch;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGWINCH, &sa, NULL);
+}
+
+int platform_read_input(unsigned char *buf, size_t cap, int timeout_ms, int *resized)
+{
+    struct pollfd p[2] = {{STDIN_FILENO, POLLIN, 0}, {resize_pipe[0], POLLIN, 0}};
+    int r = poll(p, 2, timeout_ms);
+    if (r < 0)
+        return errno == EINTR ? 0 : -1;
+    if (p[1].revents & POLLIN)
+    {
+        char drain[64];
+        while (read(resize_pipe[0], drain, sizeof(drain)) > 0)
+            ;
+        *resized = 1;
+    }
+    if (p[0].revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        ssize_t n = read(STDIN_FILENO, buf, cap);
+        if (n > 0)
+            return (int)n;
+        if (n == 0 || (errno != EINTR && errno != EAGAIN))
+            return -1;
+    }
+    return 0;
+}
+
+int platform_terminal_size(int *rows, int *cols)
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_row == 0 || ws.ws_col == 0)
+        return -1;
+    *rows = ws.ws_row;
+    *cols = ws.ws_col;
+    return 0;
+}
+
 #endif
@@ -1,6 +1,9 @@
 #ifndef VTE_PLATFORM_H
 #define VTE_PLATFORM_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 /* Platform abstraction layer for cross-platform compatibility */
 
 /* Initialize platform-specific terminal/console settings */
@@ -9,4 +12,88 @@ void platform_init(void);
 /* Cleanup platform-specific resources */
 void platform_cleanup(void);
 
+/* Map a whole file read-only. Returns NULL on failure or for an empty file. */
+const char *platform_map_file(const char *path, size_t *len);
+void platform_unmap_file(const char *data, size_t len);
+
+/* Seek and tell with 64-bit offsets (a long is 32 bits on Windows); seek returns 0
+   on success, tell -1 on failure */
+int platform_seek_file(FILE *f, long long off, int whence);
+long long platform_tell_file(FILE *f);
+
+/* Cut an open file down to 'len' bytes; returns 0 on success */
+int platform_truncate_file(FILE *f, size_t len);
+
+/* Replacing a file safely: the new content goes to a temporary file in the same
+   directory, which commit renames over the original once it is complete, so a
+   crash mid-save leaves the old file intact. If no file can be made next to it
+   (read-only directory) the original is written in place. Symlinks are followed. */
+typedef struct PlatformSaveFile PlatformSaveFile;
+typedef struct
+{
+    const void *data;
+    size_t len;
+} PlatformChunk;
+PlatformSaveFile *platform_save_begin(const char *path);
+/* Write n chunks in order (gathered into few system calls); returns 0 on success */
+int platform_save_write(PlatformSaveFile *f, const PlatformChunk *chunks, size_t n);
+/* Finish and put the file in place, flushed to disk first if 'sync'; returns 0 on
+   success. On failure, and always for abort, the temporary file is removed. */
+int platform_save_commit(PlatformSaveFile *f, int sync);
+void platform_save_abort(PlatformSaveFile *f);
+
+/* A file's modification time (ns) and size, to notice when another program changed
+   it. Returns 0 on success, -1 if the file is not there. */
+int platform_file_stamp(const char *path, long long *mtime, long long *size);
+
+/* Change notification for files (inotify on Linux). platform_watch_new() returns
+   NULL where there is none; callers then compare stamps now and then instead.
+   add() watches the directory holding 'path' (symlinks resolved), so a file
+   replaced by a rename is seen as well as one written in place; returns 0 on
+   success. remove() undoes an add() of the same path. changed() never blocks:
+   1 if a watched file was written, replaced or removed since the last call. */
+typedef struct PlatformWatch PlatformWatch;
+PlatformWatch *platform_watch_new(void);
+void platform_watch_free(PlatformWatch *w);
+int platform_watch_add(PlatformWatch *w, const char *path);
+void platform_watch_remove(PlatformWatch *w, const char *path);
+int platform_watch_changed(PlatformWatch *w);
+
+/* Milliseconds from a monotonic clock; only differences are meaningful */
+long platform_now_ms(void);
+/* Same clock in microseconds, for timing short stretches of work */
+long long platform_now_us(void);
+void platform_sleep_ms(int ms);
+
+/* Threads */
+typedef struct PlatformThread PlatformThread;
+PlatformThread *platform_thread_start(void (*fn)(void *arg), void *arg);
+void platform_thread_join(PlatformThread *t);
+
+/* Wakeup between threads: raise() from one side ends a wait() on the other.
+   wait() returns 1 if raised, 0 after timeout_ms (-1 = no limit). */
+typedef struct PlatformSignal PlatformSignal;
+PlatformSignal *platform_signal_new(void);
+void platform_signal_free(PlatformSignal *s);
+void platform_signal_raise(PlatformSignal *s);
+int platform_signal_wait(PlatformSignal *s, int timeout_ms);
+
+/* Standard input as data (vte -): if it is not the terminal, it is handed over as a
+   descriptor for platform_read_fd() and the terminal (console) takes its place, so
+   keys still come in. Returns -1 if stdin is the terminal or cannot be swapped. */
+int platform_stdin_take(void);
+/* Read what is there, up to cap bytes, waiting for at least one; returns the count,
+   0 at the end of the data and -1 on error */
+long platform_read_fd(int fd, void *buf, size_t cap);
+void platform_close_fd(int fd);
+
+/* Raw terminal input, for reading keys off the main thread (Unix only).
+   platform_input_open() takes over SIGWINCH and returns 0 on success.
+   platform_read_input() waits up to timeout_ms (-1 = no limit) and returns the
+   number of bytes read, 0 on timeout and -1 once input is gone; *resized is set
+   when the terminal size changed in the meantime. */
+int platform_input_open(void);
+int platform_read_input(unsigned char *buf, size_t cap, int timeout_ms, int *resized);
+int platform_terminal_size(int *rows, int *cols);
+
 #endif /* VTE_PLATFORM_H */
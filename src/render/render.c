@@ -0,0 +1,195 @@
+#include "render.h"
+#include "../internal/wrap.h"
+#include <curses.h>
+#include <stdlib.h>
+#if defined(PDC_WIDE) || defined(NCURSES_WIDECHAR) || defined(_XOPEN_SOURCE_EXTENDED)
+#include <wchar.h>
+#define VTE_WIDE_CURSES 1
+#endif
+
+/* curses backend: stdscr is the back buffer and doupdate() does the diffing */
+
+static int curses_open(void)
+{
+    /* Whatever was on screen before is unknown to curses' picture of it */
+    clearok(curscr, TRUE);
+    return 0;
+}
+
+static void curses_close(void)
+{
+}
+
+#ifdef VTE_WIDE_CURSES
+/* One row of cells, composed here and copied into the window with a single
+   mvadd_wchnstr(): no format parsing or per-character output processing */
+static cchar_t *row_cells;
+static int row_cap;
+
+static void curses_text(int row, int col, const char *s, size_t len, int width)
+{
+    if (width <= 0)
+        return;
+    if (width > row_cap)
+    {
+        cchar_t *nc = (cchar_t *)realloc(row_cells, (size_t)width * sizeof(cchar_t));
+        if (!nc)
+            return;
+        row_cells = nc;
+        row_cap = width;
+    }
+    wchar_t wch[CCHARW_MAX + 1];
+    int nw = 0; /* characters in the cell being filled */
+    int n = 0;
+    size_t i = 0;
+    while (i < len && s[i])
+    {
+        int cp = 0;
+        int adv = wrap_decode(s + i, &cp);
+        if (adv <= 0 || i + (size_t)adv > len)
+            break;
+        i += (size_t)adv;
+        if (wrap_char_width(cp) == 0)
+        {
+            /* Combining marks join the previous cell; controls are not shown */
+            if (cp >= 0x300 && nw > 0 && nw < CCHARW_MAX)
+                wch[nw++] = (wchar_t)cp;
+            continue;
+        }
+        if (nw > 0)
+        {
+            wch[nw] = L'\0';
+            setcchar(&row_cells[n++], wch, A_NORMAL, 0, NULL);
+        }
+        if (n >= width)
+        {
+            nw = 0;
+            break;
+        }
+        wch[0] = (wchar_t)cp;
+        nw = 1;
+    }
+    if (nw > 0)
+    {
+        wch[nw] = L'\0';
+        setcchar(&row_cells[n++], wch, A_NORMAL, 0, NULL);
+    }
+    wch[0] = L' ';
+    wch[1] = L'\0';
+    for (; n < width; ++n)
+        setcchar(&row_cells[n], wch, A_NORMAL, 0, NULL);
+    mvadd_wchnstr(row, col, row_cells, width);
+}
+#else
+static void curses_text(int row, int col, const char *s, size_t len, int width)
+{
+    if (width <= 0)
+        return;
+    /* Bytes of 's' that fit in 'width' cells */
+    size_t bytes = 0;
+    int cells = 0;
+    while (bytes < len && s[bytes])
+    {
+        int cp = 0;
+        int adv = wrap_decode(s + bytes, &cp);
+        int w = wrap_char_width(cp);
+        if (adv <= 0 || bytes + (size_t)adv > len || cells + w > width)
+            break;
+        bytes += (size_t)adv;
+        cells += w;
+    }
+    mvaddnstr(row, col, s, (int)bytes);
+    if (cells < width)
+        mvhline(row, col + cells, ' ', width - cells);
+}
+#endif
+
+static void curses_highlight(int row, int col, int width)
+{
+    if (width > 0)
+        mvchgat(row, col, width, A_REVERSE, 0, NULL);
+}
+
+static void curses_clear(void)
+{
+    erase();
+}
+
+static void curses_invalidate(void)
+{
+    clearok(curscr, TRUE);
+}
+
+static void curses_flush(int cursor_row, int cursor_col)
+{
+    if (cursor_row >= 0)
+        move(cursor_row, cursor_col);
+    /* Batch updates for smoother rendering and apply after final cursor move */
+    wnoutrefresh(stdscr);
+    doupdate();
+    curs_set(cursor_row >= 0 ? 1 : 0);
+}
+
+const RenderBackend render_curses_backend = {
+    "curses",
+    curses_open,
+    curses_close,
+    curses_text,
+    curses_highlight,
+    curses_clear,
+    curses_invalidate,
+    curses_flush,
+};
+
+static const RenderBackend *backend = &render_curses_backend;
+
+void render_init(int direct)
+{
+    const RenderBackend *want = &render_curses_backend;
+    if (direct && render_vt_backend)
+        want = render_vt_backend;
+    if (want == backend)
+        return;
+    backend->close();
+    if (want->open() != 0)
+        want = &render_curses_backend;
+    if (want == &render_curses_backend)
+        want->open();
+    backend = want;
+}
+
+void render_shutdown(void)
+{
+    backend->close();
+    backend = &render_curses_backend;
+}
+
+const char *render_backend_name(void)
+{
+    return backend->name;
+}
+
+void render_text(int row, int col, const char *s, size_t len, int width)
+{
+    backend->text(row, col, s, len, width);
+}
+
+void render_highlight(int row, int col, int width)
+{
+    backend->highlight(row, col, width);
+}
+
+void render_clear(void)
+{
+    backend->clear_all();
+}
+
+void render_invalidate(void)
+{
+    backend->invalidate();
+}
+
+void render_flush(int cursor_row, int cursor_col)
+{
+    backend->flush(cursor_row, cursor_col);
+}
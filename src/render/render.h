@@ -0,0 +1,45 @@
+#ifndef VTE_RENDER_H
+#define VTE_RENDER_H
+
+#include <stddef.h>
+
+/* Screen output. Everything the editor draws goes through here to one of two
+   backends: curses, or a direct VT100 renderer that keeps its own cell grid and
+   sends only what changed. Drawing is retained like a curses window: cells keep
+   their contents until overwritten, and render_flush() puts them on screen. */
+
+/* Backend interface */
+typedef struct RenderBackend
+{
+    const char *name;
+    int (*open)(void);   /* returns 0 if usable */
+    void (*close)(void);
+    void (*text)(int row, int col, const char *s, size_t len, int width);
+    void (*highlight)(int row, int col, int width);
+    void (*clear_all)(void);
+    void (*invalidate)(void);
+    void (*flush)(int cursor_row, int cursor_col);
+} RenderBackend;
+
+extern const RenderBackend render_curses_backend;
+/* NULL where the terminal is not driven through ncurses */
+extern const RenderBackend *const render_vt_backend;
+
+/* Pick the backend after initscr(): the VT100 renderer if 'direct' is set and it
+   is available, curses otherwise. Can be called again to switch. */
+void render_init(int direct);
+void render_shutdown(void);
+const char *render_backend_name(void);
+
+/* Draw UTF-8 text at row/col, clipped to 'width' cells and padded with spaces up to it */
+void render_text(int row, int col, const char *s, size_t len, int width);
+/* Show 'width' cells from row/col in reverse video until text is drawn over them */
+void render_highlight(int row, int col, int width);
+/* Blank the whole screen */
+void render_clear(void);
+/* Repaint everything on the next flush, e.g. after a resize */
+void render_invalidate(void);
+/* Show the drawn frame and leave the cursor at row/col (row < 0 hides it) */
+void render_flush(int cursor_row, int cursor_col);
+
+#endif /* VTE_RENDER_H */
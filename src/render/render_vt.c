@@ -0,0 +1,320 @@
+#include "render.h"
+#include "../internal/wrap.h"
+#include <curses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef NCURSES_VERSION
+#include <unistd.h>
+
+/* Direct VT100 renderer. 'back' holds what the editor drew, 'front' what the
+   terminal shows; a flush sends only the cells that differ, with as few cursor
+   moves as it can, wrapped in a synchronized update (DEC mode 2026) so the
+   terminal never shows half a frame. curses still sets up the terminal and is
+   never asked to refresh while this backend is active. */
+
+/* One cell: a character plus any combining marks, as UTF-8 */
+typedef struct
+{
+    unsigned char len;
+    unsigned char reverse; /* shown in reverse video */
+    char ch[7];
+} Cell;
+
+static const Cell blank = {1, 0, " "};
+
+static Cell *front;
+static Cell *back;
+static int grid_rows = 0, grid_cols = 0;
+static int full_repaint = 1;
+static int cur_row = -1, cur_col = -1; /* terminal cursor, -1 when unknown */
+static int cur_reverse = 0;            /* reverse video is on in the terminal */
+static int shown_row = -1, shown_col = -1; /* cursor as left by the last flush */
+
+static char *out;
+static size_t out_len = 0, out_cap = 0;
+
+static void out_put(const char *s, size_t n)
+{
+    if (out_len + n > out_cap)
+    {
+        size_t ncap = out_cap ? out_cap : 4096;
+        while (ncap < out_len + n)
+            ncap *= 2;
+        char *nb = (char *)realloc(out, ncap);
+        if (!nb)
+            return;
+        out = nb;
+        out_cap = ncap;
+    }
+    memcpy(out + out_len, s, n);
+    out_len += n;
+}
+
+static void out_str(const char *s)
+{
+    out_put(s, strlen(s));
+}
+
+static void out_num(int n)
+{
+    char tmp[12];
+    int i = sizeof(tmp);
+    do
+    {
+        tmp[--i] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0 && i > 0);
+    out_put(tmp + i, sizeof(tmp) - (size_t)i);
+}
+
+static int cell_eq(const Cell *a, const Cell *b)
+{
+    return a->len == b->len && a->reverse == b->reverse && memcmp(a->ch, b->ch, a->len) == 0;
+}
+
+static void fill(Cell *cells, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        cells[i] = blank;
+}
+
+/* Follow the terminal size; a new size starts from a blank screen */
+static int ensure_grid(void)
+{
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    if (rows == grid_rows && cols == grid_cols && back)
+        return 1;
+    size_t n = (size_t)rows * (size_t)cols;
+    Cell *nf = (Cell *)malloc(n * sizeof(Cell));
+    Cell *nb = (Cell *)malloc(n * sizeof(Cell));
+    if (!nf || !nb)
+    {
+        free(nf);
+        free(nb);
+        return 0;
+    }
+    free(front);
+    free(back);
+    front = nf;
+    back = nb;
+    fill(front, n);
+    fill(back, n);
+    grid_rows = rows;
+    grid_cols = cols;
+    full_repaint = 1;
+    return 1;
+}
+
+static void move_to(int row, int col)
+{
+    if (row == cur_row && col == cur_col)
+        return;
+    if (row == cur_row && cur_col >= 0 && col > cur_col)
+    {
+        out_str("\033[");
+        if (col - cur_col > 1)
+            out_num(col - cur_col);
+        out_put("C", 1);
+    }
+    else if (col == 0 && row == cur_row && cur_col >= 0)
+        out_put("\r", 1);
+    else if (col == 0 && row == cur_row + 1 && cur_row >= 0 && cur_col >= 0)
+        out_put("\r\n", 2);
+    else
+    {
+        out_str("\033[");
+        out_num(row + 1);
+        if (col > 0)
+        {
+            out_put(";", 1);
+            out_num(col + 1);
+        }
+        out_put("H", 1);
+    }
+    cur_row = row;
+    cur_col = col;
+}
+
+static int vt_open(void)
+{
+    if (!isatty(STDOUT_FILENO) || !ensure_grid())
+        return -1;
+    /* Own alternate screen; curses only switches to it on its first refresh */
+    fputs("\033[?1049h", stdout);
+    fflush(stdout);
+    full_repaint = 1;
+    cur_row = cur_col = -1;
+    cur_reverse = 0;
+    shown_row = shown_col = -1;
+    return 0;
+}
+
+static void vt_close(void)
+{
+    fputs("\033[?25h\033[?1049l", stdout);
+    fflush(stdout);
+    free(front);
+    free(back);
+    free(out);
+    front = back = NULL;
+    out = NULL;
+    out_len = out_cap = 0;
+    grid_rows = grid_cols = 0;
+}
+
+static void vt_text(int row, int col, const char *s, size_t len, int width)
+{
+    if (!ensure_grid() || row < 0 || row >= grid_rows || col < 0 || col >= grid_cols)
+        return;
+    if (width > grid_cols - col)
+        width = grid_cols - col;
+    Cell *cells = back + (size_t)row * grid_cols + col;
+    int n = 0;
+    size_t i = 0;
+    while (i < len && s[i])
+    {
+        int cp = 0;
+        int adv = wrap_decode(s + i, &cp);
+        if (adv <= 0 || i + (size_t)adv > len)
+            break;
+        if (wrap_char_width(cp) == 0)
+        {
+            /* Combining marks join the previous cell; controls are not shown */
+            if (cp >= 0x300 && n > 0 && cells[n - 1].len + adv <= (int)sizeof(cells[0].ch))
+            {
+                memcpy(cells[n - 1].ch + cells[n - 1].len, s + i, (size_t)adv);
+                cells[n - 1].len += (unsigned char)adv;
+            }
+            i += (size_t)adv;
+            continue;
+        }
+        if (n >= width)
+            break;
+        Cell *c = &cells[n++];
+        c->reverse = 0;
+        if (adv == 1 && cp >= 0x80)
+        {
+            /* Not valid UTF-8: don't pass stray bytes to the terminal */
+            c->len = 1;
+            c->ch[0] = '?';
+        }
+        else
+        {
+            c->len = (unsigned char)adv;
+            memcpy(c->ch, s + i, (size_t)adv);
+        }
+        i += (size_t)adv;
+    }
+    for (; n < width; ++n)
+        cells[n] = blank;
+}
+
+static void vt_highlight(int row, int col, int width)
+{
+    if (!ensure_grid() || row < 0 || row >= grid_rows || col < 0)
+        return;
+    Cell *cells = back + (size_t)row * grid_cols;
+    for (int c = col; c < col + width && c < grid_cols; ++c)
+        cells[c].reverse = 1;
+}
+
+static void vt_clear(void)
+{
+    if (ensure_grid())
+        fill(back, (size_t)grid_rows * grid_cols);
+}
+
+static void vt_invalidate(void)
+{
+    full_repaint = 1;
+}
+
+static void vt_flush(int cursor_row, int cursor_col)
+{
+    if (!ensure_grid())
+        return;
+    out_len = 0;
+    out_str("\033[?2026h\033[?25l");
+    size_t frame_start = out_len;
+    if (full_repaint)
+    {
+        out_str("\033[m\033[H\033[2J");
+        fill(front, (size_t)grid_rows * grid_cols);
+        cur_row = cur_col = 0;
+        cur_reverse = 0;
+        full_repaint = 0;
+    }
+    for (int r = 0; r < grid_rows; ++r)
+    {
+        Cell *b = back + (size_t)r * grid_cols;
+        Cell *f = front + (size_t)r * grid_cols;
+        int c = 0;
+        while (c < grid_cols)
+        {
+            if (cell_eq(&b[c], &f[c]))
+            {
+                c++;
+                continue;
+            }
+            /* Take short stretches of unchanged cells along rather than jumping over them */
+            int last = c;
+            for (int e = c + 1; e < grid_cols && e - last <= 4; ++e)
+                if (!cell_eq(&b[e], &f[e]))
+                    last = e;
+            move_to(r, c);
+            for (int k = c; k <= last; ++k)
+            {
+                if (b[k].reverse != cur_reverse)
+                {
+                    out_str(b[k].reverse ? "\033[7m" : "\033[m");
+                    cur_reverse = b[k].reverse;
+                }
+                out_put(b[k].ch, b[k].len);
+                f[k] = b[k];
+            }
+            c = last + 1;
+            cur_col = c;
+            if (cur_col >= grid_cols)
+                cur_row = cur_col = -1; /* pending autowrap: position unknown */
+        }
+    }
+    if (out_len == frame_start && cursor_row == shown_row && cursor_col == shown_col)
+        return; /* nothing changed */
+    if (cur_reverse)
+    {
+        out_str("\033[m");
+        cur_reverse = 0;
+    }
+    if (cursor_row >= 0)
+    {
+        move_to(cursor_row, cursor_col);
+        out_str("\033[?25h");
+    }
+    out_str("\033[?2026l");
+    fwrite(out, 1, out_len, stdout);
+    fflush(stdout);
+    shown_row = cursor_row;
+    shown_col = cursor_col;
+}
+
+static const RenderBackend vt_backend = {
+    "vt",
+    vt_open,
+    vt_close,
+    vt_text,
+    vt_highlight,
+    vt_clear,
+    vt_invalidate,
+    vt_flush,
+};
+
+const RenderBackend *const render_vt_backend = &vt_backend;
+
+#else
+
+const RenderBackend *const render_vt_backend = NULL;
+
+#endif